@@ -0,0 +1,317 @@
+// Async.cpp : Executors, the epoll reactor and the blocking call pool.
+//
+
+#include "../include/CRH_Async.h"
+
+#if defined(_WIN32) | defined(WIN32)
+#   include <Windows.h>
+#   include <chrono>
+#else
+#   include <errno.h>
+#   include <fcntl.h>
+#   include <sys/epoll.h>
+#   include <sys/eventfd.h>
+#   include <unistd.h>
+#endif
+
+namespace crunchy
+{
+namespace async
+{
+    // ===============================
+    // -------------------------------
+    //      THREAD POOL
+
+    thread_pool::thread_pool(unsigned threads)
+        : stopping(false)
+    {
+        if (threads == 0) {
+            threads = std::thread::hardware_concurrency();
+        }
+        if (threads == 0) {
+            threads = 1;
+        }
+
+        workers.reserve(threads);
+        for (unsigned i = 0; i < threads; ++i) {
+            workers.push_back(std::thread(&thread_pool::work, this));
+        }
+    }
+
+
+    thread_pool::~thread_pool()
+    {
+        stop();
+    }
+
+
+    void thread_pool::post(task_fn fn, void *arg)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        if (CRUNCHY_UNLIKELY(stopping)) {
+            // No workers left to hand it to
+            guard.unlock();
+            fn(arg);
+            return;
+        }
+
+        job_t j = { fn, arg };
+        jobs.push_back(j);
+        guard.unlock();
+        wake.notify_one();
+    }
+
+
+    void thread_pool::stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (size_t i = 0; i < workers.size(); ++i) {
+            if (workers[i].joinable()) {
+                workers[i].join();
+            }
+        }
+    }
+
+
+    void thread_pool::work()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;) {
+            while (jobs.empty() && !stopping) {
+                wake.wait(guard);
+            }
+            if (jobs.empty()) {
+                return;
+            }
+
+            job_t j = jobs.front();
+            jobs.pop_front();
+
+            guard.unlock();
+            j.fn(j.arg);
+            guard.lock();
+        }
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      REACTOR
+
+    namespace
+    {
+        void noop(void *) {}
+    }
+
+
+    reactor::reactor()
+        : stopped(false), poller(-1), waker(-1)
+    {
+#if !(defined(_WIN32) | defined(WIN32))
+        int ep = epoll_create1(EPOLL_CLOEXEC);
+        int ev = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        struct epoll_event e = {};
+        e.events   = EPOLLIN;
+        e.data.ptr = NULL; // The waker is the only registration without a waiter
+
+        if (CRUNCHY_UNLIKELY(ep < 0 || ev < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, ev, &e) != 0)) {
+            if (ep >= 0) close(ep);
+            if (ev >= 0) close(ev);
+            state = IOexception::set_error(IOexception::io_errc::cannot_bind_socket);
+            return;
+        }
+        poller = ep;
+        waker  = ev;
+#endif
+    }
+
+
+    reactor::~reactor()
+    {
+#if !(defined(_WIN32) | defined(WIN32))
+        if (poller >= 0) close((int)poller);
+        if (waker >= 0)  close((int)waker);
+#endif
+    }
+
+
+    void reactor::post(task_fn fn, void *arg)
+    {
+        bool first;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            first = posted.empty();
+            job_t j = { fn, arg };
+            posted.push_back(j);
+        }
+
+        // Only the post that starts a batch wakes the loop, the rest ride along
+        if (first) {
+#if defined(_WIN32) | defined(WIN32)
+            wake.notify_one();
+#else
+            uint64_t one = 1;
+            ssize_t n = write((int)waker, &one, sizeof(one));
+            (void)n;
+#endif
+        }
+    }
+
+
+    std::error_code reactor::watch(int fd, uint32_t events, fd_waiter_t *w)
+    {
+#if defined(_WIN32) | defined(WIN32)
+        (void)fd; (void)events; (void)w;
+        return std::make_error_code(std::errc::not_supported);
+#else
+        if (CRUNCHY_UNLIKELY(poller < 0)) {
+            return state;
+        }
+
+        struct epoll_event e = {};
+        e.events   = EPOLLONESHOT;
+        if (events & ASYNC_READABLE) e.events |= EPOLLIN;
+        if (events & ASYNC_WRITABLE) e.events |= EPOLLOUT;
+        e.data.ptr = w;
+        w->events  = 0;
+
+        // A one shot fd stays registered after it fires, re-arm it and only add it the first time
+        if (epoll_ctl((int)poller, EPOLL_CTL_MOD, fd, &e) == 0) {
+            return std::error_code();
+        }
+        if (errno == ENOENT && epoll_ctl((int)poller, EPOLL_CTL_ADD, fd, &e) == 0) {
+            return std::error_code();
+        }
+        return std::error_code(errno, std::system_category());
+#endif
+    }
+
+
+    void reactor::unwatch(int fd)
+    {
+#if defined(_WIN32) | defined(WIN32)
+        (void)fd;
+#else
+        if (poller >= 0) {
+            struct epoll_event e = {};
+            epoll_ctl((int)poller, EPOLL_CTL_DEL, fd, &e);
+        }
+#endif
+    }
+
+
+    size_t reactor::drain()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (posted.empty()) {
+                return 0;
+            }
+            running.swap(posted);
+        }
+
+        size_t n = running.size();
+        for (size_t i = 0; i < n; ++i) {
+            running[i].fn(running[i].arg);
+        }
+        running.clear();
+        return n;
+    }
+
+
+    size_t reactor::run_once(int timeoutMs)
+    {
+        size_t ran = drain();
+
+#if defined(_WIN32) | defined(WIN32)
+        if (ran == 0 && !stopped.load(std::memory_order_acquire)) {
+            std::unique_lock<std::mutex> guard(lock);
+            if (posted.empty()) {
+                if (timeoutMs < 0) {
+                    wake.wait(guard);
+                }
+                else {
+                    wake.wait_for(guard, std::chrono::milliseconds(timeoutMs));
+                }
+            }
+        }
+#else
+        if (CRUNCHY_UNLIKELY(poller < 0)) {
+            return ran;
+        }
+
+        struct epoll_event events[64];
+        int n = epoll_wait((int)poller, events, 64, ran ? 0 : timeoutMs);
+        for (int i = 0; i < n; ++i) {
+            fd_waiter_t *w = (fd_waiter_t *)events[i].data.ptr;
+            if (w == NULL) {
+                uint64_t count;
+                ssize_t r = read((int)waker, &count, sizeof(count));
+                (void)r;
+                continue;
+            }
+
+            uint32_t ready = 0;
+            if (events[i].events & EPOLLIN)               ready |= ASYNC_READABLE;
+            if (events[i].events & EPOLLOUT)              ready |= ASYNC_WRITABLE;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) ready |= ASYNC_HANGUP;
+
+            w->events = ready;
+            w->fn(w->arg);
+            ++ran;
+        }
+#endif
+
+        return ran + drain();
+    }
+
+
+    void reactor::run()
+    {
+        while (!stopped.load(std::memory_order_acquire)) {
+            run_once(-1);
+        }
+        stopped.store(false, std::memory_order_release);
+    }
+
+
+    void reactor::stop()
+    {
+        stopped.store(true, std::memory_order_release);
+        post(&noop, NULL);
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      BLOCKING POOL
+
+    namespace
+    {
+        std::atomic<executor *> pool_override(NULL);
+    }
+
+
+    executor &blocking_pool()
+    {
+        executor *pool = pool_override.load(std::memory_order_acquire);
+        if (pool == NULL) {
+            static thread_pool shared;
+            return shared;
+        }
+        return *pool;
+    }
+
+
+    void set_blocking_pool(executor *pool)
+    {
+        pool_override.store(pool, std::memory_order_release);
+    }
+}
+}
@@ -0,0 +1,65 @@
+// Crc32.cpp : CRC32 (IEEE), shared by the CRN snapshot and the load generator.
+//
+
+#include "../include/CRH_Snapshot.h"
+#include <string.h>
+
+namespace crunchy
+{
+namespace snapshot
+{
+    namespace
+    {
+        struct crc_tables
+        {
+            uint32_t t[8][256];
+
+            crc_tables()
+            {
+                for (uint32_t i = 0; i < 256; ++i) {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; ++k) {
+                        c = (c & 1) ? (c >> 1) ^ 0xEDB88320UL : (c >> 1);
+                    }
+                    t[0][i] = c;
+                }
+                for (uint32_t i = 0; i < 256; ++i) {
+                    for (int s = 1; s < 8; ++s) {
+                        t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+                    }
+                }
+            }
+        };
+
+        const crc_tables &tables()
+        {
+            static crc_tables tbl;
+            return tbl;
+        }
+    }
+
+
+    uint32_t crc32(const void *data, size_t len, uint32_t crc)
+    {
+        const crc_tables &tbl = tables();
+        const unsigned char *p = (const unsigned char *)data;
+        crc = ~crc;
+
+        while (len >= 8) {
+            uint32_t lo, hi;
+            memcpy(&lo, p, 4);
+            memcpy(&hi, p + 4, 4);
+            lo ^= crc;
+            crc = tbl.t[7][lo & 0xFF] ^ tbl.t[6][(lo >> 8) & 0xFF] ^ tbl.t[5][(lo >> 16) & 0xFF] ^ tbl.t[4][lo >> 24] ^
+                  tbl.t[3][hi & 0xFF] ^ tbl.t[2][(hi >> 8) & 0xFF] ^ tbl.t[1][(hi >> 16) & 0xFF] ^ tbl.t[0][hi >> 24];
+            p   += 8;
+            len -= 8;
+        }
+        while (len--) {
+            crc = tbl.t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        }
+
+        return ~crc;
+    }
+}
+}
@@ -0,0 +1,49 @@
+// Crn.cpp : createCRNData() and hasCRNInstance(), the CRN entry points of CRH_Int.h.
+//
+
+#include "../include/CRH_Snapshot.h"
+#include "../include/CRH_Int.h"
+#include <mutex>
+
+namespace crunchy
+{
+    std::string crn::stdCRN;
+    struct crn crn::current = {};
+    has_prp_int has_prp_int_t;
+
+
+    void createCRNData()
+    {
+        // Registers and pages come from the attached sources, see snapshot::capture()
+        snapshot::crn_instance_t inst = {};
+        inst.default_crn = crn::current.default_crn;
+        inst.stdCRN      = crn::stdCRN;
+        snapshot::capture(inst);
+        snapshot::save(inst, CRN_SNAPSHOT_PATH);
+    }
+
+
+    DWORD hasCRNInstance()
+    {
+        static std::mutex lock;
+        std::lock_guard<std::mutex> guard(lock);
+
+        snapshot::snapshot_view &view = snapshot::mapped();
+        if (!view.is_open() && !view.open(CRN_SNAPSHOT_PATH)) {
+            // Registers and pages are served from the mapping, only the CRN values are copied back out.
+            // Anything set since start up wins over the snapshot.
+            size_t count;
+            IOexception::io_result<const snapshot::snap_crn_t *> rec = view.entries<snapshot::snap_crn_t>(snapshot::SNAP_CRN, &count);
+            if (rec && count == 1) {
+                if (crn::current.default_crn == 0) {
+                    crn::current.default_crn = (WORD)(*rec)->default_crn;
+                }
+                const char *str = view.string((*rec)->stdCRN);
+                if (str && crn::stdCRN.empty()) {
+                    crn::stdCRN.assign(str, (*rec)->stdCRN.length);
+                }
+            }
+        }
+        return view.version();
+    }
+}
@@ -0,0 +1,51 @@
+// Exception.cpp : IO error category, static error texts and the single throw site.
+//
+
+#include "../include/CRH_Exception.h"
+
+namespace crunchy
+{
+namespace IOexception
+{
+    namespace
+    {
+        class io_category_t : public std::error_category
+        {
+            public:
+                const char *name() const noexcept { return "crunchy.io"; }
+                std::string message(int ev) const { return describe((io_errc)ev); }
+        };
+    }
+
+
+    const std::error_category &io_category() noexcept
+    {
+        static io_category_t category;
+        return category;
+    }
+
+
+    const char *describe(io_errc e) noexcept
+    {
+        switch (e) {
+            case io_errc::ok:                 return "OK";
+            case io_errc::cannot_open:        return "CANNOT_OPEN_FILE_EXCEPTION";
+            case io_errc::cannot_map:         return "CANNOT_MAP_BLOCK_EXCEPTION";
+            case io_errc::cannot_bind_socket: return "CANNOT_BIND_REPORT_SOCKET_EXCEPTION";
+            case io_errc::short_write:        return "SHORT_WRITE_EXCEPTION";
+            case io_errc::out_of_range:       return "Out of Range Exception";
+            case io_errc::not_registered:     return "COMPONENT_NOT_REGISTERED_EXCEPTION";
+            case io_errc::still_active:       return "COMPONENT_STILL_ACTIVE_EXCEPTION";
+            case io_errc::bad_format:         return "BAD_FORMAT_EXCEPTION";
+        }
+        return "UNDEFINED_ERROR_EXCEPTION";
+    }
+
+
+    void raise(io_errc e)
+    {
+        set_error(e);
+        throw IOException(describe(e), (long)e);
+    }
+}
+}
@@ -0,0 +1,292 @@
+// Filter.cpp : Cuckoo and Bloom membership filters.
+//
+
+#include "../include/CRH_Filter.h"
+#include <math.h>
+
+namespace crunchy
+{
+namespace filter
+{
+    namespace
+    {
+        inline uint64_t next_pow2(uint64_t v)
+        {
+            uint64_t p = 1;
+            while (p < v) {
+                p <<= 1;
+            }
+            return p;
+        }
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      BLOOM FILTER
+
+    bloom_filter::bloom_filter(size_t expected, double fpr)
+    {
+        if (expected == 0) expected = 1;
+        if (fpr <= 0.0 || fpr >= 1.0) fpr = FILTER_DEFAULT_FPR;
+
+        const double ln2 = 0.69314718055994530942;
+        double bits = -(double)expected * log(fpr) / (ln2 * ln2);
+
+        uint64_t blocks = next_pow2((uint64_t)ceil(bits / 512.0));
+        blockMask = blocks - 1;
+
+        double k = floor(bits / (double)expected * ln2 + 0.5);
+        hashes = (uint32_t)(k < 1 ? 1 : (k > 16 ? 16 : k));
+
+        std::vector<std::atomic<uint64_t>> table((size_t)(blocks * 8));
+        words.swap(table);
+        clear();
+    }
+
+
+    void bloom_filter::insert(uint64_t key)
+    {
+        uint64_t h = filter_hash(key);
+        std::atomic<uint64_t> *block = &words[(size_t)((h & blockMask) * 8)];
+
+        uint64_t g = filter_hash(h);
+        uint32_t a = (uint32_t)g;
+        uint32_t b = (uint32_t)(g >> 32) | 1;
+        for (uint32_t i = 0; i < hashes; ++i) {
+            uint32_t bit = (a + i * b) & 511;
+            block[bit >> 6].fetch_or(1ULL << (bit & 63), std::memory_order_relaxed);
+        }
+    }
+
+
+    bool bloom_filter::maybe_contains(uint64_t key) const
+    {
+        uint64_t h = filter_hash(key);
+        const std::atomic<uint64_t> *block = &words[(size_t)((h & blockMask) * 8)];
+
+        uint64_t g = filter_hash(h);
+        uint32_t a = (uint32_t)g;
+        uint32_t b = (uint32_t)(g >> 32) | 1;
+        for (uint32_t i = 0; i < hashes; ++i) {
+            uint32_t bit = (a + i * b) & 511;
+            if ((block[bit >> 6].load(std::memory_order_relaxed) & (1ULL << (bit & 63))) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+
+    void bloom_filter::clear()
+    {
+        for (size_t i = 0; i < words.size(); ++i) {
+            words[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      CUCKOO FILTER
+
+    cuckoo_filter::cuckoo_filter(size_t capacity, double fpr)
+        : version(0), count(0), rng(0x2545F4914F6CDD1DULL)
+    {
+        if (capacity == 0) capacity = 1;
+        if (fpr <= 0.0 || fpr >= 1.0) fpr = FILTER_DEFAULT_FPR;
+
+        // Most fingerprints per bucket (fewest bits per key) that still meets the rate
+        slotCount = 2;
+        for (unsigned s = 8; s > 2; --s) {
+            if (2.0 * s / ldexp(1.0, (int)(64 / s)) <= fpr) {
+                slotCount = s;
+                break;
+            }
+        }
+        laneBits = 64 / slotCount;
+        laneMask = laneBits == 64 ? ~0ULL : (1ULL << laneBits) - 1;
+
+        ones = 0;
+        for (unsigned s = 0; s < slotCount; ++s) {
+            ones |= 1ULL << (s * laneBits);
+        }
+        highs = ones << (laneBits - 1);
+
+        // Two slot buckets fill up sooner before an insert runs out of kicks
+        double load = slotCount >= 4 ? 0.9 : 0.8;
+        uint64_t n = next_pow2((uint64_t)ceil((double)capacity / (slotCount * load)));
+        if (n < 4) n = 4;
+        bucketMask = n - 1;
+
+        std::vector<std::atomic<uint64_t>> table((size_t)n);
+        buckets.swap(table);
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            buckets[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+
+    double cuckoo_filter::false_positive_rate() const
+    {
+        return 2.0 * slotCount / ldexp(1.0, (int)laneBits);
+    }
+
+
+    void cuckoo_filter::set_lane(uint64_t bucket, unsigned s, uint64_t fp)
+    {
+        uint64_t word = buckets[bucket].load(std::memory_order_relaxed);
+        word = (word & ~(laneMask << (s * laneBits))) | (fp << (s * laneBits));
+        buckets[bucket].store(word, std::memory_order_relaxed);
+    }
+
+
+    int cuckoo_filter::free_lane(uint64_t bucket) const
+    {
+        uint64_t word = buckets[bucket].load(std::memory_order_relaxed);
+        for (unsigned s = 0; s < slotCount; ++s) {
+            if (lane(word, s) == 0) {
+                return (int)s;
+            }
+        }
+        return -1;
+    }
+
+
+    bool cuckoo_filter::insert(uint64_t key)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        uint64_t h  = filter_hash(key);
+        uint64_t fp = fingerprint(h);
+        uint64_t i1 = h & bucketMask;
+        uint64_t i2 = alternate(i1, fp);
+
+        uint64_t b = i1;
+        int free = free_lane(b);
+        if (free < 0) {
+            b    = i2;
+            free = free_lane(b);
+        }
+        if (free >= 0) {
+            set_lane(b, (unsigned)free, fp);
+            count.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // Walk a relocation path without touching the table, then write it back to front
+        uint64_t pathBucket[FILTER_MAX_KICKS];
+        uint8_t  pathSlot[FILTER_MAX_KICKS];
+        uint64_t moved[FILTER_MAX_KICKS];
+
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        b = (rng & 1) ? i1 : i2;
+
+        for (int k = 0; k < FILTER_MAX_KICKS; ++k) {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+
+            // A slot already on the path no longer holds what the table says, pick another
+            unsigned slot = (unsigned)(rng % slotCount);
+            unsigned tried;
+            for (tried = 0; tried < slotCount; ++tried, slot = (slot + 1) % slotCount) {
+                int j = 0;
+                while (j < k && !(pathBucket[j] == b && pathSlot[j] == slot)) {
+                    ++j;
+                }
+                if (j == k) {
+                    break;
+                }
+            }
+            if (CRUNCHY_UNLIKELY(tried == slotCount)) {
+                return false;
+            }
+
+            pathBucket[k] = b;
+            pathSlot[k]   = (uint8_t)slot;
+            moved[k]      = lane(buckets[b].load(std::memory_order_relaxed), slot);
+
+            b = alternate(b, moved[k]);
+            if ((free = free_lane(b)) < 0) {
+                continue;
+            }
+
+            // Every fingerprint lands in its new bucket before its old slot is overwritten
+            version.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            set_lane(b, (unsigned)free, moved[k]);
+            for (int j = k; j > 0; --j) {
+                set_lane(pathBucket[j], pathSlot[j], moved[j - 1]);
+            }
+            set_lane(pathBucket[0], pathSlot[0], fp);
+
+            version.fetch_add(1, std::memory_order_release);
+            count.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        return false;
+    }
+
+
+    bool cuckoo_filter::erase(uint64_t key)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        uint64_t h   = filter_hash(key);
+        uint64_t fp  = fingerprint(h);
+        uint64_t bs[2] = { h & bucketMask, alternate(h & bucketMask, fp) };
+
+        for (int i = 0; i < 2; ++i) {
+            uint64_t word = buckets[bs[i]].load(std::memory_order_relaxed);
+            for (unsigned s = 0; s < slotCount; ++s) {
+                if (lane(word, s) == fp) {
+                    set_lane(bs[i], s, 0);
+                    count.fetch_sub(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      MEMBERSHIP FILTER
+
+    membership_filter::membership_filter(size_t capacity, double fpr)
+        : primary(capacity, fpr), overflow(capacity / 4 + 1, fpr), spilled(0)
+    {
+    }
+
+
+    void membership_filter::insert(uint64_t key)
+    {
+        if (primary.insert(key)) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        overflowKeys.insert(key);
+        overflow.insert(key);
+        spilled.fetch_add(1, std::memory_order_release);
+    }
+
+
+    void membership_filter::erase(uint64_t key)
+    {
+        if (spilled.load(std::memory_order_acquire) != 0) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (overflowKeys.erase(key)) {
+                return; // Its Bloom bits stay, they may belong to other keys too
+            }
+        }
+        primary.erase(key);
+    }
+}
+}
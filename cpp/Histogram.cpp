@@ -0,0 +1,131 @@
+// Histogram.cpp : HDR latency histograms.
+//
+
+#include "../include/CRH_Histogram.h"
+#include <math.h>
+
+namespace crunchy
+{
+namespace stats
+{
+    histogram::histogram()
+        : counts((size_t)((1ULL << HISTOGRAM_SUB_BITS) + HISTOGRAM_SHIFTS * (1ULL << (HISTOGRAM_SUB_BITS - 1))), 0)
+    {
+        reset();
+    }
+
+
+    void histogram::reset()
+    {
+        for (size_t i = 0; i < counts.size(); ++i) {
+            counts[i] = 0;
+        }
+        total    = 0;
+        maxValue = 0;
+        minValue = UINT64_MAX;
+        sum      = 0.0;
+    }
+
+
+    void histogram::merge(const histogram &o)
+    {
+        for (size_t i = 0; i < counts.size(); ++i) {
+            counts[i] += o.counts[i];
+        }
+        total += o.total;
+        sum   += o.sum;
+        if (o.maxValue > maxValue) maxValue = o.maxValue;
+        if (o.minValue < minValue) minValue = o.minValue;
+    }
+
+
+    uint64_t histogram::lowest(size_t idx)
+    {
+        const uint64_t sub  = 1ULL << HISTOGRAM_SUB_BITS;
+        const uint64_t half = sub >> 1;
+        if (idx < sub) {
+            return idx;
+        }
+
+        uint64_t k     = idx - sub;
+        unsigned shift = (unsigned)(k / half) + 1;
+        return ((k % half) + half) << shift;
+    }
+
+
+    uint64_t histogram::highest(size_t idx)
+    {
+        const uint64_t sub  = 1ULL << HISTOGRAM_SUB_BITS;
+        const uint64_t half = sub >> 1;
+        if (idx < sub) {
+            return idx;
+        }
+        if (idx == sub + HISTOGRAM_SHIFTS * half - 1) {
+            return UINT64_MAX; // The last bucket also takes everything past the range
+        }
+        return lowest(idx + 1) - 1;
+    }
+
+
+    uint64_t histogram::percentile(double p) const
+    {
+        if (total == 0) {
+            return 0;
+        }
+        if (p < 0.0)   p = 0.0;
+        if (p > 100.0) p = 100.0;
+
+        uint64_t target = (uint64_t)ceil(p / 100.0 * (double)total);
+        if (target == 0) target = 1;
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= target) {
+                uint64_t v = highest(i);
+                return v < maxValue ? v : maxValue;
+            }
+        }
+        return maxValue;
+    }
+
+
+    void histogram::write_hgrm(FILE *fp, double scale) const
+    {
+        fprintf(fp, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+
+        double m = mean();
+        double var = 0.0;
+        uint64_t seen = 0;
+        size_t used = 0;
+
+        for (size_t i = 0; i < counts.size(); ++i) {
+            if (counts[i] == 0) {
+                continue;
+            }
+            ++used;
+            seen += counts[i];
+
+            uint64_t top = highest(i);
+            if (top > maxValue) top = maxValue;
+
+            double mid = ((double)lowest(i) + (double)top) / 2.0;
+            var += (double)counts[i] * (mid - m) * (mid - m);
+
+            double q = (double)seen / (double)total;
+            if (seen < total) {
+                fprintf(fp, "%12.3f %14.12f %10llu %14.2f\n", top / scale, q, (unsigned long long)seen, 1.0 / (1.0 - q));
+            }
+            else {
+                fprintf(fp, "%12.3f %14.12f %10llu\n", top / scale, q, (unsigned long long)seen);
+            }
+        }
+
+        double sd = total ? sqrt(var / (double)total) : 0.0;
+        fprintf(fp, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", m / scale, sd / scale);
+        fprintf(fp, "#[Max     = %12.3f, Total count    = %12llu]\n", maxValue / scale, (unsigned long long)total);
+        fprintf(fp, "#[Buckets = %12llu, SubBuckets     = %12llu]\n",
+                (unsigned long long)used, (unsigned long long)(1ULL << HISTOGRAM_SUB_BITS));
+    }
+}
+}
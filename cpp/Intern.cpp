@@ -0,0 +1,276 @@
+// Intern.cpp : Interned string pool, sharded hash tables over append-only arenas.
+//
+
+#include "../include/CRH_Intern.h"
+#include "../include/CRH_Hash.h"
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace crunchy
+{
+namespace intern
+{
+    namespace
+    {
+        #   define  INTERN_SHARDS      (1U << INTERN_SHARD_BITS)
+        #   define  INTERN_PAGE_BITS   12
+        #   define  INTERN_PAGE_SIZE   (1U << INTERN_PAGE_BITS)
+        #   define  INTERN_MAX_INDEX   (1U << 24) /**< Per shard, 256M strings across the pool */
+        #   define  INTERN_PAGES       (INTERN_MAX_INDEX / INTERN_PAGE_SIZE)
+
+
+        /**
+         * \brief Interned string as laid out in the arena, data is NUL terminated.
+         */
+        struct record
+        {
+            uint32_t len;
+            uint32_t hash;
+            char data[1];
+        };
+
+
+        /**
+         * \brief One shard of the pool.
+         *        Interning takes the shard lock, lookups only read the page table.
+         */
+        struct shard
+        {
+            std::mutex lock;
+
+            std::vector<char *> blocks;
+            char *cur;
+            size_t left;
+            size_t reserved;
+
+            std::vector<uint64_t> table; /**< (hash << 32) | (index + 1), 0 is empty */
+            uint32_t used;
+
+            std::atomic<std::atomic<const record *> *> pages[INTERN_PAGES];
+            uint32_t next;
+
+            shard() : cur(NULL), left(0), reserved(0), table(1024, 0), used(0), next(0)
+            {
+                for (size_t p = 0; p < INTERN_PAGES; ++p) {
+                    pages[p].store(NULL, std::memory_order_relaxed);
+                }
+            }
+
+            ~shard()
+            {
+                for (size_t p = 0; p < INTERN_PAGES; ++p) {
+                    delete[] pages[p].load(std::memory_order_relaxed);
+                }
+                for (size_t b = 0; b < blocks.size(); ++b) {
+                    delete[] blocks[b];
+                }
+            }
+
+            const record *place(const char *str, size_t len, uint32_t hash)
+            {
+                size_t need = (offsetof(record, data) + len + 1 + 7) & ~(size_t)7;
+                if (need > left) {
+                    size_t size = need > INTERN_ARENA_BLOCK ? need : INTERN_ARENA_BLOCK;
+                    cur  = new char[size];
+                    left = size;
+                    reserved += size;
+                    blocks.push_back(cur);
+                }
+
+                record *r = (record *)cur;
+                r->len  = (uint32_t)len;
+                r->hash = hash;
+                memcpy(r->data, str, len);
+                r->data[len] = '\0';
+
+                cur  += need;
+                left -= need;
+                return r;
+            }
+
+            const record *at(uint32_t index) const
+            {
+                // Handles carry 28 index bits, anything past the page table was never handed out
+                if (index >= INTERN_MAX_INDEX) {
+                    return NULL;
+                }
+                std::atomic<const record *> *page = pages[index >> INTERN_PAGE_BITS].load(std::memory_order_acquire);
+                return page ? page[index & (INTERN_PAGE_SIZE - 1)].load(std::memory_order_acquire) : NULL;
+            }
+
+            void publish(uint32_t index, const record *r)
+            {
+                std::atomic<const record *> *page = pages[index >> INTERN_PAGE_BITS].load(std::memory_order_relaxed);
+                if (page == NULL) {
+                    page = new std::atomic<const record *>[INTERN_PAGE_SIZE];
+                    for (size_t i = 0; i < INTERN_PAGE_SIZE; ++i) {
+                        page[i].store(NULL, std::memory_order_relaxed);
+                    }
+                    pages[index >> INTERN_PAGE_BITS].store(page, std::memory_order_release);
+                }
+                page[index & (INTERN_PAGE_SIZE - 1)].store(r, std::memory_order_release);
+            }
+
+            /// \return Slot holding the string or the empty slot it would go in
+            size_t probe(const char *str, size_t len, uint32_t hash) const
+            {
+                size_t mask = table.size() - 1;
+                size_t i = (hash >> INTERN_SHARD_BITS) & mask;
+                for (;;) {
+                    uint64_t e = table[i];
+                    if (e == 0) {
+                        return i;
+                    }
+                    if ((uint32_t)(e >> 32) == hash) {
+                        const record *r = at((uint32_t)e - 1);
+                        if (r->len == len && memcmp(r->data, str, len) == 0) {
+                            return i;
+                        }
+                    }
+                    i = (i + 1) & mask;
+                }
+            }
+
+            void grow()
+            {
+                std::vector<uint64_t> old;
+                old.swap(table);
+                table.assign(old.size() * 2, 0);
+
+                size_t mask = table.size() - 1;
+                for (size_t o = 0; o < old.size(); ++o) {
+                    if (old[o] == 0) {
+                        continue;
+                    }
+                    size_t i = ((uint32_t)(old[o] >> 32) >> INTERN_SHARD_BITS) & mask;
+                    while (table[i] != 0) {
+                        i = (i + 1) & mask;
+                    }
+                    table[i] = old[o];
+                }
+            }
+        };
+
+
+        struct pool_t
+        {
+            shard shards[INTERN_SHARDS];
+            std::atomic<uint32_t> limit; /**< Strings per shard, see set_shard_limit() */
+
+            pool_t() : limit(INTERN_MAX_INDEX)
+            {
+                // Index 0 of shard 0 is handle 0, keep it for the empty string
+                shard &s = shards[0];
+                s.publish(0, s.place("", 0, hash::fnv1a32("", 0)));
+                s.next = 1;
+            }
+        };
+
+
+        pool_t &pool()
+        {
+            static pool_t p;
+            return p;
+        }
+
+
+        inline const record *resolve(uint32_t handle)
+        {
+            return pool().shards[handle & (INTERN_SHARDS - 1)].at(handle >> INTERN_SHARD_BITS);
+        }
+    }
+
+
+    IOexception::io_result<uint32_t> intern(const char *str, size_t len)
+    {
+        if (len == 0) {
+            return INTERN_NULL;
+        }
+        if (CRUNCHY_UNLIKELY(len > UINT32_MAX)) {
+            return IOexception::set_error(IOexception::io_errc::out_of_range);
+        }
+
+        uint32_t hash = hash::fnv1a32(str, len);
+        uint32_t sh   = hash & (INTERN_SHARDS - 1);
+        shard &s      = pool().shards[sh];
+
+        std::lock_guard<std::mutex> guard(s.lock);
+
+        size_t slot = s.probe(str, len, hash);
+        if (s.table[slot] != 0) {
+            return (((uint32_t)s.table[slot] - 1) << INTERN_SHARD_BITS) | sh;
+        }
+
+        // Never hand out INTERN_NULL for a real string, it would compare equal to ""
+        if (CRUNCHY_UNLIKELY(s.next >= pool().limit.load(std::memory_order_relaxed))) {
+            return IOexception::set_error(IOexception::io_errc::out_of_range);
+        }
+
+        uint32_t index = s.next++;
+        s.publish(index, s.place(str, len, hash));
+
+        s.table[slot] = ((uint64_t)hash << 32) | (index + 1);
+        if (++s.used * 2 > s.table.size()) {
+            s.grow();
+        }
+
+        return (index << INTERN_SHARD_BITS) | sh;
+    }
+
+
+    uint32_t find(const char *str, size_t len)
+    {
+        if (len == 0) {
+            return INTERN_NULL;
+        }
+
+        uint32_t hash = hash::fnv1a32(str, len);
+        uint32_t sh   = hash & (INTERN_SHARDS - 1);
+        shard &s      = pool().shards[sh];
+
+        std::lock_guard<std::mutex> guard(s.lock);
+
+        size_t slot = s.probe(str, len, hash);
+        if (s.table[slot] == 0) {
+            return INTERN_NULL;
+        }
+        return (((uint32_t)s.table[slot] - 1) << INTERN_SHARD_BITS) | sh;
+    }
+
+
+    const char *lookup(uint32_t handle)
+    {
+        const record *r = resolve(handle);
+        return r ? r->data : "";
+    }
+
+
+    size_t length(uint32_t handle)
+    {
+        const record *r = resolve(handle);
+        return r ? r->len : 0;
+    }
+
+
+    void stats(size_t *strings, size_t *bytes)
+    {
+        size_t n = 0, b = 0;
+        for (size_t i = 0; i < INTERN_SHARDS; ++i) {
+            shard &s = pool().shards[i];
+            std::lock_guard<std::mutex> guard(s.lock);
+            n += s.used;
+            b += s.reserved;
+        }
+        if (strings) *strings = n;
+        if (bytes)   *bytes   = b;
+    }
+
+
+    void set_shard_limit(uint32_t perShard)
+    {
+        pool().limit.store(perShard < INTERN_MAX_INDEX ? perShard : INTERN_MAX_INDEX, std::memory_order_relaxed);
+    }
+}
+}
@@ -0,0 +1,240 @@
+// MappedFile.cpp : Read-only file mappings, whole files for the CRN snapshot and windows for runt.
+//
+
+#include "../include/CRH_MappedFile.h"
+
+#if defined(_WIN32) | defined(WIN32)
+#   include <Windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+namespace crunchy
+{
+namespace paging
+{
+    size_t page_granularity()
+    {
+#if defined(_WIN32) | defined(WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwAllocationGranularity;
+#else
+        long page = sysconf(_SC_PAGESIZE);
+        return page > 0 ? (size_t)page : 4096;
+#endif
+    }
+
+
+    mapped_file_t map_file(const std::string &path, bool sequential)
+    {
+        mapped_file_t mf = {};
+#if defined(_WIN32) | defined(WIN32)
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                  sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, NULL);
+        if (CRUNCHY_UNLIKELY(file == INVALID_HANDLE_VALUE)) {
+            mf.error = IOexception::io_errc::cannot_open;
+            return mf;
+        }
+        mf.file   = (intptr_t)file;
+        mf.opened = true;
+
+        LARGE_INTEGER size;
+        if (CRUNCHY_UNLIKELY(!GetFileSizeEx(file, &size))) {
+            mf.opened = false;
+            mf.error  = IOexception::io_errc::cannot_open;
+            return mf;
+        }
+        if (size.QuadPart == 0) {
+            return mf;
+        }
+        mf.size = (uint64_t)size.QuadPart;
+
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping != NULL) {
+            mf.mapping = (intptr_t)mapping;
+            mf.data    = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+        if (CRUNCHY_UNLIKELY(mf.data == NULL)) {
+            mf.error = IOexception::io_errc::cannot_map;
+        }
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (CRUNCHY_UNLIKELY(fd < 0)) {
+            mf.error = IOexception::io_errc::cannot_open;
+            return mf;
+        }
+        mf.opened = true;
+
+        struct stat st;
+        if (CRUNCHY_UNLIKELY(fstat(fd, &st) != 0)) {
+            mf.opened = false;
+            mf.error  = IOexception::io_errc::cannot_open;
+        }
+        else if (st.st_size > 0) {
+            mf.size = (uint64_t)st.st_size;
+            if (CRUNCHY_UNLIKELY(mf.size > (uint64_t)SIZE_MAX)) {
+                // Larger than the address space of a 32-bit process, use map_window()
+                mf.error = IOexception::io_errc::cannot_map;
+                close(fd);
+                return mf;
+            }
+            void *p = mmap(NULL, (size_t)mf.size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (CRUNCHY_UNLIKELY(p == MAP_FAILED)) {
+                mf.error = IOexception::io_errc::cannot_map;
+            }
+            else {
+                madvise(p, (size_t)mf.size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+                mf.data = (const unsigned char *)p;
+            }
+        }
+
+        // The mapping keeps its own reference to the file
+        close(fd);
+#endif
+        return mf;
+    }
+
+
+    void unmap_file(mapped_file_t &mf)
+    {
+#if defined(_WIN32) | defined(WIN32)
+        if (mf.data)    UnmapViewOfFile(mf.data);
+        if (mf.mapping) CloseHandle((HANDLE)mf.mapping);
+        if (mf.file)    CloseHandle((HANDLE)mf.file);
+        mf.mapping = 0;
+        mf.file    = 0;
+#else
+        if (mf.data) munmap((void *)mf.data, (size_t)mf.size);
+#endif
+        mf.data = NULL;
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      WINDOWS
+
+    windowed_file_t open_windowed(const std::string &path, bool sequential)
+    {
+        windowed_file_t wf = {};
+        wf.file       = -1;
+        wf.sequential = sequential;
+#if defined(_WIN32) | defined(WIN32)
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                  sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, NULL);
+        if (CRUNCHY_UNLIKELY(file == INVALID_HANDLE_VALUE)) {
+            wf.error = IOexception::io_errc::cannot_open;
+            return wf;
+        }
+
+        LARGE_INTEGER size;
+        if (CRUNCHY_UNLIKELY(!GetFileSizeEx(file, &size))) {
+            CloseHandle(file);
+            wf.error = IOexception::io_errc::cannot_open;
+            return wf;
+        }
+        wf.file   = (intptr_t)file;
+        wf.opened = true;
+        wf.size   = (uint64_t)size.QuadPart;
+
+        // A mapping object costs no address space, only the views do
+        if (wf.size > 0) {
+            HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (CRUNCHY_UNLIKELY(mapping == NULL)) {
+                wf.error = IOexception::io_errc::cannot_map;
+            }
+            wf.mapping = (intptr_t)mapping;
+        }
+#else
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (CRUNCHY_UNLIKELY(fd < 0)) {
+            wf.error = IOexception::io_errc::cannot_open;
+            return wf;
+        }
+
+        struct stat st;
+        if (CRUNCHY_UNLIKELY(fstat(fd, &st) != 0)) {
+            close(fd);
+            wf.error = IOexception::io_errc::cannot_open;
+            return wf;
+        }
+        wf.file   = fd;
+        wf.opened = true;
+        wf.size   = (uint64_t)st.st_size;
+#endif
+        return wf;
+    }
+
+
+    void close_windowed(windowed_file_t &wf)
+    {
+#if defined(_WIN32) | defined(WIN32)
+        if (wf.mapping)    CloseHandle((HANDLE)wf.mapping);
+        if (wf.file != -1) CloseHandle((HANDLE)wf.file);
+#else
+        if (wf.file != -1) close((int)wf.file);
+#endif
+        wf.mapping = 0;
+        wf.file    = -1;
+        wf.opened  = false;
+    }
+
+
+    mapped_window_t map_window(const windowed_file_t &wf, uint64_t offset, size_t length)
+    {
+        mapped_window_t w = {};
+        if (CRUNCHY_UNLIKELY(wf.file == -1 || offset >= wf.size)) {
+            return w;
+        }
+        if (length > wf.size - offset) {
+            length = (size_t)(wf.size - offset);
+        }
+
+        uint64_t start = offset - offset % page_granularity();
+        size_t lead    = (size_t)(offset - start);
+        if (CRUNCHY_UNLIKELY(length == 0 || length > SIZE_MAX - lead)) {
+            return w;
+        }
+        size_t span = lead + length;
+
+#if defined(_WIN32) | defined(WIN32)
+        if (CRUNCHY_UNLIKELY(wf.mapping == 0)) {
+            return w;
+        }
+        void *p = MapViewOfFile((HANDLE)wf.mapping, FILE_MAP_READ, (DWORD)(start >> 32), (DWORD)start, span);
+        if (CRUNCHY_UNLIKELY(p == NULL)) {
+            return w;
+        }
+#else
+        void *p = mmap(NULL, span, PROT_READ, MAP_PRIVATE, (int)wf.file, (off_t)start);
+        if (CRUNCHY_UNLIKELY(p == MAP_FAILED)) {
+            return w;
+        }
+        madvise(p, span, wf.sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+#endif
+        w.base   = (const unsigned char *)p;
+        w.span   = span;
+        w.data   = w.base + lead;
+        w.length = length;
+        return w;
+    }
+
+
+    void unmap_window(mapped_window_t &w)
+    {
+#if defined(_WIN32) | defined(WIN32)
+        if (w.base) UnmapViewOfFile(w.base);
+#else
+        if (w.base) munmap((void *)w.base, w.span);
+#endif
+        w.base   = NULL;
+        w.data   = NULL;
+        w.span   = 0;
+        w.length = 0;
+    }
+}
+}
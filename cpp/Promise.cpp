@@ -0,0 +1,368 @@
+// Promise.cpp : Promise heartbeat engine and the local report socket stand-in.
+//
+
+#include "../include/CRH_Promise.h"
+#include <string.h>
+#include <chrono>
+
+#if defined(_WIN32) | defined(WIN32)
+#   include <Windows.h>
+#   include <intrin.h>
+#   include <stdio.h>
+#   include <atomic>
+#else
+#   include <errno.h>
+#   include <fcntl.h>
+#   include <sys/socket.h>
+#   include <unistd.h>
+#endif
+
+namespace crunchy
+{
+namespace promise
+{
+    namespace
+    {
+        inline unsigned lowest_bit(uint64_t w)
+        {
+#if defined(_MSC_VER)
+            unsigned long idx;
+            _BitScanForward64(&idx, w);
+            return (unsigned)idx;
+#else
+            return (unsigned)__builtin_ctzll(w);
+#endif
+        }
+
+        inline uint32_t bit_count(uint64_t w)
+        {
+#if defined(_MSC_VER)
+            return (uint32_t)__popcnt64(w);
+#else
+            return (uint32_t)__builtin_popcountll(w);
+#endif
+        }
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      LOCAL REPORT SOCKET
+
+    local_report_socket::local_report_socket()
+        : engine_end(-1), server_end(-1)
+    {
+        // Never let a slow reader stall the heartbeat, a full pipe/socket drops the batch
+        // Room for a full tick of max sized batches before anything is dropped
+        int room = 64 * (int)(sizeof(promise_header_t) + PROMISE_MAX_BATCH * sizeof(promise_record_t));
+#if defined(_WIN32) | defined(WIN32)
+        // An anonymous pipe only does blocking writes, so use a message mode named pipe
+        // with PIPE_NOWAIT on both ends, one batch per message like the datagram socket.
+        static std::atomic<unsigned> instances(0);
+        char name[64];
+        snprintf(name, sizeof(name), "\\\\.\\pipe\\crunchy-promise-%lu-%u",
+                 (unsigned long)GetCurrentProcessId(), instances.fetch_add(1));
+
+        HANDLE rd = CreateNamedPipeA(name, PIPE_ACCESS_INBOUND | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                                     PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_NOWAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                     1, 0, (DWORD)room, 0, NULL);
+        if (rd != INVALID_HANDLE_VALUE) {
+            HANDLE wr = CreateFileA(name, GENERIC_WRITE | FILE_READ_ATTRIBUTES, 0, NULL, OPEN_EXISTING, 0, NULL);
+            DWORD mode = PIPE_READMODE_MESSAGE | PIPE_NOWAIT;
+            if (wr != INVALID_HANDLE_VALUE && SetNamedPipeHandleState(wr, &mode, NULL, NULL)) {
+                server_end = (intptr_t)rd;
+                engine_end = (intptr_t)wr;
+            }
+            else {
+                if (wr != INVALID_HANDLE_VALUE) CloseHandle(wr);
+                CloseHandle(rd);
+            }
+        }
+#else
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) == 0) {
+            fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+            fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+
+            setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &room, sizeof(room));
+            setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &room, sizeof(room));
+            engine_end = fds[0];
+            server_end = fds[1];
+        }
+#endif
+        if (CRUNCHY_UNLIKELY(engine_end == -1)) {
+            state = IOexception::set_error(IOexception::io_errc::cannot_bind_socket);
+        }
+    }
+
+
+    local_report_socket::~local_report_socket()
+    {
+#if defined(_WIN32) | defined(WIN32)
+        if (engine_end != -1) CloseHandle((HANDLE)engine_end);
+        if (server_end != -1) CloseHandle((HANDLE)server_end);
+#else
+        if (engine_end != -1) close((int)engine_end);
+        if (server_end != -1) close((int)server_end);
+#endif
+    }
+
+
+    bool local_report_socket::send(const unsigned char *batch, size_t len)
+    {
+        if (CRUNCHY_UNLIKELY(engine_end == -1)) {
+            return false;
+        }
+#if defined(_WIN32) | defined(WIN32)
+        // Non-blocking, a pipe without room returns at once having written nothing
+        DWORD written = 0;
+        return WriteFile((HANDLE)engine_end, batch, (DWORD)len, &written, NULL) && written == len;
+#else
+        return ::send((int)engine_end, batch, len, 0) == (ssize_t)len;
+#endif
+    }
+
+
+    size_t local_report_socket::receive(unsigned char *buf, size_t len)
+    {
+        if (server_end == -1) {
+            return 0;
+        }
+#if defined(_WIN32) | defined(WIN32)
+        DWORD avail = 0, got = 0;
+        if (!PeekNamedPipe((HANDLE)server_end, NULL, 0, NULL, &avail, NULL) || avail == 0) {
+            return 0;
+        }
+        if (!ReadFile((HANDLE)server_end, buf, (DWORD)len, &got, NULL)) {
+            return 0;
+        }
+        return got;
+#else
+        ssize_t got = recv((int)server_end, buf, len, 0);
+        return got > 0 ? (size_t)got : 0;
+#endif
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      HEARTBEAT ENGINE
+
+    heartbeat_engine::heartbeat_engine(report_sink *sink, uint32_t capacity)
+        : sink(sink),
+          slotCount(capacity),
+          ticks(0),
+          states(capacity),
+          active((capacity + 63) / 64),
+          strict((capacity + 63) / 64),
+          beats((capacity + 63) / 64),
+          nextSlot(0),
+          taken((capacity + 63) / 64),
+          batch(sizeof(promise_header_t) + PROMISE_MAX_BATCH * sizeof(promise_record_t)),
+          count(0),
+          missed(0),
+          sent(0),
+          running(false)
+    {
+        memset(&states[0], 0, states.size() * sizeof(promise_state_t));
+        for (size_t w = 0; w < beats.size(); ++w) {
+            beats[w].store(0, std::memory_order_relaxed);
+        }
+    }
+
+
+    heartbeat_engine::~heartbeat_engine()
+    {
+        stop();
+    }
+
+
+    uint32_t heartbeat_engine::promise(uint32_t slot, uint32_t key, bool hasStrictPromise, uint32_t objectsToPromise)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (slot == PROMISE_NO_SLOT) {
+            if (!freeSlots.empty()) {
+                slot = freeSlots.back();
+                freeSlots.pop_back();
+
+                // A late beat from the previous holder must not count for the new one
+                beats[slot >> 6].fetch_and(~(1ULL << (slot & 63)), std::memory_order_relaxed);
+            }
+            else if (nextSlot < slotCount) {
+                slot = nextSlot++;
+            }
+            else {
+                return PROMISE_NO_SLOT;
+            }
+        }
+        else if (slot >= slotCount) {
+            return PROMISE_NO_SLOT;
+        }
+
+        promise_state_t &st = states[slot];
+        st.key     = key;
+        st.objects = objectsToPromise;
+        st.flags   = PROMISE_ACTIVE | (hasStrictPromise ? PROMISE_STRICT : 0);
+
+        uint64_t bit = 1ULL << (slot & 63);
+        active[slot >> 6] |= bit;
+        if (hasStrictPromise) {
+            strict[slot >> 6] |= bit;
+        }
+        else {
+            strict[slot >> 6] &= ~bit;
+        }
+
+        return slot;
+    }
+
+
+    void heartbeat_engine::release(uint32_t slot)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (slot >= slotCount || !(states[slot].flags & PROMISE_ACTIVE)) {
+            return;
+        }
+
+        uint64_t bit = 1ULL << (slot & 63);
+        active[slot >> 6] &= ~bit;
+        strict[slot >> 6] &= ~bit;
+        beats[slot >> 6].fetch_and(~bit, std::memory_order_relaxed);
+        states[slot].flags = 0;
+        freeSlots.push_back(slot);
+    }
+
+
+    void heartbeat_engine::append(uint32_t slot, uint8_t flags)
+    {
+        const promise_state_t &st = states[slot];
+
+        promise_record_t rec;
+        rec.slot    = slot;
+        rec.key     = st.key;
+        rec.objects = st.objects;
+        rec.flags   = flags;
+
+        memcpy(&batch[sizeof(promise_header_t) + count * sizeof(promise_record_t)], &rec, sizeof(rec));
+        if (++count == PROMISE_MAX_BATCH) {
+            flush(false);
+        }
+    }
+
+
+    void heartbeat_engine::flush(bool force)
+    {
+        if (count == 0 && !force) {
+            return;
+        }
+
+        promise_header_t hdr;
+        hdr.magic  = PROMISE_REPORT_MAGIC;
+        hdr.tick   = ticks;
+        hdr.count  = count;
+        hdr.missed = force ? missed : 0;
+        memcpy(&batch[0], &hdr, sizeof(hdr));
+
+        if (sink != NULL && sink->send(&batch[0], sizeof(hdr) + count * sizeof(promise_record_t))) {
+            sent += count;
+        }
+        count = 0;
+    }
+
+
+    size_t heartbeat_engine::tick()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        count  = 0;
+        missed = 0;
+        sent   = 0;
+        ++ticks;
+
+        // Swap the beats out first so beats landing mid-tick count towards the next one
+        for (size_t w = 0; w < beats.size(); ++w) {
+            taken[w] = beats[w].exchange(0, std::memory_order_relaxed);
+        }
+
+        // Strict promises first, listed whether they reported back or not
+        for (size_t w = 0; w < taken.size(); ++w) {
+            uint64_t s = strict[w];
+            while (s) {
+                unsigned b = lowest_bit(s);
+                s &= s - 1;
+
+                uint32_t slot = (uint32_t)(w * 64 + b);
+                uint8_t flags = states[slot].flags;
+                if (!(taken[w] & (1ULL << b))) {
+                    flags |= PROMISE_MISSED;
+                }
+                append(slot, flags);
+            }
+        }
+
+        // Then everything else that reported back, misses are only counted
+        for (size_t w = 0; w < taken.size(); ++w) {
+            uint64_t plain = active[w] & ~strict[w];
+            if (!plain) {
+                continue;
+            }
+
+            uint64_t hit = plain & taken[w];
+            missed += bit_count(plain & ~hit);
+
+            while (hit) {
+                unsigned b = lowest_bit(hit);
+                hit &= hit - 1;
+                append((uint32_t)(w * 64 + b), PROMISE_ACTIVE);
+            }
+        }
+
+        // The last send of a tick always goes out and carries the miss count
+        flush(true);
+        return sent;
+    }
+
+
+    void heartbeat_engine::start(unsigned tickMs)
+    {
+        bool expected = false;
+        if (!running.compare_exchange_strong(expected, true)) {
+            return;
+        }
+
+        runner = std::thread([this, tickMs]() {
+            std::unique_lock<std::mutex> guard(wakeLock);
+            while (running.load()) {
+                if (wake.wait_for(guard, std::chrono::milliseconds(tickMs)) == std::cv_status::timeout) {
+                    tick();
+                }
+            }
+        });
+    }
+
+
+    void heartbeat_engine::stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(wakeLock);
+            if (!running.exchange(false)) {
+                return;
+            }
+        }
+        wake.notify_all();
+        runner.join();
+    }
+
+
+    heartbeat_engine &engine()
+    {
+        static local_report_socket server;
+        static heartbeat_engine shared(&server);
+        static bool started = (shared.start(), true);
+        (void)started;
+        return shared;
+    }
+}
+}
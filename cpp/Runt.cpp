@@ -0,0 +1,133 @@
+// Runt.cpp : Runtime Unified Node Tester, parallel block testing over mapped files.
+//
+
+#include "../include/CRH_Runt.h"
+#include <atomic>
+#include <thread>
+
+#include "../include/CRH_MappedFile.h"
+
+namespace crunchy
+{
+namespace runt
+{
+    using paging::windowed_file_t;
+    using paging::mapped_window_t;
+    using paging::open_windowed;
+    using paging::close_windowed;
+    using paging::map_window;
+    using paging::unmap_window;
+    using paging::page_granularity;
+
+
+    std::vector<runt_result_t> run_blocks(
+                                          const std::vector<std::string> &paths,
+                                          const runt_tester &test,
+                                          size_t blockSize,
+                                          unsigned workers
+                                         )
+    {
+        size_t gran = page_granularity();
+        if (blockSize == 0) {
+            blockSize = RUNT_BLOCK_SIZE;
+        }
+        blockSize = (blockSize + gran - 1) / gran * gran;
+
+        // Open everything up front and lay the blocks of every file out back to back,
+        // firstBlock[f] is the slot of the first block of file f.
+        // Blocks are mapped one window at a time by the worker testing them, so at most
+        // workers * blockSize bytes of address space are in use whatever the file sizes.
+        std::vector<windowed_file_t> files(paths.size());
+        std::vector<size_t> firstBlock(paths.size() + 1, 0);
+
+        for (size_t f = 0; f < paths.size(); ++f) {
+            files[f] = open_windowed(paths[f]);
+
+            size_t count;
+            if (!files[f].opened || files[f].error != IOexception::io_errc::ok) {
+                count = 1;
+            }
+            else {
+                count = (size_t)((files[f].size + blockSize - 1) / blockSize);
+            }
+            firstBlock[f + 1] = firstBlock[f] + count;
+        }
+
+        size_t total = firstBlock[paths.size()];
+        std::vector<runt_result_t> results(total);
+
+        if (workers == RUNT_ALL_CORES) {
+            workers = std::thread::hardware_concurrency();
+        }
+        if (workers == 0) {
+            workers = 1;
+        }
+        if (workers > total) {
+            workers = (unsigned)(total ? total : 1);
+        }
+
+        std::atomic<size_t> next(0);
+
+        auto worker = [&]() {
+            size_t f = 0;
+            for (;;) {
+                size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+                if (slot >= total) {
+                    break;
+                }
+
+                // Slots are claimed in increasing order, so the file cursor only moves forward
+                while (firstBlock[f + 1] <= slot) {
+                    ++f;
+                }
+
+                runt_block_t block;
+                block.file   = f;
+                block.index  = slot - firstBlock[f];
+                block.offset = (uint64_t)block.index * blockSize;
+
+                runt_result_t &res = results[slot];
+                res.file   = f;
+                res.offset = block.offset;
+                res.error  = files[f].error;
+
+                if (CRUNCHY_UNLIKELY(!files[f].opened || files[f].error != IOexception::io_errc::ok)) {
+                    res.length = 0;
+                    res.passed = false;
+                    continue;
+                }
+
+                uint64_t left = files[f].size - block.offset;
+                block.length  = left < blockSize ? (size_t)left : blockSize;
+                res.length    = block.length;
+
+                mapped_window_t window = map_window(files[f], block.offset, block.length);
+                if (CRUNCHY_UNLIKELY(window.data == NULL)) {
+                    res.passed = false;
+                    res.error  = IOexception::io_errc::cannot_map;
+                    continue;
+                }
+
+                block.data = window.data;
+                res.passed = test(block);
+                unmap_window(window);
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < workers; ++i) {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (size_t i = 0; i < pool.size(); ++i) {
+            pool[i].join();
+        }
+
+        for (size_t f = 0; f < files.size(); ++f) {
+            close_windowed(files[f]);
+        }
+
+        return results;
+    }
+}
+}
@@ -0,0 +1,1260 @@
+// Shard.cpp : Consistent hash ring, registry shards and the sharded register facade.
+//
+
+#include "../include/CRH_Shard.h"
+#include <string.h>
+#include <algorithm>
+#include <unordered_set>
+
+#if !(defined(_WIN32) | defined(WIN32))
+#   include <errno.h>
+#   include <sys/socket.h>
+#   include <sys/un.h>
+#   include <unistd.h>
+#endif
+
+namespace crunchy
+{
+namespace shard
+{
+    namespace
+    {
+        enum wire_kind
+        {
+            WIRE_BATCH = 0,
+            WIRE_COLLECT
+        };
+
+        /// \brief Frame header, followed by count records and blob bytes of names
+        typedef struct wire_header
+        {
+            uint32_t magic;
+            uint32_t kind;
+            uint32_t count;
+            uint32_t blob;
+        } wire_header_t;
+
+        /// \brief Batch operation on the wire, doubles as the reply record (op holds found)
+        typedef struct wire_op
+        {
+            uint64_t uid;
+            uint32_t op;
+            uint32_t promise_key;
+            uint32_t flags;
+            uint32_t name_len;
+        } wire_op_t;
+
+
+        /// \brief Builds a frame in buf, get(i, &op) returns record i and sets its op word
+        template<class Get>
+        void encode(std::vector<unsigned char> &buf, uint32_t kind, size_t n, Get get)
+        {
+            size_t blob = 0;
+            for (size_t i = 0; i < n; ++i) {
+                blob += get(i, (uint32_t *)NULL).name.size();
+            }
+
+            buf.resize(sizeof(wire_header_t) + n * sizeof(wire_op_t) + blob);
+
+            wire_header_t hdr = { SHARD_WIRE_MAGIC, kind, (uint32_t)n, (uint32_t)blob };
+            memcpy(&buf[0], &hdr, sizeof(hdr));
+
+            unsigned char *rec   = &buf[0] + sizeof(hdr);
+            unsigned char *names = rec + n * sizeof(wire_op_t);
+            for (size_t i = 0; i < n; ++i) {
+                uint32_t op;
+                const snapshot::register_entry_t &e = get(i, &op);
+                wire_op_t w = { e.uid, op, e.promise_key, e.flags, (uint32_t)e.name.size() };
+                memcpy(rec + i * sizeof(wire_op_t), &w, sizeof(w));
+                memcpy(names, e.name.c_str(), w.name_len);
+                names += w.name_len;
+            }
+        }
+
+
+        /// \brief Walks the records of a frame body, returns FALSE if the names run past the blob or cannot be interned
+        template<class Put>
+        bool decode(const unsigned char *body, size_t n, size_t blob, Put put)
+        {
+            const unsigned char *names = body + n * sizeof(wire_op_t);
+            size_t used = 0;
+            for (size_t i = 0; i < n; ++i) {
+                wire_op_t w;
+                memcpy(&w, body + i * sizeof(wire_op_t), sizeof(w));
+                if (CRUNCHY_UNLIKELY(w.name_len > blob - used)) {
+                    return false;
+                }
+
+                snapshot::register_entry_t e;
+                e.uid         = w.uid;
+                e.name        = intern::istring::from_result(intern::intern((const char *)names + used, w.name_len));
+                if (CRUNCHY_UNLIKELY(!e.name.valid())) {
+                    return false;
+                }
+                e.promise_key = w.promise_key;
+                e.flags       = w.flags;
+                used += w.name_len;
+
+                put(i, w.op, e);
+            }
+            return true;
+        }
+
+
+        inline bool in_ranges(uint64_t hash, const hash_range_t *ranges, size_t n)
+        {
+            for (size_t r = 0; r < n; ++r) {
+                if (hash >= ranges[r].lo && hash <= ranges[r].hi) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+
+#if !(defined(_WIN32) | defined(WIN32))
+        bool write_all(int fd, const void *data, size_t len)
+        {
+            const unsigned char *p = (const unsigned char *)data;
+            while (len) {
+                ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (CRUNCHY_UNLIKELY(n <= 0)) {
+                    return false;
+                }
+                p   += n;
+                len -= (size_t)n;
+            }
+            return true;
+        }
+
+
+        bool read_all(int fd, void *data, size_t len)
+        {
+            unsigned char *p = (unsigned char *)data;
+            while (len) {
+                ssize_t n = recv(fd, p, len, 0);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (CRUNCHY_UNLIKELY(n <= 0)) {
+                    return false;
+                }
+                p   += n;
+                len -= (size_t)n;
+            }
+            return true;
+        }
+
+
+        /// \brief Reads a frame header and its body into buf
+        bool read_frame(int fd, wire_header_t *hdr, std::vector<unsigned char> &buf, size_t recordSize)
+        {
+            if (!read_all(fd, hdr, sizeof(*hdr))) {
+                return false;
+            }
+
+            uint64_t len = (uint64_t)hdr->count * recordSize + hdr->blob;
+            if (CRUNCHY_UNLIKELY(hdr->magic != SHARD_WIRE_MAGIC || len > SHARD_MAX_FRAME)) {
+                return false;
+            }
+
+            buf.resize((size_t)len + 1);
+            return read_all(fd, &buf[0], (size_t)len);
+        }
+
+
+        bool unix_address(const std::string &path, struct sockaddr_un *addr)
+        {
+            memset(addr, 0, sizeof(*addr));
+            addr->sun_family = AF_UNIX;
+            if (CRUNCHY_UNLIKELY(path.size() >= sizeof(addr->sun_path))) {
+                return false;
+            }
+            memcpy(addr->sun_path, path.c_str(), path.size());
+            return true;
+        }
+#endif
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      HASH RING
+
+    void hash_ring::add(uint32_t shard, uint32_t vnodes)
+    {
+        points.reserve(points.size() + vnodes);
+        for (uint32_t v = 0; v < vnodes; ++v) {
+            point_t p = { shard_hash(((uint64_t)shard << 32) | v), shard };
+            points.push_back(p);
+        }
+
+        std::sort(points.begin(), points.end(), [](const point_t &a, const point_t &b) { return a.hash < b.hash; });
+    }
+
+
+    uint32_t hash_ring::owner(uint64_t hash) const
+    {
+        std::vector<point_t>::const_iterator it =
+            std::lower_bound(points.begin(), points.end(), hash, [](const point_t &p, uint64_t h) { return p.hash < h; });
+        return it == points.end() ? points[0].shard : it->shard;
+    }
+
+
+    std::vector<hash_range_t> hash_ring::ranges(uint32_t shard) const
+    {
+        std::vector<hash_range_t> out;
+        for (size_t i = 0; i < points.size(); ++i) {
+            if (points[i].shard != shard) {
+                continue;
+            }
+
+            if (i > 0) {
+                hash_range_t r = { points[i - 1].hash + 1, points[i].hash };
+                out.push_back(r);
+                continue;
+            }
+
+            // The first point also owns the wrap past the last one
+            hash_range_t head = { 0, points[0].hash };
+            out.push_back(head);
+            if (points.back().hash != UINT64_MAX) {
+                hash_range_t tail = { points.back().hash + 1, UINT64_MAX };
+                out.push_back(tail);
+            }
+        }
+        return out;
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      SHARD BACKEND
+
+    std::error_code shard_backend::entries(std::vector<snapshot::register_entry_t> &out)
+    {
+        const hash_range_t all = { 0, UINT64_MAX };
+        std::vector<uint64_t> uids;
+        std::error_code err = collect(&all, 1, uids);
+        if (CRUNCHY_UNLIKELY(err)) {
+            return err;
+        }
+
+        std::vector<shard_op_t> ops;
+        std::vector<shard_reply_t> replies;
+        for (size_t at = 0; at < uids.size(); at += SHARD_MIGRATE_CHUNK) {
+            size_t n = std::min((size_t)SHARD_MIGRATE_CHUNK, uids.size() - at);
+
+            ops.assign(n, shard_op_t());
+            replies.resize(n);
+            for (size_t i = 0; i < n; ++i) {
+                ops[i].op        = SHARD_GET;
+                ops[i].entry.uid = uids[at + i];
+            }
+
+            if (CRUNCHY_UNLIKELY((err = submit(&ops[0], n, &replies[0])) || (err = complete()))) {
+                return err;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                if (replies[i].found) {
+                    out.push_back(replies[i].entry);
+                }
+            }
+        }
+        return std::error_code();
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      LOCAL SHARD
+
+    std::error_code local_shard::submit(const shard_op_t *ops, size_t n, shard_reply_t *replies)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        for (size_t i = 0; i < n; ++i) {
+            const shard_op_t &op = ops[i];
+            shard_reply_t &rep   = replies[i];
+
+            std::unordered_map<uint64_t, snapshot::register_entry_t>::iterator it = table.find(op.entry.uid);
+            rep.found = it != table.end();
+            rep.entry = rep.found ? it->second : op.entry;
+
+            switch (op.op) {
+                case SHARD_PUT:
+                    if (rep.found) {
+                        it->second = op.entry;
+                    }
+                    else {
+                        table.insert(std::make_pair(op.entry.uid, op.entry));
+                        present.insert(op.entry.uid);
+                    }
+                    break;
+
+                case SHARD_ADD:
+                    if (!rep.found) {
+                        table.insert(std::make_pair(op.entry.uid, op.entry));
+                        present.insert(op.entry.uid);
+                    }
+                    break;
+
+                case SHARD_DEL:
+                case SHARD_TAKE:
+                    if (rep.found) {
+                        table.erase(it);
+                        present.erase(op.entry.uid);
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+        }
+
+        return std::error_code();
+    }
+
+
+    std::error_code local_shard::collect(const hash_range_t *ranges, size_t n, std::vector<uint64_t> &uids)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        std::unordered_map<uint64_t, snapshot::register_entry_t>::const_iterator it;
+        for (it = table.begin(); it != table.end(); ++it) {
+            if (in_ranges(shard_hash(it->first), ranges, n)) {
+                uids.push_back(it->first);
+            }
+        }
+        return std::error_code();
+    }
+
+
+    std::error_code local_shard::entries(std::vector<snapshot::register_entry_t> &out)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        out.reserve(out.size() + table.size());
+        std::unordered_map<uint64_t, snapshot::register_entry_t>::const_iterator it;
+        for (it = table.begin(); it != table.end(); ++it) {
+            out.push_back(it->second);
+        }
+        return std::error_code();
+    }
+
+
+    size_t local_shard::size()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return table.size();
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      SOCKET SHARD
+
+    socket_shard::socket_shard()
+        : fd(-1), pending(NULL), pendingCount(0)
+    {
+    }
+
+
+    socket_shard::~socket_shard()
+    {
+#if !(defined(_WIN32) | defined(WIN32))
+        if (fd >= 0) close((int)fd);
+#endif
+    }
+
+
+    std::error_code socket_shard::connect(const std::string &path)
+    {
+#if defined(_WIN32) | defined(WIN32)
+        (void)path;
+        return std::make_error_code(std::errc::not_supported);
+#else
+        std::lock_guard<std::mutex> guard(lock);
+
+        struct sockaddr_un addr;
+        int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (CRUNCHY_UNLIKELY(s < 0 || !unix_address(path, &addr) ||
+                             ::connect(s, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+            if (s >= 0) close(s);
+            return IOexception::set_error(IOexception::io_errc::cannot_bind_socket);
+        }
+
+        if (fd >= 0) close((int)fd);
+        fd = s;
+        return std::error_code();
+#endif
+    }
+
+
+    std::error_code socket_shard::submit(const shard_op_t *ops, size_t n, shard_reply_t *replies)
+    {
+#if defined(_WIN32) | defined(WIN32)
+        (void)ops; (void)n; (void)replies;
+        return std::make_error_code(std::errc::not_supported);
+#else
+        lock.lock();
+
+        encode(buf, WIRE_BATCH, n, [&](size_t i, uint32_t *op) -> const snapshot::register_entry_t & {
+            if (op) *op = ops[i].op;
+            return ops[i].entry;
+        });
+
+        if (CRUNCHY_UNLIKELY(fd < 0 || !write_all((int)fd, &buf[0], buf.size()))) {
+            lock.unlock();
+            return IOexception::set_error(IOexception::io_errc::short_write);
+        }
+
+        pending      = replies;
+        pendingCount = n;
+        return std::error_code();
+#endif
+    }
+
+
+    std::error_code socket_shard::complete()
+    {
+#if defined(_WIN32) | defined(WIN32)
+        return std::make_error_code(std::errc::not_supported);
+#else
+        std::lock_guard<std::mutex> guard(lock, std::adopt_lock);
+
+        wire_header_t hdr;
+        bool ok = read_frame((int)fd, &hdr, buf, sizeof(wire_op_t)) &&
+                  hdr.kind == WIRE_BATCH && hdr.count == pendingCount;
+
+        shard_reply_t *replies = pending;
+        ok = ok && decode(&buf[0], hdr.count, hdr.blob, [&](size_t i, uint32_t found, const snapshot::register_entry_t &e) {
+            replies[i].found = found != 0;
+            replies[i].entry = e;
+        });
+
+        pending      = NULL;
+        pendingCount = 0;
+
+        if (CRUNCHY_UNLIKELY(!ok)) {
+            return IOexception::set_error(IOexception::io_errc::bad_format);
+        }
+        return std::error_code();
+#endif
+    }
+
+
+    std::error_code socket_shard::collect(const hash_range_t *ranges, size_t n, std::vector<uint64_t> &uids)
+    {
+#if defined(_WIN32) | defined(WIN32)
+        (void)ranges; (void)n; (void)uids;
+        return std::make_error_code(std::errc::not_supported);
+#else
+        std::lock_guard<std::mutex> guard(lock);
+
+        wire_header_t hdr = { SHARD_WIRE_MAGIC, WIRE_COLLECT, (uint32_t)n, 0 };
+        if (CRUNCHY_UNLIKELY(fd < 0 || !write_all((int)fd, &hdr, sizeof(hdr)) ||
+                             !write_all((int)fd, ranges, n * sizeof(hash_range_t)))) {
+            return IOexception::set_error(IOexception::io_errc::short_write);
+        }
+
+        if (CRUNCHY_UNLIKELY(!read_frame((int)fd, &hdr, buf, sizeof(uint64_t)) || hdr.kind != WIRE_COLLECT)) {
+            return IOexception::set_error(IOexception::io_errc::bad_format);
+        }
+
+        size_t at = uids.size();
+        uids.resize(at + hdr.count);
+        if (hdr.count) {
+            memcpy(&uids[at], &buf[0], hdr.count * sizeof(uint64_t));
+        }
+        return std::error_code();
+#endif
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      SHARD SERVER
+
+    shard_server::shard_server(local_shard *backend)
+        : backend(backend), listener(-1), running(false)
+    {
+    }
+
+
+    shard_server::~shard_server()
+    {
+        stop();
+    }
+
+
+    std::error_code shard_server::start(const std::string &path)
+    {
+#if defined(_WIN32) | defined(WIN32)
+        (void)path;
+        return std::make_error_code(std::errc::not_supported);
+#else
+        struct sockaddr_un addr;
+        int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (s >= 0 && unix_address(path, &addr)) {
+            unlink(path.c_str());
+        }
+        if (CRUNCHY_UNLIKELY(s < 0 || !unix_address(path, &addr) ||
+                             bind(s, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(s, 64) != 0)) {
+            if (s >= 0) close(s);
+            return IOexception::set_error(IOexception::io_errc::cannot_bind_socket);
+        }
+
+        this->path = path;
+        listener   = s;
+        running.store(true, std::memory_order_release);
+        acceptor   = std::thread(&shard_server::accept_loop, this);
+        return std::error_code();
+#endif
+    }
+
+
+    void shard_server::stop()
+    {
+#if !(defined(_WIN32) | defined(WIN32))
+        if (!running.exchange(false)) {
+            return;
+        }
+
+        shutdown((int)listener, SHUT_RDWR);
+        acceptor.join();
+        close((int)listener);
+        listener = -1;
+        unlink(path.c_str());
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for (size_t i = 0; i < conns.size(); ++i) {
+                shutdown((int)conns[i], SHUT_RDWR);
+            }
+        }
+        for (size_t i = 0; i < workers.size(); ++i) {
+            workers[i].join();
+        }
+        workers.clear();
+        finished.clear();
+#endif
+    }
+
+
+    void shard_server::reap()
+    {
+        std::vector<std::thread> done;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for (size_t f = 0; f < finished.size(); ++f) {
+                for (size_t w = 0; w < workers.size(); ++w) {
+                    if (workers[w].get_id() == finished[f]) {
+                        done.push_back(std::move(workers[w]));
+                        workers[w] = std::move(workers.back());
+                        workers.pop_back();
+                        break;
+                    }
+                }
+            }
+            finished.clear();
+        }
+
+        // They have left serve(), joining only waits for the thread to wind down
+        for (size_t i = 0; i < done.size(); ++i) {
+            done[i].join();
+        }
+    }
+
+
+    void shard_server::accept_loop()
+    {
+#if !(defined(_WIN32) | defined(WIN32))
+        while (running.load(std::memory_order_acquire)) {
+            int c = accept4((int)listener, NULL, NULL, SOCK_CLOEXEC);
+            if (c < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                return;
+            }
+
+            // Connections come and go, join the threads of the closed ones before adding another
+            reap();
+
+            std::lock_guard<std::mutex> guard(lock);
+            conns.push_back(c);
+            workers.push_back(std::thread(&shard_server::serve, this, (intptr_t)c));
+        }
+#endif
+    }
+
+
+    void shard_server::serve(intptr_t conn)
+    {
+#if !(defined(_WIN32) | defined(WIN32))
+        int c = (int)conn;
+        std::vector<unsigned char> in, out;
+        std::vector<shard_op_t> ops;
+        std::vector<shard_reply_t> replies;
+        std::vector<uint64_t> uids;
+
+        for (;;) {
+            wire_header_t hdr;
+            if (!read_all(c, &hdr, sizeof(hdr)) || hdr.magic != SHARD_WIRE_MAGIC) {
+                break;
+            }
+
+            size_t recordSize = hdr.kind == WIRE_BATCH ? sizeof(wire_op_t) : sizeof(hash_range_t);
+            uint64_t len = (uint64_t)hdr.count * recordSize + hdr.blob;
+            if (CRUNCHY_UNLIKELY(len > SHARD_MAX_FRAME)) {
+                break;
+            }
+            in.resize((size_t)len + 1);
+            if (!read_all(c, &in[0], (size_t)len)) {
+                break;
+            }
+
+            if (hdr.kind == WIRE_COLLECT) {
+                std::vector<hash_range_t> ranges(hdr.count);
+                if (hdr.count) {
+                    memcpy(&ranges[0], &in[0], hdr.count * sizeof(hash_range_t));
+                }
+
+                uids.clear();
+                backend->collect(ranges.empty() ? NULL : &ranges[0], ranges.size(), uids);
+
+                wire_header_t rep = { SHARD_WIRE_MAGIC, WIRE_COLLECT, (uint32_t)uids.size(), 0 };
+                if (!write_all(c, &rep, sizeof(rep)) || !write_all(c, uids.empty() ? NULL : &uids[0], uids.size() * sizeof(uint64_t))) {
+                    break;
+                }
+                continue;
+            }
+
+            ops.resize(hdr.count);
+            replies.resize(hdr.count);
+            bool ok = decode(&in[0], hdr.count, hdr.blob, [&](size_t i, uint32_t op, const snapshot::register_entry_t &e) {
+                ops[i].op    = op;
+                ops[i].entry = e;
+            });
+            if (CRUNCHY_UNLIKELY(!ok)) {
+                break;
+            }
+
+            if (hdr.count) {
+                backend->submit(&ops[0], ops.size(), &replies[0]);
+                backend->complete();
+            }
+
+            encode(out, WIRE_BATCH, replies.size(), [&](size_t i, uint32_t *found) -> const snapshot::register_entry_t & {
+                if (found) *found = replies[i].found ? 1 : 0;
+                return replies[i].entry;
+            });
+            if (!write_all(c, &out[0], out.size())) {
+                break;
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        conns.erase(std::find(conns.begin(), conns.end(), conn));
+        close(c);
+        finished.push_back(std::this_thread::get_id());
+#endif
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      SHARDED REGISTER
+
+    sharded_register::sharded_register(size_t expected, double fpr)
+        : migrating(false), writerWaiting(false), present{ { expected, fpr }, { expected, fpr } },
+          presentEpoch(0), presentStale(0), presentLimit(expected / 4 ? expected / 4 : 1)
+    {
+        snapshot::attach(this);
+    }
+
+
+    sharded_register::~sharded_register()
+    {
+        snapshot::detach(this);
+    }
+
+
+    std::unique_lock<std::shared_timed_mutex> sharded_register::exclusive()
+    {
+        std::lock_guard<std::mutex> queue(gate);
+        writerWaiting.store(true, std::memory_order_release);
+        std::unique_lock<std::shared_timed_mutex> guard(lock);
+        writerWaiting.store(false, std::memory_order_release);
+        return guard;
+    }
+
+
+    std::error_code sharded_register::dispatch(const shard_op_t *ops, size_t n, shard_reply_t *replies,
+                                               const uint32_t *owners)
+    {
+        size_t shardCount = backends.size();
+
+        // Counting sort by owner keeps ops on the same UID in order, reused per thread
+        static thread_local std::vector<size_t> start;
+        static thread_local std::vector<size_t> order;
+        static thread_local std::vector<shard_op_t> sorted;
+        static thread_local std::vector<shard_reply_t> sortedReplies;
+
+        start.assign(shardCount + 1, 0);
+        for (size_t i = 0; i < n; ++i) {
+            ++start[owners[i] + 1];
+        }
+        for (size_t s = 0; s < shardCount; ++s) {
+            start[s + 1] += start[s];
+        }
+
+        order.resize(n);
+        sorted.resize(n);
+        sortedReplies.resize(n);
+        {
+            std::vector<size_t> at(start.begin(), start.end() - 1);
+            for (size_t i = 0; i < n; ++i) {
+                size_t k  = at[owners[i]]++;
+                order[k]  = i;
+                sorted[k] = ops[i];
+            }
+        }
+
+        // Every shard's part goes out before any reply is waited on
+        std::error_code err;
+        std::vector<bool> inFlight(shardCount, false);
+        for (size_t s = 0; s < shardCount; ++s) {
+            size_t count = start[s + 1] - start[s];
+            if (count == 0) {
+                continue;
+            }
+            std::error_code e = backends[s]->submit(&sorted[start[s]], count, &sortedReplies[start[s]]);
+            if (CRUNCHY_UNLIKELY(e)) {
+                if (!err) err = e;
+                continue;
+            }
+            inFlight[s] = true;
+        }
+        for (size_t s = 0; s < shardCount; ++s) {
+            if (inFlight[s]) {
+                std::error_code e = backends[s]->complete();
+                if (CRUNCHY_UNLIKELY(e) && !err) {
+                    err = e;
+                }
+            }
+        }
+
+        for (size_t k = 0; k < n; ++k) {
+            replies[order[k]] = sortedReplies[k];
+        }
+        return err;
+    }
+
+
+    std::shared_lock<std::shared_timed_mutex> sharded_register::shared()
+    {
+        if (CRUNCHY_UNLIKELY(writerWaiting.load(std::memory_order_acquire))) {
+            std::lock_guard<std::mutex> queue(gate);
+        }
+        return std::shared_lock<std::shared_timed_mutex>(lock);
+    }
+
+
+    std::error_code sharded_register::apply(const shard_op_t *ops, size_t n, shard_reply_t *replies)
+    {
+        std::error_code err;
+        {
+            std::shared_lock<std::shared_timed_mutex> guard = shared();
+            err = apply_locked(ops, n, replies);
+        }
+        prune_filter();
+        return err;
+    }
+
+
+    std::error_code sharded_register::apply_locked(const shard_op_t *ops, size_t n, shard_reply_t *replies)
+    {
+        if (CRUNCHY_UNLIKELY(ring.empty())) {
+            return IOexception::set_error(IOexception::io_errc::not_registered);
+        }
+
+        // Into the filter before any shard holds the UID. The epoch only moves under the exclusive lock
+        uint64_t epoch = presentEpoch.load(std::memory_order_relaxed);
+        filter::bloom_filter &current = present[(epoch >> 1) & 1];
+        filter::bloom_filter &next    = present[((epoch >> 1) & 1) ^ 1];
+        for (size_t i = 0; i < n; ++i) {
+            if (ops[i].op == SHARD_PUT || ops[i].op == SHARD_ADD) {
+                current.insert(ops[i].entry.uid);
+                if (epoch & 1) {
+                    next.insert(ops[i].entry.uid);
+                }
+            }
+        }
+
+        std::error_code err = route(ops, n, replies);
+
+        // Replies of a failed batch may be stale, an erase missed here only delays the rebuild
+        size_t erased = 0;
+        for (size_t i = 0; !err && i < n; ++i) {
+            if ((ops[i].op == SHARD_DEL || ops[i].op == SHARD_TAKE) && replies[i].found) {
+                ++erased;
+            }
+        }
+        if (erased) {
+            presentStale.fetch_add(erased, std::memory_order_relaxed);
+        }
+        return err;
+    }
+
+
+    std::error_code sharded_register::route(const shard_op_t *ops, size_t n, shard_reply_t *replies)
+    {
+
+        std::vector<uint32_t> owners(n);
+        std::vector<size_t> moving;
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t h = shard_hash(ops[i].entry.uid);
+            owners[i]  = ring.owner(h);
+            if (migrating && previous.owner(h) != owners[i]) {
+                moving.push_back(i);
+            }
+        }
+
+        if (moving.empty()) {
+            return n ? dispatch(ops, n, replies, &owners[0]) : std::error_code();
+        }
+
+        // UIDs being moved may still sit on their old shard, they take the slow path in order
+        std::vector<shard_op_t> fast;
+        std::vector<uint32_t> fastOwners;
+        std::vector<size_t> fastIndex;
+        for (size_t i = 0, m = 0; i < n; ++i) {
+            if (m < moving.size() && moving[m] == i) {
+                ++m;
+                continue;
+            }
+            fast.push_back(ops[i]);
+            fastOwners.push_back(owners[i]);
+            fastIndex.push_back(i);
+        }
+
+        std::error_code err;
+        if (!fast.empty()) {
+            std::vector<shard_reply_t> fastReplies(fast.size());
+            err = dispatch(&fast[0], fast.size(), &fastReplies[0], &fastOwners[0]);
+            for (size_t k = 0; k < fast.size(); ++k) {
+                replies[fastIndex[k]] = fastReplies[k];
+            }
+        }
+
+        for (size_t m = 0; m < moving.size(); ++m) {
+            size_t i = moving[m];
+            shard_backend *now = backends[owners[i]];
+            shard_backend *old = backends[previous.owner(shard_hash(ops[i].entry.uid))];
+
+            shard_op_t probe = ops[i];
+            shard_reply_t other;
+            std::error_code e;
+
+            switch (ops[i].op) {
+                case SHARD_ADD:
+                    // Only add if the old shard does not still hold it
+                    probe.op = SHARD_GET;
+                    if (!(e = old->submit(&probe, 1, &other)) && !(e = old->complete()) && other.found) {
+                        replies[i] = other;
+                        break;
+                    }
+                    if (!e && !(e = now->submit(&ops[i], 1, &replies[i]))) {
+                        e = now->complete();
+                    }
+                    break;
+
+                case SHARD_DEL:
+                    if (!(e = now->submit(&ops[i], 1, &replies[i])) && !(e = now->complete()) &&
+                        !(e = old->submit(&ops[i], 1, &other)) && !(e = old->complete())) {
+                        if (other.found && !replies[i].found) replies[i] = other;
+                    }
+                    break;
+
+                default:
+                    // PUT, GET and TAKE go to the new owner, GET and TAKE fall back to the old one
+                    if (!(e = now->submit(&ops[i], 1, &replies[i])) && !(e = now->complete()) && !replies[i].found) {
+                        probe.op = ops[i].op == SHARD_PUT ? (uint32_t)SHARD_GET : ops[i].op;
+                        if (!(e = old->submit(&probe, 1, &other)) && !(e = old->complete()) && other.found) {
+                            replies[i].found = true;
+                            if (ops[i].op != SHARD_PUT) replies[i].entry = other.entry;
+                        }
+                    }
+                    break;
+            }
+
+            if (CRUNCHY_UNLIKELY(e) && !err) {
+                err = e;
+            }
+        }
+
+        return err;
+    }
+
+
+    std::error_code sharded_register::insert(const snapshot::register_entry_t &entry)
+    {
+        shard_op_t op = { SHARD_PUT, entry };
+        shard_reply_t rep;
+        return apply(&op, 1, &rep);
+    }
+
+
+    bool sharded_register::maybe_registered(uint64_t uid) const
+    {
+        uint64_t epoch = presentEpoch.load(std::memory_order_acquire);
+        if (present[(epoch >> 1) & 1].maybe_contains(uid)) {
+            return true;
+        }
+
+        // A rebuild since the epoch was read may have cleared the filter that was checked
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return presentEpoch.load(std::memory_order_relaxed) != epoch;
+    }
+
+
+    bool sharded_register::single(uint32_t code, uint64_t uid, snapshot::register_entry_t *out)
+    {
+        // Most absent UIDs stop here, before the lock and the ring
+        if (!maybe_registered(uid)) {
+            return false;
+        }
+
+        std::shared_lock<std::shared_timed_mutex> guard = shared();
+
+        if (CRUNCHY_UNLIKELY(ring.empty())) {
+            return false;
+        }
+
+        // While migrating the UID may still be on its old shard
+        uint64_t h = shard_hash(uid);
+        uint32_t now = ring.owner(h);
+        uint32_t old = migrating ? previous.owner(h) : now;
+        if (!backends[now]->maybe_contains(uid) && (old == now || !backends[old]->maybe_contains(uid))) {
+            return false;
+        }
+
+        shard_op_t op = {};
+        op.op        = code;
+        op.entry.uid = uid;
+
+        shard_reply_t rep;
+        if (CRUNCHY_UNLIKELY(apply_locked(&op, 1, &rep)) || !rep.found) {
+            return false;
+        }
+        if (out) {
+            *out = rep.entry;
+        }
+        return true;
+    }
+
+
+    bool sharded_register::find(uint64_t uid, snapshot::register_entry_t *out)
+    {
+        return single(SHARD_GET, uid, out);
+    }
+
+
+    bool sharded_register::erase(uint64_t uid)
+    {
+        bool erased = single(SHARD_DEL, uid, NULL);
+        if (erased) {
+            prune_filter();
+        }
+        return erased;
+    }
+
+
+    void sharded_register::prune_filter()
+    {
+        if (presentStale.load(std::memory_order_relaxed) < presentLimit) {
+            return;
+        }
+
+        // Skipped while a shard is added or another rebuild runs, a later erase comes back
+        std::unique_lock<std::mutex> serial(rebalance, std::try_to_lock);
+        if (!serial.owns_lock() || presentStale.load(std::memory_order_relaxed) < presentLimit) {
+            return;
+        }
+
+        // Nothing writes the idle filter and only readers holding an older epoch read it
+        uint64_t epoch = presentEpoch.load(std::memory_order_relaxed);
+        filter::bloom_filter &next = present[((epoch >> 1) & 1) ^ 1];
+        std::atomic_thread_fence(std::memory_order_release);
+        next.clear();
+
+        // From here on registrations go into both filters, and erases count against the new one
+        {
+            std::unique_lock<std::shared_timed_mutex> guard = exclusive();
+            presentEpoch.store(epoch + 1, std::memory_order_release);
+            presentStale.store(0, std::memory_order_relaxed);
+        }
+
+        // Moves wait on rebalance, so every UID registered before the odd epoch is listed by some shard
+        const hash_range_t all = { 0, UINT64_MAX };
+        std::error_code err;
+        std::vector<uint64_t> uids;
+        for (size_t s = 0; s < backends.size() && !err; ++s) {
+            std::shared_lock<std::shared_timed_mutex> guard = shared();
+            uids.clear();
+            err = backends[s]->collect(&all, 1, uids);
+            for (size_t i = 0; i < uids.size(); ++i) {
+                next.insert(uids[i]);
+            }
+        }
+
+        // A shard that could not be listed keeps the old filter
+        std::unique_lock<std::shared_timed_mutex> guard = exclusive();
+        presentEpoch.store(CRUNCHY_UNLIKELY(err) ? epoch : epoch + 2, std::memory_order_release);
+    }
+
+
+    std::error_code sharded_register::collect(snapshot::crn_instance_t &inst)
+    {
+        // Moves and ring changes wait on rebalance, so every UID stays on the shard it is listed on
+        std::lock_guard<std::mutex> serial(rebalance);
+
+        std::error_code err;
+        std::vector<snapshot::register_entry_t> copied;
+        std::vector<uint32_t> from;
+        for (size_t s = 0; s < backends.size(); ++s) {
+            std::error_code e;
+            {
+                std::shared_lock<std::shared_timed_mutex> guard = shared();
+                e = backends[s]->entries(copied);
+            }
+            if (CRUNCHY_UNLIKELY(e) && !err) {
+                err = e;
+            }
+            from.resize(copied.size(), (uint32_t)s);
+        }
+
+        if (!migrating) {
+            inst.registers.insert(inst.registers.end(), copied.begin(), copied.end());
+            return err;
+        }
+
+        // A move that could not finish can leave an older copy on the previous owner, the new owner's wins
+        std::unordered_set<uint64_t> owned;
+        for (size_t k = 0; k < copied.size(); ++k) {
+            if (ring.owner(shard_hash(copied[k].uid)) == from[k]) {
+                owned.insert(copied[k].uid);
+            }
+        }
+        for (size_t k = 0; k < copied.size(); ++k) {
+            if (ring.owner(shard_hash(copied[k].uid)) == from[k] || owned.count(copied[k].uid) == 0) {
+                inst.registers.push_back(copied[k]);
+            }
+        }
+        return err;
+    }
+
+
+    std::error_code sharded_register::restore(snapshot::snapshot_view &view)
+    {
+        size_t count;
+        IOexception::io_result<const snapshot::snap_register_t *> regs =
+            view.entries<snapshot::snap_register_t>(snapshot::SNAP_REGISTER, &count);
+        if (CRUNCHY_UNLIKELY(!regs)) {
+            return regs.error();
+        }
+
+        // ADD so anything registered since the snapshot was taken wins
+        std::error_code err;
+        std::vector<shard_op_t> ops;
+        std::vector<shard_reply_t> replies;
+        for (size_t at = 0; at < count; at += SHARD_MIGRATE_CHUNK) {
+            size_t n = std::min((size_t)SHARD_MIGRATE_CHUNK, count - at);
+
+            ops.resize(n);
+            replies.resize(n);
+            size_t m = 0;
+            for (size_t i = 0; i < n; ++i) {
+                const snapshot::snap_register_t &r = (*regs)[at + i];
+                ops[m].op                = SHARD_ADD;
+                ops[m].entry.uid         = r.uid;
+                ops[m].entry.name        = view.intern_string(r.name);
+                ops[m].entry.promise_key = r.promise_key;
+                ops[m].entry.flags       = r.flags;
+
+                // A name that cannot be read back is not restored under the wrong name
+                if (CRUNCHY_UNLIKELY(!ops[m].entry.name.valid())) {
+                    if (!err) {
+                        err = IOexception::make_error_code(IOexception::io_errc::out_of_range);
+                    }
+                    continue;
+                }
+                ++m;
+            }
+            if (m == 0) {
+                continue;
+            }
+
+            std::error_code e = apply(&ops[0], m, &replies[0]);
+            if (CRUNCHY_UNLIKELY(e) && !err) {
+                err = e;
+            }
+        }
+        return err;
+    }
+
+
+    std::error_code sharded_register::move(shard_backend *from, shard_backend *to,
+                                           const std::vector<hash_range_t> &ranges, uint32_t code, bool chunked)
+    {
+        std::vector<uint64_t> uids;
+        std::error_code err = from->collect(ranges.empty() ? NULL : &ranges[0], ranges.size(), uids);
+        if (CRUNCHY_UNLIKELY(err)) {
+            return err;
+        }
+
+        std::vector<shard_op_t> ops;
+        std::vector<shard_reply_t> replies;
+        std::vector<shard_op_t> puts;
+        std::vector<shard_reply_t> putReplies;
+
+        for (size_t at = 0; at < uids.size(); at += SHARD_MIGRATE_CHUNK) {
+            size_t n = std::min((size_t)SHARD_MIGRATE_CHUNK, uids.size() - at);
+
+            ops.assign(n, shard_op_t());
+            replies.resize(n);
+            for (size_t i = 0; i < n; ++i) {
+                ops[i].op        = SHARD_TAKE;
+                ops[i].entry.uid = uids[at + i];
+            }
+
+            // Calls wait only for one chunk, a UID is never missing from both shards in between
+            std::unique_lock<std::shared_timed_mutex> guard;
+            if (chunked) {
+                guard = exclusive();
+            }
+
+            std::error_code e;
+            if (CRUNCHY_UNLIKELY((e = from->submit(&ops[0], n, &replies[0])) || (e = from->complete()))) {
+                if (!err) err = e;
+                continue;
+            }
+
+            puts.clear();
+            for (size_t i = 0; i < n; ++i) {
+                if (replies[i].found) {
+                    shard_op_t put = { code, replies[i].entry };
+                    puts.push_back(put);
+                }
+            }
+            if (puts.empty()) {
+                continue;
+            }
+
+            putReplies.resize(puts.size());
+            if (CRUNCHY_UNLIKELY((e = to->submit(&puts[0], puts.size(), &putReplies[0])) || (e = to->complete()))) {
+                // Put them back where they were rather than drop them
+                for (size_t i = 0; i < puts.size(); ++i) {
+                    puts[i].op = SHARD_ADD;
+                }
+                if (!from->submit(&puts[0], puts.size(), &putReplies[0])) {
+                    from->complete();
+                }
+                if (!err) err = e;
+            }
+        }
+        return err;
+    }
+
+
+    std::error_code sharded_register::migrate(uint32_t added)
+    {
+        // Only add_shard() changes backends and the rings, and it is serialized, so reading them unlocked is safe
+        std::error_code err;
+        std::vector<hash_range_t> ranges = ring.ranges(added);
+        for (uint32_t s = 0; s < added; ++s) {
+            // ADD, a write that reached the new owner mid-move is newer than the entry being moved
+            std::error_code e = move(backends[s], backends[added], ranges, SHARD_ADD, true);
+            if (CRUNCHY_UNLIKELY(e) && !err) {
+                err = e;
+            }
+        }
+        if (CRUNCHY_UNLIKELY(err)) {
+            return err;
+        }
+
+        std::unique_lock<std::shared_timed_mutex> guard = exclusive();
+        migrating = false;
+        previous  = hash_ring();
+        return std::error_code();
+    }
+
+
+    std::error_code sharded_register::roll_back(uint32_t added)
+    {
+        // Calls wait for the whole roll back, so nothing new lands on the shard being emptied
+        // and its copy of a UID is always the newest one, PUT it over the old owner's
+        std::unique_lock<std::shared_timed_mutex> guard = exclusive();
+
+        std::error_code err;
+        for (uint32_t s = 0; s < added; ++s) {
+            std::error_code e = move(backends[added], backends[s], previous.ranges(s), SHARD_PUT, false);
+            if (CRUNCHY_UNLIKELY(e) && !err) {
+                err = e;
+            }
+        }
+        if (CRUNCHY_UNLIKELY(err)) {
+            return err;
+        }
+
+        ring = previous;
+        backends.pop_back();
+        migrating = false;
+        previous  = hash_ring();
+        return std::error_code();
+    }
+
+
+    std::error_code sharded_register::add_shard(shard_backend *backend, uint32_t vnodes)
+    {
+        std::lock_guard<std::mutex> serial(rebalance);
+
+        // A move an earlier call could neither finish nor undo is retried before the ring changes again
+        if (CRUNCHY_UNLIKELY(migrating)) {
+            std::error_code e = migrate((uint32_t)backends.size() - 1);
+            if (CRUNCHY_UNLIKELY(e)) {
+                return e;
+            }
+        }
+
+        uint32_t added;
+        {
+            std::unique_lock<std::shared_timed_mutex> guard = exclusive();
+            added = (uint32_t)backends.size();
+            backends.push_back(backend);
+
+            if (ring.empty()) {
+                ring.add(added, vnodes);
+                return std::error_code();
+            }
+
+            previous  = ring;
+            ring.add(added, vnodes);
+            migrating = true;
+        }
+
+        std::error_code err = migrate(added);
+        if (CRUNCHY_UNLIKELY(err)) {
+            // Go back to the old ring. If even that fails stay migrating, reads keep checking both
+            // shards so no UID becomes unreachable, and the next add_shard() retries the move
+            roll_back(added);
+        }
+        return err;
+    }
+}
+}
@@ -0,0 +1,1011 @@
+// SharedRegistry.cpp : Shared-memory component registry with per-slot seqlocks, process leases and dead owner recovery.
+//
+
+#include "../include/CRH_SharedRegistry.h"
+#include "../include/CRH_Hash.h"
+#include <string.h>
+#include <thread>
+
+#if defined(_WIN32) | defined(WIN32)
+#   include <Windows.h>
+#else
+#   include <errno.h>
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+namespace crunchy
+{
+namespace shm
+{
+    namespace
+    {
+        #   define  SHM_STATE_READY 1
+
+        #   define  SHM_SPINS_BEFORE_CHECK 1024        /**< Spins on a locked word before checking the holder is alive */
+        #   define  SHM_NO_SLOT            0xFFFFFFFFU
+        #   define  SHM_INIT_BYTE          0           /**< Byte of the segment locked while it is laid out */
+        #   define  SHM_LEASE_BYTE         1           /**< Lease k locks byte SHM_LEASE_BYTE + k */
+
+#if ATOMIC_LLONG_LOCK_FREE != 2
+#   error "Shared registry needs lock-free 64-bit atomics"
+#endif
+
+#if !(defined(_WIN32) | defined(WIN32))
+#   if defined(F_OFD_SETLK)
+        // Owned by the open file description, so two handles in one process hold separate leases
+#       define  SHM_LOCK_SET   F_OFD_SETLK
+#       define  SHM_LOCK_WAIT  F_OFD_SETLKW
+#       define  SHM_LOCK_GET   F_OFD_GETLK
+#       define  SHM_OFD_LOCKS  1
+#   else
+#       define  SHM_LOCK_SET   F_SETLK
+#       define  SHM_LOCK_WAIT  F_SETLKW
+#       define  SHM_LOCK_GET   F_GETLK
+#       define  SHM_OFD_LOCKS  0
+#   endif
+#endif
+
+        inline uint32_t current_pid()
+        {
+#if defined(_WIN32) | defined(WIN32)
+            return (uint32_t)GetCurrentProcessId();
+#else
+            return (uint32_t)getpid();
+#endif
+        }
+
+
+#if defined(_WIN32) | defined(WIN32)
+        bool process_alive(uint32_t pid)
+        {
+            if (pid == 0) {
+                return false;
+            }
+            HANDLE h = OpenProcess(SYNCHRONIZE, FALSE, pid);
+            if (h == NULL) {
+                return GetLastError() == ERROR_ACCESS_DENIED;
+            }
+            bool alive = WaitForSingleObject(h, 0) == WAIT_TIMEOUT;
+            CloseHandle(h);
+            return alive;
+        }
+
+
+        /**
+         * \brief Creation time of a process folded to 32 bits, tells a pid apart from a later process reusing it.
+         *        Windows has no PID namespaces, a pid names the same process for every caller.
+         *
+         * \return Token, never 0. 0 if the process is gone
+         */
+        uint32_t process_token(uint32_t pid)
+        {
+            uint64_t start = 0;
+            HANDLE h = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+            if (h == NULL) {
+                return 0;
+            }
+            FILETIME created, exited, kernel, user;
+            if (GetProcessTimes(h, &created, &exited, &kernel, &user)) {
+                start = ((uint64_t)created.dwHighDateTime << 32) | created.dwLowDateTime;
+            }
+            CloseHandle(h);
+            uint32_t token = (uint32_t)(start ^ (start >> 32));
+            return start != 0 && token == 0 ? 1 : token;
+        }
+
+
+        /// \brief TRUE if a lease holder recorded as (start token << 32) | pid is no longer running
+        bool holder_gone(uint64_t holder)
+        {
+            uint32_t pid = (uint32_t)holder;
+            if (!process_alive(pid)) {
+                return true;
+            }
+            uint32_t now = process_token(pid);
+            return now != 0 && now != (uint32_t)(holder >> 32);
+        }
+#else
+        /// \brief fcntl on one byte of the segment, retried on EINTR
+        int range_lock(int fd, int cmd, short type, off_t at)
+        {
+            struct flock fl;
+            memset(&fl, 0, sizeof(fl));
+            fl.l_type   = type;
+            fl.l_whence = SEEK_SET;
+            fl.l_start  = at;
+            fl.l_len    = 1;
+
+            int rc;
+            do {
+                rc = fcntl(fd, cmd, &fl);
+            } while (rc != 0 && errno == EINTR);
+            return rc;
+        }
+
+
+        /// \brief TRUE if another open file description holds a lock on byte at
+        bool range_held(int fd, off_t at)
+        {
+            struct flock fl;
+            memset(&fl, 0, sizeof(fl));
+            fl.l_type   = F_WRLCK;
+            fl.l_whence = SEEK_SET;
+            fl.l_start  = at;
+            fl.l_len    = 1;
+
+            // Unable to tell, never declare a live holder dead
+            if (fcntl(fd, SHM_LOCK_GET, &fl) != 0) {
+                return true;
+            }
+            return fl.l_type != F_UNLCK;
+        }
+#endif
+
+
+        inline uint64_t pack(uint32_t owner, uint64_t seq) { return ((uint64_t)owner << 32) | (seq & 0xFFFFFFFFULL); }
+        inline uint32_t lock_owner(uint64_t w) { return (uint32_t)(w >> 32); }
+        inline uint64_t lock_seq(uint64_t w) { return w & 0xFFFFFFFFULL; }
+        inline uint32_t make_token(uint32_t lease, uint32_t gen) { return ((lease + 1) << 16) | (gen & 0xFFFF); }
+
+
+        inline size_t align64(size_t n) { return (n + 63) & ~(size_t)63; }
+        inline size_t leases_at() { return align64(sizeof(shm_header_t)); }
+        inline size_t slots_at() { return align64(leases_at() + SHM_MAX_LEASES * sizeof(shm_lease_t)); }
+
+        size_t segment_size(uint32_t capacity, uint32_t arenaBytes)
+        {
+            return slots_at() + (size_t)capacity * sizeof(shm_slot_t) + arenaBytes;
+        }
+
+
+        inline uint32_t class_bytes(unsigned k) { return 8U << k; }
+
+        /// \brief Smallest name class holding len bytes, #SHM_NAME_CLASSES if none does
+        unsigned name_class(size_t len)
+        {
+            unsigned k = 0;
+            while (k < SHM_NAME_CLASSES && class_bytes(k) < len) {
+                ++k;
+            }
+            return k;
+        }
+
+
+        /**
+         * \brief Lays a segment out in whatever size it has, under the init lock.
+         *        A fresh segment is zero filled by the OS, only one left half done by a dead process is wiped.
+         */
+        void lay_out(unsigned char *base, size_t mapped, uint32_t capacity, bool wipe)
+        {
+            shm_header_t *hdr = (shm_header_t *)base;
+            if (mapped < slots_at() + sizeof(shm_slot_t)) {
+                return;
+            }
+
+            size_t room  = mapped - slots_at();
+            uint64_t cap = capacity;
+            if (cap * sizeof(shm_slot_t) > room) {
+                cap = room / 2 / sizeof(shm_slot_t);
+            }
+
+            if (wipe) {
+                memset(base, 0, mapped);
+            }
+            hdr->magic         = SHM_REGISTRY_MAGIC;
+            hdr->version       = SHM_REGISTRY_VERSION;
+            hdr->capacity      = (uint32_t)cap;
+            hdr->leases_offset = leases_at();
+            hdr->slots_offset  = slots_at();
+            hdr->arena_offset  = slots_at() + cap * sizeof(shm_slot_t);
+            hdr->arena_size    = (uint32_t)(mapped - hdr->arena_offset);
+            hdr->count.store(0, std::memory_order_relaxed);
+            hdr->arena_used.store(0, std::memory_order_relaxed);
+
+            hdr->init.store(SHM_STATE_READY, std::memory_order_release);
+        }
+
+
+        /// \brief TRUE if the header was laid out by this version and fits the mapping
+        bool header_valid(const shm_header_t *hdr, size_t mapped)
+        {
+            return hdr->init.load(std::memory_order_acquire) == SHM_STATE_READY &&
+                   hdr->magic == SHM_REGISTRY_MAGIC && hdr->version == SHM_REGISTRY_VERSION &&
+                   hdr->capacity != 0 && hdr->leases_offset == leases_at() && hdr->slots_offset == slots_at() &&
+                   hdr->arena_offset == hdr->slots_offset + (uint64_t)hdr->capacity * sizeof(shm_slot_t) &&
+                   hdr->arena_offset + hdr->arena_size <= mapped;
+        }
+    }
+
+
+    shared_registry::shared_registry()
+        : base(NULL), hdr(NULL), mapped(0), handle(-1), self(current_pid()), lease(0), token(0)
+    {
+    }
+
+
+    shared_registry::~shared_registry()
+    {
+        detach();
+    }
+
+
+    std::error_code shared_registry::attach(const char *name, uint32_t capacity, uint32_t arenaBytes)
+    {
+        using IOexception::io_errc;
+
+        detach();
+
+        if (CRUNCHY_UNLIKELY(capacity == 0)) {
+            return IOexception::set_error(io_errc::out_of_range);
+        }
+        size_t want = segment_size(capacity, arenaBytes);
+
+#if defined(_WIN32) | defined(WIN32)
+        // An abandoned mutex is handed to the next waiter, so a creator that died half way is taken over
+        std::string initName = std::string(name) + "_init";
+        HANDLE m = CreateMutexA(NULL, FALSE, initName.c_str());
+        if (CRUNCHY_UNLIKELY(m == NULL)) {
+            return IOexception::set_error(io_errc::cannot_open);
+        }
+        DWORD got = WaitForSingleObject(m, INFINITE);
+        if (CRUNCHY_UNLIKELY(got != WAIT_OBJECT_0 && got != WAIT_ABANDONED)) {
+            CloseHandle(m);
+            return IOexception::set_error(io_errc::cannot_open);
+        }
+
+        // Named mappings are created or opened in one call, only the creator's size is used
+        HANDLE h = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                      (DWORD)((uint64_t)want >> 32), (DWORD)want, name);
+        bool blank = h != NULL && GetLastError() != ERROR_ALREADY_EXISTS;
+        void *p = h != NULL ? MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, 0) : NULL;
+        if (CRUNCHY_UNLIKELY(p == NULL)) {
+            if (h != NULL) {
+                CloseHandle(h);
+            }
+            ReleaseMutex(m);
+            CloseHandle(m);
+            return IOexception::set_error(h == NULL ? io_errc::cannot_open : io_errc::cannot_map);
+        }
+        MEMORY_BASIC_INFORMATION info;
+        VirtualQuery(p, &info, sizeof(info));
+        handle = (intptr_t)h;
+        mapped = info.RegionSize;
+        base   = (unsigned char *)p;
+        hdr    = (shm_header_t *)p;
+
+        if (hdr->init.load(std::memory_order_acquire) != SHM_STATE_READY) {
+            lay_out(base, mapped, capacity, !blank);
+        }
+        ReleaseMutex(m);
+        CloseHandle(m);
+#else
+        int fd = shm_open(name, O_RDWR | O_CREAT, 0660);
+        if (CRUNCHY_UNLIKELY(fd < 0)) {
+            return IOexception::set_error(io_errc::cannot_open);
+        }
+
+        // Whoever holds the init lock and finds the segment blank sizes it, nobody else ever truncates it.
+        // Closing the fd drops the lock, so every failure below releases it
+        struct stat st;
+        if (CRUNCHY_UNLIKELY(range_lock(fd, SHM_LOCK_WAIT, F_WRLCK, SHM_INIT_BYTE) != 0 || fstat(fd, &st) != 0)) {
+            close(fd);
+            return IOexception::set_error(io_errc::cannot_open);
+        }
+        bool blank = st.st_size == 0;
+        if (blank && CRUNCHY_UNLIKELY(ftruncate(fd, (off_t)want) != 0 || fstat(fd, &st) != 0)) {
+            close(fd);
+            return IOexception::set_error(io_errc::cannot_map);
+        }
+        if (CRUNCHY_UNLIKELY(st.st_size < (off_t)slots_at())) {
+            close(fd);
+            return IOexception::set_error(io_errc::bad_format);
+        }
+
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (CRUNCHY_UNLIKELY(p == MAP_FAILED)) {
+            close(fd);
+            return IOexception::set_error(io_errc::cannot_map);
+        }
+        handle = fd;
+        mapped = (size_t)st.st_size;
+        base   = (unsigned char *)p;
+        hdr    = (shm_header_t *)p;
+
+        // Not ready with the lock free means whoever was laying it out died, the kernel dropped its lock
+        if (hdr->init.load(std::memory_order_acquire) != SHM_STATE_READY) {
+            lay_out(base, mapped, capacity, !blank);
+        }
+        range_lock(fd, SHM_LOCK_SET, F_UNLCK, SHM_INIT_BYTE);
+#endif
+
+        if (CRUNCHY_UNLIKELY(!header_valid(hdr, mapped))) {
+            detach();
+            return IOexception::set_error(io_errc::bad_format);
+        }
+        if (CRUNCHY_UNLIKELY(!claim_lease())) {
+            detach();
+            return IOexception::set_error(io_errc::out_of_range);
+        }
+
+        return std::error_code();
+    }
+
+
+    void shared_registry::detach()
+    {
+        if (base == NULL) {
+            return;
+        }
+        release_lease();
+#if defined(_WIN32) | defined(WIN32)
+        UnmapViewOfFile(base);
+        CloseHandle((HANDLE)handle);
+#else
+        munmap(base, mapped);
+        close((int)handle);
+#endif
+        base   = NULL;
+        hdr    = NULL;
+        mapped = 0;
+        handle = -1;
+    }
+
+
+    bool shared_registry::unlink(const char *name)
+    {
+#if defined(_WIN32) | defined(WIN32)
+        (void)name;
+        return true; // The mapping goes away with its last handle
+#else
+        return shm_unlink(name) == 0;
+#endif
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      LEASES
+
+    bool shared_registry::claim_lease()
+    {
+        shm_lease_t *ls = leases();
+#if defined(_WIN32) | defined(WIN32)
+        uint64_t mine = ((uint64_t)process_token(self) << 32) | self;
+#endif
+
+        for (uint32_t k = 0; k < SHM_MAX_LEASES; ++k) {
+#if defined(_WIN32) | defined(WIN32)
+            uint64_t cur = ls[k].holder.load(std::memory_order_acquire);
+            if (cur != 0 && !holder_gone(cur)) {
+                continue;
+            }
+            if (!ls[k].holder.compare_exchange_strong(cur, mine, std::memory_order_acq_rel)) {
+                continue;
+            }
+#else
+            if (range_lock((int)handle, SHM_LOCK_SET, F_WRLCK, SHM_LEASE_BYTE + k) != 0) {
+                continue;
+            }
+#   if !SHM_OFD_LOCKS
+            // Process-wide locks never conflict with a lease this process already holds
+            if (ls[k].holder.load(std::memory_order_acquire) == self) {
+                continue;
+            }
+#   endif
+            ls[k].holder.store(self, std::memory_order_release);
+#endif
+            // A new generation, so entries of the lease's last holder stop matching
+            uint32_t gen = ls[k].gen.fetch_add(1, std::memory_order_acq_rel) + 1;
+            lease = k;
+            token = make_token(k, gen);
+            return true;
+        }
+        return false;
+    }
+
+
+    void shared_registry::release_lease()
+    {
+        if (token == 0) {
+            return;
+        }
+        // On POSIX closing the fd drops the lock itself, the holder word is only bookkeeping
+        shm_lease_t &l = leases()[lease];
+        uint64_t cur = l.holder.load(std::memory_order_relaxed);
+        if ((uint32_t)cur == self) {
+            l.holder.compare_exchange_strong(cur, 0, std::memory_order_release);
+        }
+        token = 0;
+    }
+
+
+    bool shared_registry::owner_alive(uint32_t owner) const
+    {
+        if (owner == 0) {
+            return false;
+        }
+        if (owner == token) {
+            return true;
+        }
+
+        uint32_t k = (owner >> 16) - 1;
+        if (k >= SHM_MAX_LEASES) {
+            return false;
+        }
+        const shm_lease_t &l = leases()[k];
+        if ((l.gen.load(std::memory_order_acquire) & 0xFFFF) != (owner & 0xFFFF)) {
+            return false;
+        }
+
+#if defined(_WIN32) | defined(WIN32)
+        uint64_t h = l.holder.load(std::memory_order_acquire);
+        return h != 0 && !holder_gone(h);
+#else
+#   if !SHM_OFD_LOCKS
+        if (l.holder.load(std::memory_order_acquire) == self) {
+            return true;
+        }
+#   endif
+        return range_held((int)handle, SHM_LEASE_BYTE + k);
+#endif
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      SEQLOCK
+
+    bool shared_registry::lock_word(std::atomic<uint64_t> &w, uint64_t *seq)
+    {
+        unsigned spins = 0;
+        for (;;) {
+            uint64_t cur = w.load(std::memory_order_relaxed);
+
+            if ((lock_seq(cur) & 1) == 0) {
+                if (w.compare_exchange_weak(cur, pack(token, lock_seq(cur) + 1), std::memory_order_acquire)) {
+                    // Sequence is odd, no field store may become visible ahead of it
+                    std::atomic_thread_fence(std::memory_order_release);
+                    *seq = lock_seq(cur) + 1;
+                    return false;
+                }
+                continue;
+            }
+
+            if (++spins % SHM_SPINS_BEFORE_CHECK == 0 && !owner_alive(lock_owner(cur))) {
+                // Holder died with the word locked, take it over as it is
+                if (w.compare_exchange_strong(cur, pack(token, lock_seq(cur)), std::memory_order_acquire)) {
+                    std::atomic_thread_fence(std::memory_order_release);
+                    *seq = lock_seq(cur);
+                    return true;
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+
+    bool shared_registry::try_lock_word(std::atomic<uint64_t> &w, uint64_t *seq)
+    {
+        uint64_t cur = w.load(std::memory_order_relaxed);
+        if ((lock_seq(cur) & 1) != 0 ||
+            !w.compare_exchange_strong(cur, pack(token, lock_seq(cur) + 1), std::memory_order_acquire)) {
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        *seq = lock_seq(cur) + 1;
+        return true;
+    }
+
+
+    void shared_registry::unlock_word(std::atomic<uint64_t> &w, uint64_t seq)
+    {
+        w.store(pack(0, seq + 1), std::memory_order_release);
+    }
+
+
+    void shared_registry::lock_slot(shm_slot_t &s, uint64_t *seq)
+    {
+        // A new entry only becomes visible with its uid store, so an empty slot is still clean
+        if (lock_word(s.lock, seq)) {
+            drop_entry(s, false);
+        }
+    }
+
+
+    void shared_registry::drop_entry(shm_slot_t &s, bool reclaim)
+    {
+        // Under the slot lock. count only ever over-reports if a writer dies, it never wraps
+        uint64_t uid = s.uid.load(std::memory_order_relaxed);
+        if (uid != SHM_EMPTY_UID && uid != SHM_TOMBSTONE_UID) {
+            s.uid.store(SHM_TOMBSTONE_UID, std::memory_order_relaxed);
+            hdr->tombstones.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (s.counted) {
+            s.counted = 0;
+            hdr->count.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        // A dead writer may have left the name fields half written, its block is lost rather than freed twice
+        if (reclaim && s.name_len != 0) {
+            free_name(s.name_off, s.name_len);
+        }
+        s.name_off  = 0;
+        s.name_len  = 0;
+        s.owner_pid = 0;
+        s.owner     = 0;
+    }
+
+
+    bool shared_registry::read_slot(shm_slot_t &s, shm_record_t *out)
+    {
+        unsigned spins = 0;
+        for (;;) {
+            uint64_t before = s.lock.load(std::memory_order_acquire);
+            if (lock_seq(before) & 1) {
+                if (++spins % SHM_SPINS_BEFORE_CHECK == 0 && !owner_alive(lock_owner(before))) {
+                    // Let the lock path clean up after the dead writer
+                    uint64_t seq;
+                    lock_slot(s, &seq);
+                    unlock_word(s.lock, seq);
+                }
+                std::this_thread::yield();
+                continue;
+            }
+
+            out->uid         = s.uid.load(std::memory_order_relaxed);
+            out->name_off    = s.name_off;
+            out->name_len    = s.name_len;
+            out->promise_key = s.promise_key;
+            out->flags       = s.flags;
+            out->owner_pid   = s.owner_pid;
+            out->owner       = s.owner;
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.lock.load(std::memory_order_relaxed) == before) {
+                return lock_seq(before) != 0;
+            }
+        }
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      NAME ARENA
+
+    bool shared_registry::alloc_name(size_t len, uint32_t *off)
+    {
+        unsigned k = name_class(len);
+        if (k >= SHM_NAME_CLASSES) {
+            return false;
+        }
+        unsigned char *arena = base + hdr->arena_offset;
+
+        // A freed block of the same class first, the tag stops a block popped and pushed back in between
+        std::atomic<uint64_t> &head = hdr->name_free[k];
+        uint64_t h = head.load(std::memory_order_acquire);
+        while ((uint32_t)h != 0) {
+            uint32_t at   = (uint32_t)h - 1;
+            uint32_t next = ((std::atomic<uint32_t> *)(arena + at))->load(std::memory_order_relaxed);
+            if (head.compare_exchange_weak(h, (((h >> 32) + 1) << 32) | next, std::memory_order_acq_rel)) {
+                *off = at;
+                return true;
+            }
+        }
+
+        // Only advance the arena when the block fits, a failed insert leaves it untouched
+        uint32_t size = class_bytes(k);
+        uint32_t used = hdr->arena_used.load(std::memory_order_relaxed);
+        do {
+            if ((uint64_t)used + size > hdr->arena_size) {
+                return false;
+            }
+        } while (!hdr->arena_used.compare_exchange_weak(used, used + size, std::memory_order_relaxed));
+        *off = used;
+        return true;
+    }
+
+
+    void shared_registry::free_name(uint32_t off, uint32_t len)
+    {
+        unsigned k = name_class(len);
+        if (k >= SHM_NAME_CLASSES) {
+            return;
+        }
+
+        // The first word of a free block links to the next one
+        std::atomic<uint32_t> *link = (std::atomic<uint32_t> *)(base + hdr->arena_offset + off);
+        std::atomic<uint64_t> &head = hdr->name_free[k];
+        uint64_t h = head.load(std::memory_order_relaxed);
+        do {
+            link->store((uint32_t)h, std::memory_order_relaxed);
+        } while (!head.compare_exchange_weak(h, (((h >> 32) + 1) << 32) | (off + 1), std::memory_order_release,
+                                             std::memory_order_relaxed));
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      TABLE
+
+    uint64_t shared_registry::moves_settled()
+    {
+        unsigned spins = 0;
+        for (;;) {
+            uint64_t m = hdr->moving.load(std::memory_order_acquire);
+            if ((lock_seq(m) & 1) == 0) {
+                return m;
+            }
+            if (++spins % SHM_SPINS_BEFORE_CHECK == 0 && !owner_alive(lock_owner(m))) {
+                // The compactor died, the slots it held are dropped by whoever touches them next
+                uint64_t seq;
+                lock_word(hdr->moving, &seq);
+                unlock_word(hdr->moving, seq);
+                continue;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+
+    bool shared_registry::moves_unchanged(uint64_t m) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return hdr->moving.load(std::memory_order_relaxed) == m;
+    }
+
+
+    void shared_registry::maybe_compact()
+    {
+        if ((int32_t)hdr->tombstones.load(std::memory_order_relaxed) > (int32_t)(hdr->capacity / 8)) {
+            compact();
+        }
+    }
+
+
+    void shared_registry::compact()
+    {
+        // No new entry may claim a slot while entries move, then the move word tells misses to look again
+        uint64_t cseq[SHM_CLAIM_STRIPES];
+        for (uint32_t k = 0; k < SHM_CLAIM_STRIPES; ++k) {
+            lock_word(hdr->claim[k], &cseq[k]);
+        }
+
+        shm_slot_t *table = slots();
+        uint32_t cap = hdr->capacity;
+
+        // Someone else compacted while we waited on the claims
+        if ((int32_t)hdr->tombstones.load(std::memory_order_relaxed) > (int32_t)(cap / 8)) {
+            uint64_t mseq;
+            lock_word(hdr->moving, &mseq);
+
+            uint32_t left = 0;
+            for (uint32_t i = 0; i < cap; ++i) {
+                if (table[i].uid.load(std::memory_order_acquire) != SHM_TOMBSTONE_UID) {
+                    continue;
+                }
+                uint32_t hole = i;
+                uint64_t hseq;
+                lock_slot(table[hole], &hseq);
+                if (table[hole].uid.load(std::memory_order_relaxed) != SHM_TOMBSTONE_UID) {
+                    unlock_word(table[hole].lock, hseq);
+                    continue;
+                }
+
+                // Backward shift: pull the next entry whose probe path crosses the hole into it, the
+                // slot it leaves is the new hole. Erases may run meanwhile, they only leave more tombstones
+                bool ended = false;
+                uint32_t j = hole;
+                for (uint32_t probes = 1; probes < cap; ++probes) {
+                    j = j + 1 == cap ? 0 : j + 1;
+                    uint64_t cur = table[j].uid.load(std::memory_order_acquire);
+                    if (cur == SHM_EMPTY_UID) {
+                        ended = true;
+                        break;
+                    }
+                    if (cur == SHM_TOMBSTONE_UID) {
+                        continue;
+                    }
+                    uint32_t home = (uint32_t)(hash::hash64(cur, HASH_SEED_SHM) % cap);
+                    if ((hole + cap - home) % cap >= (j + cap - home) % cap) {
+                        continue;
+                    }
+
+                    uint64_t jseq;
+                    lock_slot(table[j], &jseq);
+                    if (table[j].uid.load(std::memory_order_relaxed) != cur) {
+                        unlock_word(table[j].lock, jseq);
+                        continue;
+                    }
+
+                    // Visible in the hole before it leaves j, a reader missing it saw the move word change
+                    shm_slot_t &to = table[hole], &from = table[j];
+                    to.name_off    = from.name_off;
+                    to.name_len    = from.name_len;
+                    to.promise_key = from.promise_key;
+                    to.flags       = from.flags;
+                    to.owner_pid   = from.owner_pid;
+                    to.owner       = from.owner;
+                    to.counted     = from.counted;
+                    to.uid.store(cur, std::memory_order_relaxed);
+
+                    from.uid.store(SHM_TOMBSTONE_UID, std::memory_order_relaxed);
+                    from.name_off  = 0;
+                    from.name_len  = 0;
+                    from.owner_pid = 0;
+                    from.owner     = 0;
+                    from.counted   = 0;
+
+                    unlock_word(to.lock, hseq);
+                    hole = j;
+                    hseq = jseq;
+                }
+                // No entry after the hole probes past it any more, unless the run is the whole table
+                if (ended) {
+                    table[hole].uid.store(SHM_EMPTY_UID, std::memory_order_relaxed);
+                }
+                else {
+                    ++left;
+                }
+                unlock_word(table[hole].lock, hseq);
+            }
+
+            // Recounted rather than decremented, so a compactor that died mid-way cannot skew it for good
+            hdr->tombstones.store(left, std::memory_order_relaxed);
+            unlock_word(hdr->moving, mseq);
+        }
+
+        for (uint32_t k = SHM_CLAIM_STRIPES; k-- > 0; ) {
+            unlock_word(hdr->claim[k], cseq[k]);
+        }
+    }
+
+
+    std::error_code shared_registry::write_entry(shm_slot_t &s, bool fresh, const std::string &name,
+                                                 uint32_t promise_key, uint32_t flags)
+    {
+        using IOexception::io_errc;
+
+        // Under the slot lock. A re-registration with the same name keeps its bytes, one of the same
+        // class is written over them, anything else moves to a new block and frees the old one
+        uint32_t oldLen = fresh ? 0 : s.name_len;
+        if (fresh || oldLen != name.size() || memcmp(base + hdr->arena_offset + s.name_off, name.data(), name.size()) != 0) {
+            bool inPlace = oldLen != 0 && !name.empty() && name_class(oldLen) == name_class(name.size());
+            uint32_t off = inPlace ? s.name_off : 0;
+            if (!inPlace && !name.empty() && CRUNCHY_UNLIKELY(!alloc_name(name.size(), &off))) {
+                return IOexception::set_error(io_errc::out_of_range);
+            }
+            memcpy(base + hdr->arena_offset + off, name.data(), name.size());
+            if (!inPlace && oldLen != 0) {
+                free_name(s.name_off, oldLen);
+            }
+            s.name_off = off;
+            s.name_len = (uint32_t)name.size();
+        }
+
+        s.promise_key = promise_key;
+        s.flags       = flags;
+        s.owner_pid   = self;
+        s.owner       = token;
+        return std::error_code();
+    }
+
+
+    IOexception::io_result<uint32_t> shared_registry::insert(uint64_t uid, const std::string &name, uint32_t promise_key, uint32_t flags)
+    {
+        using IOexception::io_errc;
+
+        if (CRUNCHY_UNLIKELY(hdr == NULL || uid == SHM_EMPTY_UID || uid == SHM_TOMBSTONE_UID ||
+                             name_class(name.size()) >= SHM_NAME_CLASSES)) {
+            return IOexception::set_error(io_errc::out_of_range);
+        }
+
+        shm_slot_t *table = slots();
+        uint32_t cap  = hdr->capacity;
+        uint64_t h    = hash::hash64(uid, HASH_SEED_SHM);
+        uint32_t home = (uint32_t)(h % cap);
+        std::atomic<uint64_t> &claim = hdr->claim[(h >> 32) % SHM_CLAIM_STRIPES];
+        bool claiming = false;
+        uint64_t cseq = 0;
+
+        for (;;) {
+            // Look for the UID, remembering the first slot a new entry could take on the way
+            uint32_t hit = SHM_NO_SLOT, open = SHM_NO_SLOT;
+            uint32_t i = home;
+            for (uint32_t probes = 0; probes < cap; ++probes, i = (i + 1 == cap) ? 0 : i + 1) {
+                uint64_t cur = table[i].uid.load(std::memory_order_acquire);
+                if (cur == uid) {
+                    hit = i;
+                    break;
+                }
+                if (cur == SHM_EMPTY_UID || cur == SHM_TOMBSTONE_UID) {
+                    open = open == SHM_NO_SLOT ? i : open;
+                    if (cur == SHM_EMPTY_UID) {
+                        break;
+                    }
+                }
+            }
+
+            if (hit != SHM_NO_SLOT) {
+                shm_slot_t &s = table[hit];
+                uint64_t seq;
+                lock_slot(s, &seq);
+                if (s.uid.load(std::memory_order_relaxed) != uid) {
+                    // Erased while we waited on the lock
+                    unlock_word(s.lock, seq);
+                    continue;
+                }
+                std::error_code ec = write_entry(s, false, name, promise_key, flags);
+                unlock_word(s.lock, seq);
+                if (claiming) {
+                    unlock_word(claim, cseq);
+                }
+                if (CRUNCHY_UNLIKELY(ec)) {
+                    return ec;
+                }
+                return hit;
+            }
+
+            if (!claiming) {
+                // One new entry per UID at a time, then look again so a racing insert or a move is found
+                lock_word(claim, &cseq);
+                claiming = true;
+                continue;
+            }
+
+            if (CRUNCHY_UNLIKELY(open == SHM_NO_SLOT)) {
+                unlock_word(claim, cseq);
+                return IOexception::set_error(io_errc::out_of_range);
+            }
+
+            shm_slot_t &s = table[open];
+            uint64_t seq;
+            lock_slot(s, &seq);
+
+            // Another UID may have taken the slot while we waited. Slots only turn empty in compact(),
+            // which holds every claim lock, so the probe path to it is still whole
+            uint64_t cur = s.uid.load(std::memory_order_relaxed);
+            if (cur != SHM_EMPTY_UID && cur != SHM_TOMBSTONE_UID) {
+                unlock_word(s.lock, seq);
+                continue;
+            }
+
+            std::error_code ec = write_entry(s, true, name, promise_key, flags);
+            if (!ec) {
+                // Counted only once the entry can be found
+                if (cur == SHM_TOMBSTONE_UID) {
+                    hdr->tombstones.fetch_sub(1, std::memory_order_relaxed);
+                }
+                s.uid.store(uid, std::memory_order_relaxed);
+                hdr->count.fetch_add(1, std::memory_order_relaxed);
+                s.counted = 1;
+            }
+            unlock_word(s.lock, seq);
+            unlock_word(claim, cseq);
+            if (CRUNCHY_UNLIKELY(ec)) {
+                return ec;
+            }
+            return open;
+        }
+    }
+
+
+    bool shared_registry::find(uint64_t uid, shm_record_t *out)
+    {
+        if (CRUNCHY_UNLIKELY(hdr == NULL || uid == SHM_EMPTY_UID || uid == SHM_TOMBSTONE_UID)) {
+            return false;
+        }
+
+        shm_slot_t *table = slots();
+        uint32_t cap  = hdr->capacity;
+        uint32_t home = (uint32_t)(hash::hash64(uid, HASH_SEED_SHM) % cap);
+
+        for (;;) {
+            uint64_t m = moves_settled();
+            uint32_t i = home;
+            for (uint32_t probes = 0; probes < cap; ++probes, i = (i + 1 == cap) ? 0 : i + 1) {
+                uint64_t cur = table[i].uid.load(std::memory_order_acquire);
+                if (cur == SHM_EMPTY_UID) {
+                    break;
+                }
+                if (cur != uid) {
+                    continue;
+                }
+                if (read_slot(table[i], out) && out->uid == uid) {
+                    return true;
+                }
+                break;
+            }
+
+            // A miss only counts if no entry moved back while we probed
+            if (moves_unchanged(m)) {
+                return false;
+            }
+        }
+    }
+
+
+    const char *shared_registry::name(const shm_record_t &rec) const
+    {
+        return hdr ? (const char *)(base + hdr->arena_offset + rec.name_off) : NULL;
+    }
+
+
+    bool shared_registry::erase(uint64_t uid)
+    {
+        if (CRUNCHY_UNLIKELY(hdr == NULL || uid == SHM_EMPTY_UID || uid == SHM_TOMBSTONE_UID)) {
+            return false;
+        }
+
+        shm_slot_t *table = slots();
+        uint32_t cap  = hdr->capacity;
+        uint32_t home = (uint32_t)(hash::hash64(uid, HASH_SEED_SHM) % cap);
+
+        for (;;) {
+            uint64_t m = moves_settled();
+            uint32_t i = home;
+            for (uint32_t probes = 0; probes < cap; ++probes, i = (i + 1 == cap) ? 0 : i + 1) {
+                shm_slot_t &s = table[i];
+                uint64_t cur = s.uid.load(std::memory_order_acquire);
+                if (cur == SHM_EMPTY_UID) {
+                    break;
+                }
+                if (cur != uid) {
+                    continue;
+                }
+
+                uint64_t seq;
+                lock_slot(s, &seq);
+                bool hit = s.uid.load(std::memory_order_relaxed) == uid;
+                if (hit) {
+                    drop_entry(s, true);
+                }
+                unlock_word(s.lock, seq);
+                if (hit) {
+                    maybe_compact();
+                    return true;
+                }
+                break;
+            }
+
+            if (moves_unchanged(m)) {
+                return false;
+            }
+        }
+    }
+
+
+    size_t shared_registry::reap_dead_owners()
+    {
+        if (hdr == NULL) {
+            return 0;
+        }
+
+        shm_slot_t *table = slots();
+        size_t reaped = 0;
+
+        for (uint32_t i = 0; i < hdr->capacity; ++i) {
+            uint64_t cur = table[i].uid.load(std::memory_order_acquire);
+            if (cur == SHM_EMPTY_UID || cur == SHM_TOMBSTONE_UID) {
+                continue;
+            }
+
+            shm_record_t rec;
+            if (read_slot(table[i], &rec) && rec.uid == cur && !owner_alive(rec.owner)) {
+                uint64_t seq;
+                lock_slot(table[i], &seq);
+                if (table[i].uid.load(std::memory_order_relaxed) == cur && table[i].owner == rec.owner) {
+                    drop_entry(table[i], true);
+                    ++reaped;
+                }
+                unlock_word(table[i].lock, seq);
+            }
+        }
+
+        maybe_compact();
+        return reaped;
+    }
+}
+}
@@ -0,0 +1,481 @@
+// Snapshot.cpp : CRN instance snapshots, collecting, saving and mapping them.
+//
+
+#include "../include/CRH_Snapshot.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(_WIN32) | defined(WIN32)
+#   include <Windows.h>
+#   include <io.h>
+#else
+#   include <unistd.h>
+#endif
+
+namespace crunchy
+{
+namespace snapshot
+{
+    namespace
+    {
+        inline uint64_t align8(uint64_t v) { return (v + 7) & ~(uint64_t)7; }
+
+
+        /**
+         * \brief Collects the string section while saving, each interned string is stored once.
+         */
+        struct string_blob
+        {
+            std::vector<char> bytes;
+            std::unordered_map<uint32_t, snap_string_t> seen;
+
+            snap_string_t add(const char *str, size_t len)
+            {
+                snap_string_t s;
+                s.offset = (uint32_t)bytes.size();
+                s.length = (uint32_t)len;
+                bytes.insert(bytes.end(), str, str + len);
+                return s;
+            }
+
+            snap_string_t add(const intern::istring &str)
+            {
+                std::unordered_map<uint32_t, snap_string_t>::iterator it = seen.find(str.handle());
+                if (it != seen.end()) {
+                    return it->second;
+                }
+                snap_string_t s = add(str.c_str(), str.size());
+                seen[str.handle()] = s;
+                return s;
+            }
+        };
+
+
+        /// \brief Sources attached for capture()
+        struct source_list
+        {
+            std::vector<snapshot_source *> sources;
+            std::mutex lock;
+        };
+
+
+        source_list &sources()
+        {
+            static source_list list;
+            return list;
+        }
+
+
+        /// \brief Flushes stdio and the OS cache of fp to disk
+        bool flush_to_disk(FILE *fp)
+        {
+            if (fflush(fp) != 0) {
+                return false;
+            }
+#if defined(_WIN32) | defined(WIN32)
+            return _commit(_fileno(fp)) == 0;
+#else
+            return fsync(fileno(fp)) == 0;
+#endif
+        }
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      SOURCES
+
+    void attach(snapshot_source *src)
+    {
+        source_list &list = sources();
+        std::lock_guard<std::mutex> guard(list.lock);
+        if (std::find(list.sources.begin(), list.sources.end(), src) == list.sources.end()) {
+            list.sources.push_back(src);
+        }
+    }
+
+
+    void detach(snapshot_source *src)
+    {
+        source_list &list = sources();
+        std::lock_guard<std::mutex> guard(list.lock);
+        list.sources.erase(std::remove(list.sources.begin(), list.sources.end(), src), list.sources.end());
+    }
+
+
+    std::error_code capture(crn_instance_t &inst)
+    {
+        source_list &list = sources();
+        std::lock_guard<std::mutex> guard(list.lock);
+
+        std::error_code err;
+        for (size_t i = 0; i < list.sources.size(); ++i) {
+            std::error_code e = list.sources[i]->collect(inst);
+            if (CRUNCHY_UNLIKELY(e) && !err) {
+                err = e;
+            }
+        }
+        return err;
+    }
+
+
+    void page_table::set(uint32_t signableID, const intern::istring &virtualUID)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        table[signableID] = virtualUID;
+    }
+
+
+    bool page_table::erase(uint32_t signableID)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return table.erase(signableID) != 0;
+    }
+
+
+    bool page_table::find(uint32_t signableID, page_entry_t *out)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::unordered_map<uint32_t, intern::istring>::const_iterator it = table.find(signableID);
+        if (it == table.end()) {
+            return false;
+        }
+        if (out) {
+            out->signableID = it->first;
+            out->virtualUID = it->second;
+        }
+        return true;
+    }
+
+
+    size_t page_table::size()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return table.size();
+    }
+
+
+    std::error_code page_table::collect(crn_instance_t &inst)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        inst.pages.reserve(inst.pages.size() + table.size());
+
+        std::unordered_map<uint32_t, intern::istring>::const_iterator it;
+        for (it = table.begin(); it != table.end(); ++it) {
+            page_entry_t p;
+            p.signableID = it->first;
+            p.virtualUID = it->second;
+            inst.pages.push_back(p);
+        }
+        return std::error_code();
+    }
+
+
+    page_table &pages()
+    {
+        static page_table table;
+        static bool attached = (attach(&table), true);
+        (void)attached;
+        return table;
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      SAVE
+
+
+    IOexception::io_result<uint64_t> save(const crn_instance_t &inst, const std::string &path)
+    {
+        using IOexception::io_errc;
+
+        // Flatten everything first, strings are resolved into the blob as records are built
+        string_blob strings;
+
+        snap_crn_t crnRec;
+        crnRec.default_crn = inst.default_crn;
+        crnRec.stdCRN      = strings.add(inst.stdCRN.data(), inst.stdCRN.size());
+
+        std::vector<snap_register_t> regs(inst.registers.size());
+        for (size_t i = 0; i < regs.size(); ++i) {
+            const register_entry_t &e = inst.registers[i];
+            regs[i].uid         = e.uid;
+            regs[i].name        = strings.add(e.name);
+            regs[i].promise_key = e.promise_key;
+            regs[i].flags       = e.flags;
+        }
+        std::stable_sort(regs.begin(), regs.end(), [](const snap_register_t &a, const snap_register_t &b) {
+            return a.uid < b.uid;
+        });
+
+        std::vector<snap_page_t> pages(inst.pages.size());
+        for (size_t i = 0; i < pages.size(); ++i) {
+            pages[i].signableID = inst.pages[i].signableID;
+            pages[i].virtualUID = strings.add(inst.pages[i].virtualUID);
+        }
+        std::stable_sort(pages.begin(), pages.end(), [](const snap_page_t &a, const snap_page_t &b) {
+            return a.signableID < b.signableID;
+        });
+
+        const void *data[SNAP_SECTIONS] = {
+            &crnRec,
+            regs.empty() ? NULL : &regs[0],
+            pages.empty() ? NULL : &pages[0],
+            strings.bytes.empty() ? NULL : &strings.bytes[0]
+        };
+
+        snap_section_t table[SNAP_SECTIONS];
+        table[SNAP_CRN].entry_size      = sizeof(snap_crn_t);
+        table[SNAP_CRN].count           = 1;
+        table[SNAP_REGISTER].entry_size = sizeof(snap_register_t);
+        table[SNAP_REGISTER].count      = regs.size();
+        table[SNAP_PAGES].entry_size    = sizeof(snap_page_t);
+        table[SNAP_PAGES].count         = pages.size();
+        table[SNAP_STRINGS].entry_size  = 1;
+        table[SNAP_STRINGS].count       = strings.bytes.size();
+
+        uint64_t off = align8(sizeof(snap_header_t) + sizeof(table));
+        for (int s = 0; s < SNAP_SECTIONS; ++s) {
+            size_t len = (size_t)(table[s].entry_size * table[s].count);
+            table[s].offset = off;
+            table[s].crc    = crc32(data[s], len);
+            off = align8(off + len);
+        }
+
+        snap_header_t hdr = {};
+        hdr.magic     = CRN_SNAPSHOT_MAGIC;
+        hdr.version   = CRN_SNAPSHOT_VERSION;
+        hdr.env_size  = default_env::size;
+        hdr.sections  = SNAP_SECTIONS;
+        hdr.file_size = off;
+        hdr.table_crc = crc32(table, sizeof(table));
+
+        std::string tmp = path + ".tmp";
+        FILE *fp = fopen(tmp.c_str(), "wb");
+        if (CRUNCHY_UNLIKELY(fp == NULL)) {
+            return IOexception::set_error(io_errc::cannot_open);
+        }
+
+        static const char pad[8] = { 0 };
+        bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 && fwrite(table, sizeof(table), 1, fp) == 1;
+        uint64_t at = sizeof(hdr) + sizeof(table);
+
+        for (int s = 0; s < SNAP_SECTIONS && ok; ++s) {
+            size_t len = (size_t)(table[s].entry_size * table[s].count);
+            ok = fwrite(pad, 1, (size_t)(table[s].offset - at), fp) == table[s].offset - at;
+            if (ok && len) {
+                ok = fwrite(data[s], 1, len, fp) == len;
+            }
+            at = table[s].offset + len;
+        }
+        if (ok && at < off) {
+            ok = fwrite(pad, 1, (size_t)(off - at), fp) == off - at;
+        }
+
+        // The rename must never land before the data it points at
+        ok = ok && flush_to_disk(fp);
+        ok = fclose(fp) == 0 && ok;
+        if (CRUNCHY_UNLIKELY(!ok)) {
+            remove(tmp.c_str());
+            return IOexception::set_error(io_errc::short_write);
+        }
+
+#if defined(_WIN32) | defined(WIN32)
+        ok = MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        ok = rename(tmp.c_str(), path.c_str()) == 0;
+#endif
+        if (CRUNCHY_UNLIKELY(!ok)) {
+            remove(tmp.c_str());
+            return IOexception::set_error(io_errc::cannot_open);
+        }
+
+        return off;
+    }
+
+
+    // ===============================
+    // -------------------------------
+    //      SNAPSHOT VIEW
+
+    snapshot_view::snapshot_view()
+    {
+        memset(&file, 0, sizeof(file));
+        for (int s = 0; s < SNAP_SECTIONS; ++s) {
+            checked[s].store(0, std::memory_order_relaxed);
+        }
+    }
+
+
+    snapshot_view::~snapshot_view()
+    {
+        close();
+    }
+
+
+    std::error_code snapshot_view::open(const std::string &path)
+    {
+        using IOexception::io_errc;
+
+        close();
+
+        file = paging::map_file(path, false);
+        if (CRUNCHY_UNLIKELY(file.data == NULL)) {
+            io_errc e = file.opened ? io_errc::bad_format : file.error;
+            close();
+            return IOexception::set_error(e);
+        }
+
+        // Only the header and section table are checked here, sections wait for first access
+        const snap_header_t *hdr = (const snap_header_t *)file.data;
+        const snap_section_t *table = (const snap_section_t *)(hdr + 1);
+
+        bool ok = file.size >= sizeof(snap_header_t) + SNAP_SECTIONS * sizeof(snap_section_t) &&
+                  hdr->magic == CRN_SNAPSHOT_MAGIC &&
+                  hdr->version == CRN_SNAPSHOT_VERSION &&
+                  hdr->env_size == (uint32_t)default_env::size &&
+                  hdr->sections == SNAP_SECTIONS &&
+                  hdr->file_size == file.size &&
+                  hdr->table_crc == crc32(table, SNAP_SECTIONS * sizeof(snap_section_t));
+
+        // Bound the count before multiplying, entry_size * count can wrap
+        for (int s = 0; ok && s < SNAP_SECTIONS; ++s) {
+            ok = (table[s].offset & 7) == 0 &&
+                 table[s].offset <= file.size &&
+                 (table[s].entry_size == 0 ? table[s].count == 0
+                                           : table[s].count <= (file.size - table[s].offset) / table[s].entry_size);
+        }
+
+        if (CRUNCHY_UNLIKELY(!ok)) {
+            close();
+            return IOexception::set_error(io_errc::bad_format);
+        }
+
+        return std::error_code();
+    }
+
+
+    void snapshot_view::close()
+    {
+        paging::unmap_file(file);
+        memset(&file, 0, sizeof(file));
+        for (int s = 0; s < SNAP_SECTIONS; ++s) {
+            checked[s].store(0, std::memory_order_relaxed);
+        }
+    }
+
+
+    uint32_t snapshot_view::version() const
+    {
+        return file.data ? ((const snap_header_t *)file.data)->version : 0;
+    }
+
+
+    const void *snapshot_view::section(snapshot_section id, size_t entrySize, size_t *count)
+    {
+        *count = 0;
+        if (CRUNCHY_UNLIKELY(file.data == NULL || id >= SNAP_SECTIONS)) {
+            return NULL;
+        }
+
+        const snap_section_t &sec = ((const snap_section_t *)((const snap_header_t *)file.data + 1))[id];
+        if (CRUNCHY_UNLIKELY(sec.entry_size != entrySize)) {
+            return NULL;
+        }
+
+        const unsigned char *p = file.data + sec.offset;
+
+        uint8_t state = checked[id].load(std::memory_order_acquire);
+        if (CRUNCHY_UNLIKELY(state == 0)) {
+            // Racing first readers may both check, they agree on the answer
+            state = crc32(p, (size_t)(sec.entry_size * sec.count)) == sec.crc ? 1 : 2;
+            checked[id].store(state, std::memory_order_release);
+        }
+        if (CRUNCHY_UNLIKELY(state != 1)) {
+            IOexception::set_error(IOexception::io_errc::bad_format);
+            return NULL;
+        }
+
+        *count = (size_t)sec.count;
+        return p;
+    }
+
+
+    const char *snapshot_view::string(const snap_string_t &s)
+    {
+        size_t len = 0;
+        const char *blob = (const char *)section(SNAP_STRINGS, 1, &len);
+        if (CRUNCHY_UNLIKELY(blob == NULL && s.length != 0)) {
+            return NULL;
+        }
+        if (CRUNCHY_UNLIKELY((uint64_t)s.offset + s.length > len)) {
+            return NULL;
+        }
+        return blob + s.offset;
+    }
+
+
+    intern::istring snapshot_view::intern_string(const snap_string_t &s)
+    {
+        const char *str = string(s);
+        if (CRUNCHY_UNLIKELY(str == NULL)) {
+            return intern::istring::from_handle(INTERN_INVALID);
+        }
+        return intern::istring::from_result(intern::intern(str, s.length));
+    }
+
+
+    bool snapshot_view::find_register(uint64_t uid, register_entry_t *out)
+    {
+        size_t count;
+        const snap_register_t *regs = (const snap_register_t *)section(SNAP_REGISTER, sizeof(snap_register_t), &count);
+        if (CRUNCHY_UNLIKELY(regs == NULL)) {
+            return false;
+        }
+
+        const snap_register_t *it = std::lower_bound(regs, regs + count, uid,
+                                                     [](const snap_register_t &r, uint64_t u) { return r.uid < u; });
+        if (it == regs + count || it->uid != uid) {
+            return false;
+        }
+        if (out) {
+            out->uid         = it->uid;
+            out->name        = intern_string(it->name);
+            out->promise_key = it->promise_key;
+            out->flags       = it->flags;
+            return out->name.valid();
+        }
+        return true;
+    }
+
+
+    bool snapshot_view::find_page(uint32_t signableID, page_entry_t *out)
+    {
+        size_t count;
+        const snap_page_t *pages = (const snap_page_t *)section(SNAP_PAGES, sizeof(snap_page_t), &count);
+        if (CRUNCHY_UNLIKELY(pages == NULL)) {
+            return false;
+        }
+
+        const snap_page_t *it = std::lower_bound(pages, pages + count, signableID,
+                                                 [](const snap_page_t &p, uint32_t id) { return p.signableID < id; });
+        if (it == pages + count || it->signableID != signableID) {
+            return false;
+        }
+        if (out) {
+            out->signableID = it->signableID;
+            out->virtualUID = intern_string(it->virtualUID);
+            return out->virtualUID.valid();
+        }
+        return true;
+    }
+
+
+    snapshot_view &mapped()
+    {
+        static snapshot_view view;
+        return view;
+    }
+}
+}
@@ -0,0 +1,14 @@
+// TempVarData.cpp : Storage for the tmp_dt statics and the shared type_form and EFLAG_PAGE of CRH_TempVarData.h.
+//
+
+#include "../include/CRH_TempVarData.h"
+
+unsigned int  tmp_dt::tmp_path     = 0;
+unsigned long tmp_dt::max_tmp_size = 0;
+std::string   tmp_dt::tmp_reg_str;
+
+namespace crunchy
+{
+    type_form type_form_t;
+    EFLAG_PAGE EFLAG_PAGE_T;
+}
@@ -1,16 +1,568 @@
-// crunchylib.cpp : Defines the entry point for the console application.
+// crunchylib.cpp : Open-loop load generator and latency profiler for the registry, promise, signature and paging paths.
 //
+// Every worker follows a fixed arrival schedule and measures each operation from the time it
+// was due, not from when it got to run, so a stall shows up in the latencies instead of
+// silently lowering the offered rate (no coordinated omission).
+//
+// crunchylib --rate 200000 --duration 30 --mix register=30,deregister=30,promise=20,signature=10,paging=10
+//
+
+#if defined(_WIN32) | defined(WIN32)
+#   include "../stdafx.h"
+#endif
+#include <stdio.h>
+#include "../include/CRH_Histogram.h"
+#include "../include/CRH_Shard.h"
+#include "../include/CRH_Promise.h"
+#include "../include/CRH_Snapshot.h"
+#include "../include/CRH_MappedFile.h"
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
 
-#include "../stdafx.h"
-#include "../include/CRH_Declspec.h"
-#include <iostream>
-#include <fstream>
-using namespace crunchy::declarator;
+#if !(defined(_WIN32) | defined(WIN32))
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
 
-int main()
+using namespace crunchy;
+
+namespace
 {
-    init(0, true, 20);
-    system("PAUSE");
-    return 0;
+    typedef std::chrono::steady_clock load_clock;
+
+    enum load_op
+    {
+        OP_REGISTER = 0,
+        OP_DEREGISTER,
+        OP_PROMISE,
+        OP_SIGNATURE,
+        OP_PAGING,
+        OP_COUNT
+    };
+
+    const char *const op_names[OP_COUNT] = { "register", "deregister", "promise", "signature", "paging" };
+
+    /// \brief Outcome of one op
+    enum load_outcome
+    {
+        LOAD_HIT = 0,   /**< Done, or found what it looked for */
+        LOAD_MISS,      /**< Done, but the UID was not registered */
+        LOAD_ERROR      /**< Failed */
+    };
+
+    #   define  LOAD_NAMES       256        /**< Distinct component names registered */
+    #   define  LOAD_PROMISES    16         /**< Promise slots held by each worker */
+    #   define  LOAD_SIGN_BYTES  1024       /**< Bytes signed per signature op */
+    #   define  LOAD_PAGE_FILE   "crunchy_load.pages"
+    #   define  LOAD_PAGE_BYTES  (1UL << 20)
+    #   define  LOAD_SPIN_NS     100000     /**< Spin instead of sleeping when the next op is this close */
+
+
+    /**
+     * \brief Run settings, see usage().
+     */
+    typedef struct load_config
+    {
+        double   rate;
+        double   duration;
+        double   warmup;
+        unsigned threads;
+        unsigned shards;
+        uint64_t uidSpace;
+        uint64_t seed;
+        bool     poisson;
+        unsigned weights[OP_COUNT];
+        bool     markers;
+        const char *perfCtl;
+        const char *hgrm;
+    } load_config_t;
+
+
+    void usage()
+    {
+        printf("usage: crunchylib [options]\n"
+               "  --rate N          offered ops/s over all workers (100000)\n"
+               "  --duration S      measured seconds (10)\n"
+               "  --warmup S        unmeasured seconds before that (2)\n"
+               "  --threads N       workers, each takes rate/N (one per core)\n"
+               "  --mix LIST        op weights, e.g. register=40,deregister=20,promise=20,signature=10,paging=10\n"
+               "  --arrival KIND    poisson or uniform spacing (poisson)\n"
+               "  --seed N          schedule and op sequence seed (1)\n"
+               "  --uids N          UID space, half of it is registered up front (1000000)\n"
+               "  --shards N        registry shards (4)\n"
+               "  --markers         write phase markers to the ftrace trace_marker, see perf script\n"
+               "  --perf-ctl FIFO   send enable/disable to a perf record --control fifo around the measured phase\n"
+               "  --hgrm PREFIX     write PREFIX.<op>.hgrm percentile distributions\n");
+    }
+
+
+    bool parse_mix(const char *list, unsigned *weights)
+    {
+        for (int i = 0; i < OP_COUNT; ++i) {
+            weights[i] = 0;
+        }
+
+        std::string s(list);
+        size_t at = 0;
+        while (at < s.size()) {
+            size_t end = s.find(',', at);
+            if (end == std::string::npos) end = s.size();
+
+            std::string item = s.substr(at, end - at);
+            size_t eq = item.find('=');
+            int op = -1;
+            for (int i = 0; eq != std::string::npos && i < OP_COUNT; ++i) {
+                if (item.compare(0, eq, op_names[i]) == 0 && strlen(op_names[i]) == eq) {
+                    op = i;
+                }
+            }
+            if (op < 0) {
+                fprintf(stderr, "unknown op in mix: %s\n", item.c_str());
+                return false;
+            }
+            weights[op] = (unsigned)strtoul(item.c_str() + eq + 1, NULL, 10);
+            at = end + 1;
+        }
+
+        unsigned total = 0;
+        for (int i = 0; i < OP_COUNT; ++i) {
+            total += weights[i];
+        }
+        return total > 0;
+    }
+
+
+    bool parse_args(int argc, char **argv, load_config_t *cfg)
+    {
+        unsigned defaults[OP_COUNT] = { 40, 20, 20, 10, 10 };
+
+        cfg->rate     = 100000;
+        cfg->duration = 10;
+        cfg->warmup   = 2;
+        cfg->threads  = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 1;
+        cfg->shards   = 4;
+        cfg->uidSpace = 1000000;
+        cfg->seed     = 1;
+        cfg->poisson  = true;
+        cfg->markers  = false;
+        cfg->perfCtl  = NULL;
+        cfg->hgrm     = NULL;
+        memcpy(cfg->weights, defaults, sizeof(defaults));
+
+        for (int i = 1; i < argc; ++i) {
+            const char *a = argv[i];
+            const char *v = i + 1 < argc ? argv[i + 1] : NULL;
+
+            if (!strcmp(a, "--markers")) { cfg->markers = true; continue; }
+            if (!strcmp(a, "--help") || !strcmp(a, "-h") || v == NULL) {
+                return false;
+            }
+
+            ++i;
+            if      (!strcmp(a, "--rate"))     cfg->rate     = atof(v);
+            else if (!strcmp(a, "--duration")) cfg->duration = atof(v);
+            else if (!strcmp(a, "--warmup"))   cfg->warmup   = atof(v);
+            else if (!strcmp(a, "--threads"))  cfg->threads  = (unsigned)strtoul(v, NULL, 10);
+            else if (!strcmp(a, "--shards"))   cfg->shards   = (unsigned)strtoul(v, NULL, 10);
+            else if (!strcmp(a, "--uids"))     cfg->uidSpace = strtoull(v, NULL, 10);
+            else if (!strcmp(a, "--seed"))     cfg->seed     = strtoull(v, NULL, 10);
+            else if (!strcmp(a, "--arrival"))  cfg->poisson  = strcmp(v, "uniform") != 0;
+            else if (!strcmp(a, "--perf-ctl")) cfg->perfCtl  = v;
+            else if (!strcmp(a, "--hgrm"))     cfg->hgrm     = v;
+            else if (!strcmp(a, "--mix")) {
+                if (!parse_mix(v, cfg->weights)) return false;
+            }
+            else {
+                return false;
+            }
+        }
+
+        return cfg->rate > 0 && cfg->duration > 0 && cfg->warmup >= 0 &&
+               cfg->threads > 0 && cfg->shards > 0 && cfg->uidSpace > 1;
+    }
+
+
+    /**
+     * \brief Phase markers for perf.
+     *        trace_marker lines show up as ftrace:print in perf script, the control fifo lets
+     *        perf record -D -1 --control fifo:FIFO sample only the measured phase.
+     */
+    class perf_markers
+    {
+        public:
+            perf_markers() : traceFd(-1), ctlFd(-1) {}
+
+            ~perf_markers()
+            {
+#if !(defined(_WIN32) | defined(WIN32))
+                if (traceFd >= 0) close(traceFd);
+                if (ctlFd >= 0)   close(ctlFd);
+#endif
+            }
+
+            void open_sinks(bool markers, const char *ctl)
+            {
+#if !(defined(_WIN32) | defined(WIN32))
+                if (markers) {
+                    traceFd = open("/sys/kernel/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+                    if (traceFd < 0) {
+                        traceFd = open("/sys/kernel/debug/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+                    }
+                    if (traceFd < 0) {
+                        fprintf(stderr, "markers: no writable trace_marker, continuing without\n");
+                    }
+                }
+                if (ctl) {
+                    ctlFd = open(ctl, O_WRONLY | O_CLOEXEC);
+                    if (ctlFd < 0) {
+                        fprintf(stderr, "perf-ctl: cannot open %s, continuing without\n", ctl);
+                    }
+                }
+#else
+                if (markers || ctl) {
+                    fprintf(stderr, "perf markers are Linux only, continuing without\n");
+                }
+#endif
+            }
+
+            void mark(const char *phase)
+            {
+#if !(defined(_WIN32) | defined(WIN32))
+                if (traceFd >= 0) {
+                    char line[128];
+                    int n = snprintf(line, sizeof(line), "crunchy_load: %s\n", phase);
+                    ssize_t w = write(traceFd, line, (size_t)n);
+                    (void)w;
+                }
+#else
+                (void)phase;
+#endif
+            }
+
+            void sample(bool on)
+            {
+#if !(defined(_WIN32) | defined(WIN32))
+                if (ctlFd >= 0) {
+                    const char *cmd = on ? "enable\n" : "disable\n";
+                    ssize_t w = write(ctlFd, cmd, strlen(cmd));
+                    (void)w;
+                }
+#else
+                (void)on;
+#endif
+            }
+
+        private:
+            int traceFd;
+            int ctlFd;
+    };
+
+
+    /**
+     * \brief State the operations run against, shared by every worker.
+     */
+    struct load_target
+    {
+        shard::sharded_register registry;
+        std::vector<std::unique_ptr<shard::local_shard>> shards;
+        std::vector<intern::istring> names;
+        std::vector<unsigned char> payload;
+    };
+
+
+    /**
+     * \brief One worker, its schedule and its histograms.
+     */
+    struct load_worker
+    {
+        unsigned id;
+        std::mt19937_64 rng;
+        stats::histogram latency[OP_COUNT];
+        uint64_t errors[OP_COUNT];
+        uint64_t misses[OP_COUNT];
+        uint64_t late;                 /**< Ops that started more than LOAD_SPIN_NS after they were due */
+        uint32_t promises[LOAD_PROMISES];
+        uint64_t sink;                 /**< Keeps signature results alive */
+
+        load_worker() : id(0), late(0), sink(0)
+        {
+            memset(errors, 0, sizeof(errors));
+            memset(misses, 0, sizeof(misses));
+            for (int i = 0; i < LOAD_PROMISES; ++i) {
+                promises[i] = PROMISE_NO_SLOT;
+            }
+        }
+    };
+
+
+    /// \brief Runs one op
+    load_outcome run_op(load_op op, load_worker &w, load_target &t, const load_config_t &cfg)
+    {
+        uint64_t uid = 1 + w.rng() % cfg.uidSpace;
+
+        switch (op) {
+            case OP_REGISTER:
+            {
+                snapshot::register_entry_t e;
+                e.uid         = uid;
+                e.name        = t.names[uid % t.names.size()];
+                e.promise_key = (uint32_t)uid;
+                e.flags       = 0;
+                return t.registry.insert(e) ? LOAD_ERROR : LOAD_HIT;
+            }
+
+            case OP_DEREGISTER:
+                return t.registry.erase(uid) ? LOAD_HIT : LOAD_MISS;
+
+            case OP_PROMISE:
+            {
+                uint32_t &slot = w.promises[uid % LOAD_PROMISES];
+                slot = promise::engine().promise(slot, (uint32_t)uid, (uid & 7) == 0, 1);
+                promise::engine().beat(slot);
+                return slot != PROMISE_NO_SLOT ? LOAD_HIT : LOAD_ERROR;
+            }
+
+            case OP_SIGNATURE:
+            {
+                size_t at = (size_t)(uid % (t.payload.size() - LOAD_SIGN_BYTES));
+                w.sink += snapshot::crc32(&t.payload[at], LOAD_SIGN_BYTES);
+                return LOAD_HIT;
+            }
+
+            case OP_PAGING:
+            {
+                paging::mapped_file_t mf = paging::map_file(LOAD_PAGE_FILE, false);
+                bool ok = mf.data != NULL;
+                if (ok) {
+                    w.sink += mf.data[(size_t)(uid % mf.size)];
+                }
+                paging::unmap_file(mf);
+                return ok ? LOAD_HIT : LOAD_ERROR;
+            }
+
+            default:
+                return LOAD_ERROR;
+        }
+    }
+
+
+    /// \brief Waits for a due time, sleeping until close to it and spinning the rest
+    void wait_until(load_clock::time_point due)
+    {
+        for (;;) {
+            load_clock::time_point now = load_clock::now();
+            if (now >= due) {
+                return;
+            }
+            if (due - now > std::chrono::nanoseconds(2 * LOAD_SPIN_NS)) {
+                std::this_thread::sleep_for(due - now - std::chrono::nanoseconds(LOAD_SPIN_NS));
+            }
+            else {
+                std::this_thread::yield(); // Let other workers run when there are fewer cores than workers
+            }
+        }
+    }
+
+
+    void run_worker(load_worker &w, load_target &t, const load_config_t &cfg,
+                    load_clock::time_point start, load_clock::time_point measure, load_clock::time_point end)
+    {
+        unsigned total = 0;
+        for (int i = 0; i < OP_COUNT; ++i) {
+            total += cfg.weights[i];
+        }
+
+        double interval = 1e9 * cfg.threads / cfg.rate;
+        std::exponential_distribution<double> gap(1.0);
+
+        // Stagger the workers so their schedules do not line up
+        double offset = interval * w.id / cfg.threads;
+        load_clock::time_point due = start + std::chrono::nanoseconds((int64_t)offset);
+
+        while (due < end) {
+            unsigned pick = (unsigned)(w.rng() % total);
+            int op = 0;
+            while (pick >= cfg.weights[op]) {
+                pick -= cfg.weights[op++];
+            }
+
+            wait_until(due);
+            load_clock::time_point began = load_clock::now();
+            load_outcome got = run_op((load_op)op, w, t, cfg);
+            load_clock::time_point done = load_clock::now();
+
+            if (due >= measure) {
+                w.latency[op].record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(done - due).count());
+                if (got == LOAD_ERROR) ++w.errors[op];
+                if (got == LOAD_MISS)  ++w.misses[op];
+                if (began - due > std::chrono::nanoseconds(LOAD_SPIN_NS)) ++w.late;
+            }
+
+            double next = cfg.poisson ? gap(w.rng) * interval : interval;
+            due += std::chrono::nanoseconds((int64_t)(next + 0.5));
+        }
+    }
+
+
+    bool prepare(load_target &t, const load_config_t &cfg)
+    {
+        std::mt19937_64 rng(cfg.seed);
+
+        for (int i = 0; i < LOAD_NAMES; ++i) {
+            char name[32];
+            snprintf(name, sizeof(name), "component-%d", i);
+            t.names.push_back(intern::istring(name));
+            if (!t.names.back().valid()) {
+                fprintf(stderr, "cannot intern %s\n", name);
+                return false;
+            }
+        }
+
+        t.payload.resize(64 * 1024);
+        for (size_t i = 0; i < t.payload.size(); ++i) {
+            t.payload[i] = (unsigned char)rng();
+        }
+
+        // Size each shard filter for its part of the UID space with headroom
+        for (unsigned s = 0; s < cfg.shards; ++s) {
+            t.shards.push_back(std::unique_ptr<shard::local_shard>(
+                new shard::local_shard((size_t)(cfg.uidSpace / cfg.shards + cfg.uidSpace / (4 * cfg.shards) + 1))));
+            t.registry.add_shard(t.shards.back().get());
+        }
+
+        // Half the UID space starts registered, so deregisters hit as often as they miss
+        for (uint64_t uid = 2; uid <= cfg.uidSpace; uid += 2) {
+            snapshot::register_entry_t e;
+            e.uid         = uid;
+            e.name        = t.names[uid % t.names.size()];
+            e.promise_key = (uint32_t)uid;
+            e.flags       = 0;
+            t.registry.insert(e);
+        }
+
+        FILE *fp = fopen(LOAD_PAGE_FILE, "wb");
+        if (fp == NULL) {
+            fprintf(stderr, "cannot create %s\n", LOAD_PAGE_FILE);
+            return false;
+        }
+        std::vector<unsigned char> page(4096);
+        for (size_t off = 0; off < LOAD_PAGE_BYTES; off += page.size()) {
+            page[0] = (unsigned char)off;
+            fwrite(&page[0], 1, page.size(), fp);
+        }
+        fclose(fp);
+        return true;
+    }
+
+
+    void report(const std::vector<std::unique_ptr<load_worker>> &workers, const load_config_t &cfg)
+    {
+        stats::histogram all;
+        uint64_t late = 0;
+
+        printf("\n%-11s %10s %10s %10s %10s %10s %10s %8s %8s\n",
+               "op", "count", "rate/s", "p50 us", "p99 us", "p999 us", "max us", "misses", "errors");
+
+        for (int op = 0; op < OP_COUNT; ++op) {
+            stats::histogram h;
+            uint64_t errors = 0, misses = 0;
+            for (size_t i = 0; i < workers.size(); ++i) {
+                h.merge(workers[i]->latency[op]);
+                errors += workers[i]->errors[op];
+                misses += workers[i]->misses[op];
+            }
+            all.merge(h);
+
+            if (h.count() == 0) {
+                continue;
+            }
+
+            printf("%-11s %10llu %10.0f %10.2f %10.2f %10.2f %10.2f %8llu %8llu\n", op_names[op],
+                   (unsigned long long)h.count(), h.count() / cfg.duration,
+                   h.percentile(50.0) / 1e3, h.percentile(99.0) / 1e3, h.percentile(99.9) / 1e3,
+                   h.max() / 1e3, (unsigned long long)misses, (unsigned long long)errors);
+
+            if (cfg.hgrm) {
+                std::string path = std::string(cfg.hgrm) + "." + op_names[op] + ".hgrm";
+                FILE *fp = fopen(path.c_str(), "w");
+                if (fp) {
+                    h.write_hgrm(fp, 1000.0);
+                    fclose(fp);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < workers.size(); ++i) {
+            late += workers[i]->late;
+        }
+
+        printf("%-11s %10llu %10.0f %10.2f %10.2f %10.2f %10.2f\n", "all",
+               (unsigned long long)all.count(), all.count() / cfg.duration,
+               all.percentile(50.0) / 1e3, all.percentile(99.0) / 1e3, all.percentile(99.9) / 1e3, all.max() / 1e3);
+        printf("\noffered %.0f ops/s, %llu ops (%.2f%%) started late, latencies include that wait\n",
+               cfg.rate, (unsigned long long)late, all.count() ? 100.0 * late / all.count() : 0.0);
+    }
 }
 
+
+int main(int argc, char **argv)
+{
+    load_config_t cfg;
+    if (!parse_args(argc, argv, &cfg)) {
+        usage();
+        return 1;
+    }
+
+    load_target target;
+    if (!prepare(target, cfg)) {
+        return 1;
+    }
+
+    perf_markers markers;
+    markers.open_sinks(cfg.markers, cfg.perfCtl);
+
+    std::vector<std::unique_ptr<load_worker>> workers;
+    for (unsigned i = 0; i < cfg.threads; ++i) {
+        workers.push_back(std::unique_ptr<load_worker>(new load_worker()));
+        workers.back()->id = i;
+        workers.back()->rng.seed(cfg.seed * 0x9E3779B97F4A7C15ULL + i);
+    }
+
+    printf("%u workers, %.0f ops/s %s, %.1fs warmup + %.1fs measured, %llu UIDs over %u shards\n",
+           cfg.threads, cfg.rate, cfg.poisson ? "poisson" : "uniform", cfg.warmup, cfg.duration,
+           (unsigned long long)cfg.uidSpace, cfg.shards);
+
+    load_clock::time_point start   = load_clock::now() + std::chrono::milliseconds(50);
+    load_clock::time_point measure = start + std::chrono::nanoseconds((int64_t)(cfg.warmup * 1e9));
+    load_clock::time_point end     = measure + std::chrono::nanoseconds((int64_t)(cfg.duration * 1e9));
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < cfg.threads; ++i) {
+        threads.push_back(std::thread(run_worker, std::ref(*workers[i]), std::ref(target), std::cref(cfg),
+                                      start, measure, end));
+    }
+
+    std::this_thread::sleep_until(start);
+    markers.mark("warmup begin");
+    std::this_thread::sleep_until(measure);
+    markers.mark("measure begin");
+    markers.sample(true);
+    std::this_thread::sleep_until(end);
+    markers.sample(false);
+    markers.mark("measure end");
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+
+    report(workers, cfg);
+    remove(LOAD_PAGE_FILE);
+    return 0;
+}
@@ -0,0 +1,379 @@
+/**
+* \file CRH_Async.h
+* \brief Async entry points, executors and the I/O reactor
+* \details Awaitable wrappers around the blocking Register and Signatures calls.
+*          The blocking call runs on a pluggable executor and its completion is posted back to the
+*          caller's executor, usually a reactor, so one event loop thread can keep many calls in flight.
+* \author Corbin Matschull
+* \version 1
+* \date Oct 19. 2026
+* \pre Make sure you have GNU GCC or LLVM to compile, BSD won't compile.
+* \pre co_await needs C++20 coroutines, see #CRUNCHY_HAS_COROUTINES. Older compilers use async_op::then
+* \throws Rethrows whatever the wrapped call threw, on resume
+*/
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "CRH_Exception.h"
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#   if __has_include(<coroutine>)
+#       include <coroutine>
+#       define  CRUNCHY_HAS_COROUTINES 1
+#   endif
+#endif
+#ifndef CRUNCHY_HAS_COROUTINES
+#   define  CRUNCHY_HAS_COROUTINES 0
+#endif
+
+namespace crunchy
+{
+    /// \brief Async entry points, executors and the I/O reactor
+    namespace async
+    {
+        // ===============================
+        // -------------------------------
+        //      WATCH EVENTS
+        #   define  ASYNC_READABLE 0x01 /**< fd can be read without blocking */
+        #   define  ASYNC_WRITABLE 0x02 /**< fd can be written without blocking */
+        #   define  ASYNC_HANGUP   0x04 /**< Peer closed or the fd failed, set on completion only */
+
+
+        /// \brief Unit of work handed to an executor
+        typedef void (*task_fn)(void *arg);
+
+
+        /**
+         * \brief Runs posted tasks. Implementations decide on which thread.
+         */
+        class executor
+        {
+            public:
+                virtual ~executor() {}
+
+                /**
+                 * \brief Runs fn(arg) later. Must be safe to call from any thread.
+                 *
+                 * \param fn - Task
+                 * \param arg - Passed to fn, not owned
+                 */
+                virtual void post(task_fn fn, void *arg) = 0;
+        };
+
+
+        /**
+         * \brief Runs every task straight away on the posting thread.
+         */
+        class inline_executor : public executor
+        {
+            public:
+                void post(task_fn fn, void *arg) { fn(arg); }
+        };
+
+
+        /**
+         * \brief Fixed set of worker threads sharing one FIFO queue, for blocking calls.
+         */
+        class thread_pool : public executor
+        {
+            public:
+                /// \param threads - Worker count, 0 for one per core
+                explicit thread_pool(unsigned threads = 0);
+                ~thread_pool();
+
+                void post(task_fn fn, void *arg);
+
+                /// \brief Runs what is queued, then joins the workers. Later posts run inline.
+                void stop();
+
+                size_t size() const { return workers.size(); }
+
+            private:
+                typedef struct job
+                {
+                    task_fn fn;
+                    void *arg;
+                } job_t;
+
+                void work();
+
+                std::deque<job_t> jobs;
+                std::vector<std::thread> workers;
+                std::mutex lock;
+                std::condition_variable wake;
+                bool stopping;
+        };
+
+
+        /**
+         * \brief fd readiness request, see reactor::watch().
+         *        Owned by the caller and must stay put until fn has run.
+         *
+         * \param fn - Called on the reactor thread once the fd is ready
+         * \param arg - Passed to fn
+         * \param events - ASYNC_* events that were ready, set before fn is called
+         */
+        typedef struct fd_waiter
+        {
+            task_fn fn;
+            void *arg;
+            uint32_t events;
+        } fd_waiter_t;
+
+
+        /**
+         * \brief Event loop, epoll on Linux.
+         *        Posted tasks and fd readiness both complete on the thread calling run().
+         *        Posts from other threads are batched, the loop is woken at most once per batch.
+         */
+        class reactor : public executor
+        {
+            public:
+                reactor();
+                ~reactor();
+
+                /// \brief Error from creating the loop, io_errc::cannot_bind_socket if it could not be created
+                std::error_code status() const noexcept { return state; }
+
+                void post(task_fn fn, void *arg);
+
+                /**
+                 * \brief Calls w->fn once fd is ready for any of events, one shot.
+                 *
+                 * \param fd - Non-blocking fd
+                 * \param events - ASYNC_READABLE and/or ASYNC_WRITABLE
+                 * \param w - Completion, see fd_waiter_t
+                 *
+                 * \return std::errc::not_supported where there is no fd polling (Windows)
+                 */
+                std::error_code watch(int fd, uint32_t events, fd_waiter_t *w);
+
+                /// \brief Drops fd from the loop, call before closing a watched fd
+                void unwatch(int fd);
+
+                /**
+                 * \brief Runs ready tasks and fd completions, waiting up to timeoutMs for one.
+                 *
+                 * \param timeoutMs - Max wait, -1 for no limit
+                 *
+                 * \return Number of tasks and completions run
+                 */
+                size_t run_once(int timeoutMs = -1);
+
+                /// \brief Runs until stop()
+                void run();
+
+                /// \brief Makes run() return, safe from any thread
+                void stop();
+
+#if CRUNCHY_HAS_COROUTINES
+                /// \brief co_await reactor.readable(fd), resumes on the loop with the ready events
+                struct fd_wait
+                {
+                    reactor *loop;
+                    int fd;
+                    uint32_t events;
+                    fd_waiter_t waiter;
+                    std::error_code error;
+
+                    bool await_ready() const noexcept { return false; }
+
+                    bool await_suspend(std::coroutine_handle<> h)
+                    {
+                        waiter.fn  = &fd_wait::resume;
+                        waiter.arg = h.address();
+                        error = loop->watch(fd, events, &waiter);
+                        return !error;
+                    }
+
+                    /// \return Error from watch(), ASYNC_* events are in waiter.events
+                    std::error_code await_resume() const noexcept { return error; }
+
+                    static void resume(void *h) { std::coroutine_handle<>::from_address(h).resume(); }
+                };
+
+                fd_wait readable(int fd) { fd_wait w = { this, fd, ASYNC_READABLE, {}, {} }; return w; }
+                fd_wait writable(int fd) { fd_wait w = { this, fd, ASYNC_WRITABLE, {}, {} }; return w; }
+#endif
+
+            private:
+                typedef struct job
+                {
+                    task_fn fn;
+                    void *arg;
+                } job_t;
+
+                size_t drain();
+
+                std::vector<job_t> posted;   /**< Filled by post() */
+                std::vector<job_t> running;  /**< Swapped with posted by the loop, reused */
+                std::mutex lock;
+                std::atomic<bool> stopped;
+                std::error_code state;
+
+                intptr_t poller;
+                intptr_t waker;
+#if defined(_WIN32) | defined(WIN32)
+                std::condition_variable wake;
+#endif
+        };
+
+
+        /**
+         * \brief Executor the blocking Register and Signatures calls run on.
+         *        A process wide thread_pool unless set_blocking_pool() replaced it.
+         */
+        executor &blocking_pool();
+
+        /// \brief Replaces the blocking call executor, NULL restores the default. pool is not owned
+        void set_blocking_pool(executor *pool);
+
+
+        namespace detail
+        {
+            template<class T>
+            struct op_value
+            {
+                T value;
+
+                void run(std::function<T()> &work) { value = work(); }
+                T take() { return std::move(value); }
+            };
+
+            template<>
+            struct op_value<void>
+            {
+                void run(std::function<void()> &work) { work(); }
+                void take() {}
+            };
+        }
+
+
+        /**
+         * \brief One blocking call in flight.
+         *        The call runs on blocking_pool() and completes on the resume executor.
+         *        Awaiting it allocates nothing beyond the bound call, then() allocates its callback.
+         *
+         * \param T - Result of the call
+         */
+        template<class T>
+        class async_op
+        {
+            public:
+                typedef std::function<T()> work_t;
+
+                /**
+                 * \param resumeOn - Executor the completion runs on
+                 * \param call - Blocking call
+                 */
+                async_op(executor &resumeOn, work_t call)
+                    : resume(&resumeOn), work(std::move(call)), done(NULL), doneArg(NULL) {}
+
+                async_op(async_op &&) = default;
+
+                /**
+                 * \brief Starts the call, runs callback(op) on the resume executor when it is done.
+                 *        Call op.get() inside the callback for the result.
+                 */
+                template<class F>
+                void then(F callback)
+                {
+                    struct pending
+                    {
+                        async_op op;
+                        F callback;
+
+                        static void finish(void *p)
+                        {
+                            pending *self = (pending *)p;
+                            self->callback(self->op);
+                            delete self;
+                        }
+                    };
+
+                    pending *p = new pending{ std::move(*this), std::move(callback) };
+                    p->op.start(&pending::finish, p);
+                }
+
+                /// \brief Result of a finished call, rethrows if the call threw
+                T get()
+                {
+                    if (CRUNCHY_UNLIKELY(error)) {
+                        std::rethrow_exception(error);
+                    }
+                    return result.take();
+                }
+
+#if CRUNCHY_HAS_COROUTINES
+                bool await_ready() const noexcept { return false; }
+
+                void await_suspend(std::coroutine_handle<> h) { start(&async_op::resume_handle, h.address()); }
+
+                T await_resume() { return get(); }
+#endif
+
+            private:
+                void start(task_fn fn, void *arg)
+                {
+                    done    = fn;
+                    doneArg = arg;
+                    blocking_pool().post(&async_op::run, this);
+                }
+
+                static void run(void *p)
+                {
+                    async_op *self = (async_op *)p;
+                    try {
+                        self->result.run(self->work);
+                    }
+                    catch (...) {
+                        self->error = std::current_exception();
+                    }
+
+                    // self may be gone as soon as the completion runs
+                    self->resume->post(self->done, self->doneArg);
+                }
+
+#if CRUNCHY_HAS_COROUTINES
+                static void resume_handle(void *h) { std::coroutine_handle<>::from_address(h).resume(); }
+#endif
+
+                executor *resume;
+                work_t work;
+                task_fn done;
+                void *doneArg;
+                detail::op_value<T> result;
+                std::exception_ptr error;
+        };
+
+
+#if CRUNCHY_HAS_COROUTINES
+        /**
+         * \brief Fire and forget coroutine, for spawning registry work on a reactor:
+         *        async::detached job() { BOOL ok = co_await reg.register_component_async(loop, ...); }
+         *        An exception escaping the coroutine terminates.
+         */
+        struct detached
+        {
+            struct promise_type
+            {
+                detached get_return_object() noexcept { return detached(); }
+                std::suspend_never initial_suspend() noexcept { return {}; }
+                std::suspend_never final_suspend() noexcept { return {}; }
+                void return_void() noexcept {}
+                void unhandled_exception() noexcept { std::terminate(); }
+            };
+        };
+#endif
+    }
+}
@@ -0,0 +1,166 @@
+/**
+* \file CRH_EnvProfile.h
+* \brief Environment size profiles
+* \details Compile-time key, PRUID and box widths for each UNIX_Portable::ENV_DATA environment size.
+* \author Corbin Matschull
+* \version 1
+* \date Oct 19. 2026
+* \pre Make sure you have GNU GCC or LLVM to compile, BSD won't compile.
+*/
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+namespace crunchy
+{
+    /// \brief UNIX/Linux portable code, see CRH_Portability.h
+    namespace UNIX_Portable
+    {
+        /**
+         * \brief This holds environment sizes
+         *
+         * \param env64_t - Large environment size
+         * \param env32_t - Default environment size
+         * \param env16_t - Small environment size, use this in cases of being in a bootloader or other low-level process
+         */
+        typedef struct ENV_DATA
+        {
+            typedef long long   env64_t;
+            typedef long        env32_t;
+            typedef short       env16_t;
+        } ENV_DATA_T, *PENV_DATA_T;
+    }
+
+
+    /**
+     * \brief Environment profile to build Signatures, Register and the key containers for.
+     *        Must be one of the UNIX_Portable::ENV_DATA typedefs:
+     *        env16_t (bootloader), env32_t (default) or env64_t (server).
+     *        Define it before including any crunchy header to switch profiles.
+     */
+#if !defined(CRUNCHY_ENV_PROFILE)
+#   define  CRUNCHY_ENV_PROFILE crunchy::UNIX_Portable::ENV_DATA::env32_t
+#endif
+
+
+    /// \brief Index of a profile in env_table
+    enum env_size
+    {
+        ENV_SIZE_16 = 0,
+        ENV_SIZE_32,
+        ENV_SIZE_64
+    };
+
+
+    /**
+     * \brief Widths of one environment profile.
+     *
+     * \param key_bits - Width of a content/promise key
+     * \param pruid_bits - Width of a PRUID (Pseudo. Random. User. ID)
+     * \param box_bits - Width of a content box slot
+     * \param box_size - Number of slots in a content box
+     */
+    struct env_widths
+    {
+        unsigned key_bits;
+        unsigned pruid_bits;
+        unsigned box_bits;
+        unsigned box_size;
+    };
+
+
+    /// \brief Width table, indexed by env_size
+    static constexpr env_widths env_table[] =
+    {
+        { 16, 16, 16,   8 }, /**< env16_t, bootloader */
+        { 32, 32, 64,  64 }, /**< env32_t, matches the original CONTENT_KEYS layout */
+        { 64, 64, 64, 256 }  /**< env64_t, server */
+    };
+
+
+    /// \brief Unsigned integer type of exactly Bits bits
+    template<unsigned Bits> struct env_uint;
+    template<> struct env_uint<16> { typedef uint16_t type; };
+    template<> struct env_uint<32> { typedef uint32_t type; };
+    template<> struct env_uint<64> { typedef uint64_t type; };
+
+
+    /**
+     * \brief Profile built from one env_table row.
+     *        Everything here is a type or a constant, nothing is checked at runtime.
+     */
+    template<env_size S>
+    struct env_profile_base
+    {
+        static constexpr env_size size       = S;
+        static constexpr unsigned key_bits   = env_table[S].key_bits;
+        static constexpr unsigned pruid_bits = env_table[S].pruid_bits;
+        static constexpr unsigned box_bits   = env_table[S].box_bits;
+        static constexpr unsigned box_size   = env_table[S].box_size;
+
+        typedef typename env_uint<env_table[S].key_bits>::type   key_t;
+        typedef typename env_uint<env_table[S].pruid_bits>::type pruid_t;
+        typedef typename env_uint<env_table[S].box_bits>::type   box_t;
+
+        /// \brief Number of key_t words needed to hold a Bits wide key
+        static constexpr unsigned key_words(unsigned bits) { return (bits + key_bits - 1) / key_bits; }
+    };
+
+    // C++14 still needs a definition for a static constexpr member that is odr-used
+    template<env_size S> constexpr env_size env_profile_base<S>::size;
+    template<env_size S> constexpr unsigned env_profile_base<S>::key_bits;
+    template<env_size S> constexpr unsigned env_profile_base<S>::pruid_bits;
+    template<env_size S> constexpr unsigned env_profile_base<S>::box_bits;
+    template<env_size S> constexpr unsigned env_profile_base<S>::box_size;
+
+
+    /**
+     * \brief Maps an ENV_DATA typedef onto its profile.
+     *
+     * \param EnvT - ENV_DATA::env16_t, env32_t or env64_t
+     */
+    template<class EnvT> struct env_profile;
+    template<> struct env_profile<UNIX_Portable::ENV_DATA::env16_t> : env_profile_base<ENV_SIZE_16> {};
+    template<> struct env_profile<UNIX_Portable::ENV_DATA::env32_t> : env_profile_base<ENV_SIZE_32> {};
+    template<> struct env_profile<UNIX_Portable::ENV_DATA::env64_t> : env_profile_base<ENV_SIZE_64> {};
+
+    /// \brief Profile selected by #CRUNCHY_ENV_PROFILE
+    typedef env_profile<CRUNCHY_ENV_PROFILE> default_env;
+
+
+    /**
+     * \brief Content keys for keeping content strings in handy containers, sized by the profile.
+     *
+     * \param CONTENT_VOID - Sends key dump to the content trunk incase of void instances happening.
+     * \param KEY_PRNG - PRNG for the key dump
+     * \param PROMISE_KEY - Generates a promise key, use with Register::register_component()
+     * \param content_box - Key trunk
+     */
+    template<class Env>
+    struct basic_content_keys
+    {
+        typename Env::key_t CONTENT_VOID;
+        typename Env::key_t KEY_PRNG;
+
+        typename Env::key_t PROMISE_KEY;
+
+        // Keeps keys in storage box
+        typename Env::box_t content_box[Env::box_size];
+    };
+
+
+    /**
+     * \brief PRP (Public Return Prototypes) keys, each stored as whole profile key words.
+     *
+     * \param prp128  - portable rotation property 128-bit
+     * \param prp512  - portable rotation property 512-bit
+     * \param prp1024 - portable rotation property 1024-bit
+     */
+    template<class Env>
+    struct basic_prp_keys
+    {
+        typename Env::key_t prp128[Env::key_words(128)];
+        typename Env::key_t prp512[Env::key_words(512)];
+        typename Env::key_t prp1024[Env::key_words(1024)];
+    };
+}
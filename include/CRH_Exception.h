@@ -3,12 +3,32 @@
 * \brief Exceptions and errors
 * \details Contains prototypes and classes for errors and exceptions.
 * \author Corbin Matschull
-* \version 2
-* \date Sep 2. 2015
+* \version 3
+* \date Oct 19. 2026
 * \pre Make sure you have GNU GCC or LLVM to compile, BSD or VCC won't compile.
 * \throws UNDEFINED_ERROR_EXCEPTION
+*
+* \par Error policy
+* Hot I/O and registry calls never throw. They return an io_result<T> (or a std::error_code)
+* and mark the error branch with #CRUNCHY_UNLIKELY, so the happy path carries no exception setup.
+* Only API boundaries that promise to throw turn an error into an IOException, through
+* IOexception::raise(), which is kept out of line. IOException never allocates: messages are
+* static strings and the last error is kept per thread.
 */
+#pragma once
+#include <exception>
 #include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#if defined(__GNUC__) | defined(__clang__)
+#   define  CRUNCHY_UNLIKELY(x) __builtin_expect(!!(x), 0) /**< Error branch hint, see the error policy */
+#   define  CRUNCHY_COLD __attribute__((cold, noinline))   /**< Keep error paths out of the hot code */
+#else
+#   define  CRUNCHY_UNLIKELY(x) (x)
+#   define  CRUNCHY_COLD __declspec(noinline)
+#endif
 
 /// \brief Main Crunchy Namespace
 namespace crunchy
@@ -19,24 +39,139 @@ namespace crunchy
         /// \brief Default UID generated for all exceptions
         #   define  EXCEPTION_DEFAULT_UID 1UL
 
-        long error_code;            /**< Main error code param */
-        std::string exception_name; /**< Main exception text */
+        /**
+         * \brief IO and registry error codes, the value doubles as the documentation error id.
+         */
+        enum class io_errc
+        {
+            ok = 0,
+            cannot_open = 0x100,   /**< File could not be opened */
+            cannot_map,            /**< File could not be mapped */
+            cannot_bind_socket,    /**< Report socket could not be created */
+            short_write,           /**< Not everything could be written */
+            out_of_range,          /**< Slot, handle or offset out of range */
+            not_registered,        /**< Component is not registered */
+            still_active,          /**< Component is still active */
+            bad_format             /**< Data on disk is malformed or of the wrong version */
+        };
+
+
+        /// \brief Error category for io_errc
+        const std::error_category &io_category() noexcept;
+
+        /// \brief Lets io_errc convert to std::error_code
+        inline std::error_code make_error_code(io_errc e) noexcept
+        {
+            return std::error_code((int)e, io_category());
+        }
+
+
+        /**
+         * \brief Expected-style result for the fast path, holds either a value or an error code.
+         *
+         * \param T - Value type, must be default constructible
+         */
+        template<class T>
+        class io_result
+        {
+            public:
+                io_result(const T &value) : val(value) {}
+                io_result(T &&value) : val(std::move(value)) {}
+                io_result(io_errc e) : val(), err(make_error_code(e)) {}
+                io_result(std::error_code e) : val(), err(e) {}
+
+                bool ok() const noexcept { return !err; }
+                explicit operator bool() const noexcept { return !err; }
+
+                const std::error_code &error() const noexcept { return err; }
+
+                T &value() noexcept { return val; }
+                const T &value() const noexcept { return val; }
+                T &operator*() noexcept { return val; }
+                const T &operator*() const noexcept { return val; }
+
+                /// \brief Value, or fallback if this holds an error
+                T value_or(const T &fallback) const { return err ? fallback : val; }
+
+            private:
+                T val;
+                std::error_code err;
+        };
+
 
         /// \brief Main class to contain IO exceptions
-        class IOException
+        class IOException : public std::exception
         {
             public:
                 /**
                  * \brief IOException constructor
                  *
-                 * \param exception - Name of error to display to user
+                 * \param exception - Name of error to display to user, must be a static string
                  * \param error_id - Generate an error id to direct users to documentation
                  */
-                IOException(std::string exception, long error_id)
+                IOException(const char *exception, long error_id) noexcept
+                    : exception_name(exception), error_code(error_id)
                 {
-                    exception = exception_name;
-                    error_id  = error_code;
                 }
+
+                const char *what() const noexcept { return exception_name; }
+                long code() const noexcept { return error_code; }
+
+            private:
+                const char *exception_name; /**< Main exception text */
+                long error_code;            /**< Main error code param */
+        };
+
+
+        /**
+         * \brief Last error raised on this thread.
+         *
+         * \param exception_name - Static text of the error
+         * \param error_code - Error id
+         */
+        typedef struct io_error_state
+        {
+            const char *exception_name;
+            long error_code;
+        } io_error_state_t;
+
+
+        /// \brief Last error raised on the calling thread, replaces the old namespace globals
+        inline io_error_state_t &last_error() noexcept
+        {
+            static thread_local io_error_state_t state = { "", 0 };
+            return state;
         }
+
+        /**
+         * \brief Static text for an io_errc, never allocates.
+         */
+        const char *describe(io_errc e) noexcept;
+
+        /**
+         * \brief Records an error for this thread without throwing.
+         *
+         * \param e - Error code
+         *
+         * \return e, so it can be returned straight away
+         */
+        inline io_errc set_error(io_errc e) noexcept
+        {
+            io_error_state_t &st = last_error();
+            st.exception_name = describe(e);
+            st.error_code     = (long)e;
+            return e;
+        }
+
+        /**
+         * \brief Records and throws an error, the only place in the library that throws IOException.
+         */
+        CRUNCHY_COLD void raise(io_errc e);
     }
 }
+
+namespace std
+{
+    template<>
+    struct is_error_code_enum<crunchy::IOexception::io_errc> : true_type {};
+}
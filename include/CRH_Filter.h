@@ -0,0 +1,213 @@
+/**
+* \file CRH_Filter.h
+* \brief UID membership filters
+* \details Approximate UID sets kept next to a registry table, so a lookup for an absent UID
+*          is answered without touching the table. A cuckoo filter does the work, a Bloom
+*          filter takes whatever no longer fits in it.
+* \author Corbin Matschull
+* \version 1
+* \date Oct 19. 2026
+* \pre Make sure you have GNU GCC or LLVM to compile, BSD won't compile.
+*/
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include "CRH_Exception.h"
+#include "CRH_Hash.h"
+
+namespace crunchy
+{
+    /// \brief UID membership filters
+    namespace filter
+    {
+        #   define  FILTER_DEFAULT_CAPACITY (1UL << 20) /**< Default number of UIDs a filter is sized for */
+        #   define  FILTER_DEFAULT_FPR      0.001       /**< Default false positive rate */
+        #   define  FILTER_MAX_KICKS        500         /**< Cuckoo relocations tried before an insert gives up */
+
+
+        /// \brief Mixes a UID into the hash every filter indexes by, seeded apart from shard::shard_hash
+        inline uint64_t filter_hash(uint64_t key)
+        {
+            return hash::hash64(key, HASH_SEED_FILTER);
+        }
+
+
+        /**
+         * \brief Blocked Bloom filter, every key sets its bits inside one 64 byte block.
+         *        Lock-free, keys cannot be removed.
+         */
+        class bloom_filter
+        {
+            public:
+                /**
+                 * \param expected - Number of keys the filter is sized for
+                 * \param fpr - False positive rate at expected keys
+                 */
+                bloom_filter(size_t expected, double fpr = FILTER_DEFAULT_FPR);
+
+                void insert(uint64_t key);
+
+                /// \brief FALSE if key was never inserted
+                bool maybe_contains(uint64_t key) const;
+
+                void clear();
+
+                size_t size_bytes() const { return words.size() * sizeof(uint64_t); }
+
+            private:
+                std::vector<std::atomic<uint64_t>> words;
+                uint64_t blockMask;
+                uint32_t hashes;
+        };
+
+
+        /**
+         * \brief Cuckoo filter with one 64 bit word per bucket.
+         *        The false positive rate decides how many fingerprints share a bucket:
+         *        2 x 32 bit down to 8 x 8 bit, the smallest that meets the rate is used.
+         *        Lookups are lock-free, two loads and a SWAR compare. Inserts and erases are
+         *        serialized. Relocations move each fingerprint into its new bucket before clearing
+         *        the old one, and lookups that race a relocation retry, so they never miss a key.
+         */
+        class cuckoo_filter
+        {
+            public:
+                /**
+                 * \param capacity - Number of keys the filter is sized for
+                 * \param fpr - Target false positive rate
+                 */
+                cuckoo_filter(size_t capacity, double fpr = FILTER_DEFAULT_FPR);
+
+                /**
+                 * \brief Adds a key, insert each key once.
+                 *
+                 * \return FALSE if the filter is too full, nothing was changed
+                 */
+                bool insert(uint64_t key);
+
+                /**
+                 * \brief Removes a key, only pass keys that were inserted.
+                 *
+                 * \return FALSE if no fingerprint of key was found
+                 */
+                bool erase(uint64_t key);
+
+                /// \brief FALSE if key is not in the filter
+                inline bool maybe_contains(uint64_t key) const
+                {
+                    uint64_t h       = filter_hash(key);
+                    uint64_t fp      = fingerprint(h);
+                    uint64_t i1      = h & bucketMask;
+                    uint64_t i2      = alternate(i1, fp);
+                    uint64_t pattern = fp * ones;
+
+                    for (;;) {
+                        uint64_t v = version.load(std::memory_order_acquire);
+                        if (has_zero_lane(buckets[i1].load(std::memory_order_relaxed) ^ pattern) ||
+                            has_zero_lane(buckets[i2].load(std::memory_order_relaxed) ^ pattern)) {
+                            return true;
+                        }
+                        std::atomic_thread_fence(std::memory_order_acquire);
+                        if (CRUNCHY_UNLIKELY((v & 1) != 0 || v != version.load(std::memory_order_relaxed))) {
+                            continue; // Raced a relocation
+                        }
+                        return false;
+                    }
+                }
+
+                size_t size() const { return count.load(std::memory_order_relaxed); }
+
+                /// \brief Fingerprints per bucket
+                unsigned slots() const { return slotCount; }
+
+                /// \brief Bits per fingerprint
+                unsigned fingerprint_bits() const { return laneBits; }
+
+                /// \brief Expected false positive rate when full, 2 x slots / 2^fingerprint_bits
+                double false_positive_rate() const;
+
+                size_t size_bytes() const { return buckets.size() * sizeof(uint64_t); }
+
+            private:
+                inline uint64_t fingerprint(uint64_t h) const
+                {
+                    uint64_t fp = (h >> 32) & laneMask;
+                    return fp ? fp : 1;
+                }
+
+                inline uint64_t alternate(uint64_t bucket, uint64_t fp) const
+                {
+                    return (bucket ^ filter_hash(fp)) & bucketMask;
+                }
+
+                inline bool has_zero_lane(uint64_t word) const
+                {
+                    return ((word - ones) & ~word & highs) != 0;
+                }
+
+                inline uint64_t lane(uint64_t word, unsigned s) const { return (word >> (s * laneBits)) & laneMask; }
+
+                void set_lane(uint64_t bucket, unsigned s, uint64_t fp);
+                int free_lane(uint64_t bucket) const;
+
+                std::vector<std::atomic<uint64_t>> buckets;
+                uint64_t bucketMask;
+                unsigned slotCount;
+                unsigned laneBits;
+                uint64_t laneMask;
+                uint64_t ones;     /**< Lowest bit of every lane */
+                uint64_t highs;    /**< Highest bit of every lane */
+
+                std::atomic<uint64_t> version; /**< Odd while a relocation is being written */
+                std::atomic<size_t> count;
+                uint64_t rng;
+                std::mutex lock;
+        };
+
+
+        /**
+         * \brief Cuckoo filter with a Bloom filter behind it for keys that no longer fit.
+         *        Keys that spilled into the Bloom filter are never removed from it, so the false
+         *        positive rate creeps up once the cuckoo filter is full; size capacity with headroom.
+         */
+        class membership_filter
+        {
+            public:
+                /**
+                 * \param capacity - Number of keys the cuckoo filter is sized for, the Bloom filter takes a quarter more
+                 * \param fpr - Target false positive rate of both
+                 */
+                membership_filter(size_t capacity = FILTER_DEFAULT_CAPACITY, double fpr = FILTER_DEFAULT_FPR);
+
+                /// \brief Adds a key, insert each key once
+                void insert(uint64_t key);
+
+                /// \brief Removes a key, only pass keys that were inserted
+                void erase(uint64_t key);
+
+                /// \brief FALSE if key is not registered
+                inline bool maybe_contains(uint64_t key) const
+                {
+                    return primary.maybe_contains(key) ||
+                           (spilled.load(std::memory_order_relaxed) != 0 && overflow.maybe_contains(key));
+                }
+
+                const cuckoo_filter &cuckoo() const { return primary; }
+
+                /// \brief Keys that went to the Bloom filter
+                size_t overflowed() const { return spilled.load(std::memory_order_relaxed); }
+
+            private:
+                cuckoo_filter primary;
+                bloom_filter overflow;
+                std::unordered_set<uint64_t> overflowKeys; /**< Spilled keys still registered, they must not be erased from primary */
+                std::atomic<size_t> spilled;
+                std::mutex lock;
+        };
+    }
+}
@@ -0,0 +1,63 @@
+/**
+* \file CRH_Hash.h
+* \brief Shared hash functions
+* \details The integer mixer and the string hash every module uses, so each exists once.
+*          Modules whose hashes must not line up (the shard ring and the UID filters) use their own seed.
+* \author Corbin Matschull
+* \version 1
+* \date Oct 19. 2026
+* \pre Make sure you have GNU GCC or LLVM to compile, BSD won't compile.
+*/
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+namespace crunchy
+{
+    /// \brief Shared hash functions
+    namespace hash
+    {
+        #   define  HASH_SEED_RING   0x9E3779B97F4A7C15ULL /**< shard::shard_hash, the splitmix64 increment */
+        #   define  HASH_SEED_FILTER 0xD1B54A32D192ED03ULL /**< filter::filter_hash, unrelated to the ring so a shard's filter sees spread fingerprints */
+        #   define  HASH_SEED_SHM    0ULL                  /**< Probe start of shm::shared_registry slots */
+
+
+        /// \brief splitmix64 finalizer, a bijection on 64 bits
+        inline uint64_t mix64(uint64_t x)
+        {
+            x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+            return x ^ (x >> 31);
+        }
+
+
+        /**
+         * \brief Seeded 64 bit key hash, still a bijection so distinct keys never collide.
+         *
+         * \param key - Key to hash
+         * \param seed - One of the HASH_SEED_* values
+         */
+        inline uint64_t hash64(uint64_t key, uint64_t seed)
+        {
+            return mix64(key + seed);
+        }
+
+
+        /**
+         * \brief FNV-1a, 32 bit.
+         *
+         * \param data - Bytes to hash
+         * \param len - Length of data
+         */
+        inline uint32_t fnv1a32(const void *data, size_t len)
+        {
+            const unsigned char *p = (const unsigned char *)data;
+            uint32_t h = 2166136261UL;
+            for (size_t i = 0; i < len; ++i) {
+                h ^= p[i];
+                h *= 16777619UL;
+            }
+            return h;
+        }
+    }
+}
@@ -0,0 +1,113 @@
+/**
+* \file CRH_Histogram.h
+* \brief HDR latency histograms
+* \details Log-linear histogram over a fixed range with constant relative precision,
+*          cheap enough to record every operation of a load run.
+* \author Corbin Matschull
+* \version 1
+* \date Oct 19. 2026
+* \pre Make sure you have GNU GCC or LLVM to compile, BSD won't compile.
+*/
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+
+namespace crunchy
+{
+    /// \brief Latency statistics
+    namespace stats
+    {
+        #   define  HISTOGRAM_SUB_BITS  11 /**< 2^11 sub-buckets, values are kept to 1 part in 1024 (3 significant digits) */
+        #   define  HISTOGRAM_SHIFTS    32 /**< Octaves above the sub-bucket range, covers 2^43 (about 2.4 hours in ns) */
+
+
+        /**
+         * \brief HDR histogram. Values below 2^#HISTOGRAM_SUB_BITS are exact, larger ones share
+         *        a bucket with values within 1/1024 of them. Values past the range land in the last bucket.
+         *        Not thread safe, keep one per thread and merge().
+         */
+        class histogram
+        {
+            public:
+                histogram();
+
+                inline void record(uint64_t value)
+                {
+                    ++counts[index(value)];
+                    ++total;
+                    sum += (double)value;
+                    if (value > maxValue) maxValue = value;
+                    if (value < minValue) minValue = value;
+                }
+
+                /// \brief Adds every value recorded in o
+                void merge(const histogram &o);
+
+                void reset();
+
+                /**
+                 * \brief Value at a percentile, the top of the bucket it falls in.
+                 *
+                 * \param p - Percentile, 0 to 100
+                 *
+                 * \return 0 if nothing was recorded
+                 */
+                uint64_t percentile(double p) const;
+
+                uint64_t count() const { return total; }
+                uint64_t max() const { return maxValue; }
+                uint64_t min() const { return total ? minValue : 0; }
+                double mean() const { return total ? sum / (double)total : 0.0; }
+
+                /**
+                 * \brief Writes the percentile distribution in the HdrHistogram .hgrm text format.
+                 *
+                 * \param fp - Output
+                 * \param scale - Divides every value, 1000.0 writes ns recordings as us
+                 */
+                void write_hgrm(FILE *fp, double scale = 1.0) const;
+
+            private:
+                static inline size_t index(uint64_t v)
+                {
+                    const uint64_t sub  = 1ULL << HISTOGRAM_SUB_BITS;
+                    const uint64_t half = sub >> 1;
+                    if (v < sub) {
+                        return (size_t)v;
+                    }
+
+                    unsigned shift = msb(v) - (HISTOGRAM_SUB_BITS - 1);
+                    if (shift > HISTOGRAM_SHIFTS) {
+                        return (size_t)(sub + HISTOGRAM_SHIFTS * half - 1);
+                    }
+                    return (size_t)(sub + (shift - 1) * half + ((v >> shift) - half));
+                }
+
+                static inline unsigned msb(uint64_t v)
+                {
+#if defined(_MSC_VER)
+                    unsigned long bit;
+                    _BitScanReverse64(&bit, v);
+                    return (unsigned)bit;
+#else
+                    return 63 - (unsigned)__builtin_clzll(v);
+#endif
+                }
+
+                static uint64_t lowest(size_t idx);
+                static uint64_t highest(size_t idx);
+
+                std::vector<uint64_t> counts;
+                uint64_t total;
+                uint64_t maxValue;
+                uint64_t minValue;
+                double sum;
+        };
+    }
+}
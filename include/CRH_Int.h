@@ -8,10 +8,13 @@
 * \warning Make sure you run with admin/root privilages or this will fail
 * \throws CANNOT_BIND_TARGETS_EXCEPTION
 */
-#include <Windows.h>
-#include <minwindef.h>
+#pragma once
 #include <string>
 #include <vector>
+
+#include "CRH_WinTypes.h"
+#include "CRH_Intern.h"
+#include "CRH_EnvProfile.h"
 namespace crunchy
 {
 
@@ -28,6 +31,7 @@ namespace crunchy
 #   define  CRUNCHY_UDOUBLE unsigned double
 #   define  CRUNCHY_ULONG unsigned long
 #   define  CRUNCHY_STRING std::string
+#   define  CRUNCHY_ISTRING crunchy::intern::istring /**< Interned CRUNCHY_STRING, use for identifiers kept in structs */
 
 #   define  PAGING_REFERENCES 12
 
@@ -45,33 +49,39 @@ namespace crunchy
  *
  * @param signableID - used to sign a 32-Bit PRUID (Pseudo. Random. User. ID)
  * @param ptr_id - used a pointer ID
- * @param virtualUID - used to sign a virtual UID with a string
+ * @param virtualUID - used to sign a virtual UID with an interned string
  */
 typedef struct
 {
     CRUNCHY_UINT signableID;
     CRUNCHY_UINT *ptr_id;
-    CRUNCHY_STRING virtualUID;
+    CRUNCHY_ISTRING virtualUID;
 } pgs_t;
 
 
 /**
  * @brief PRP (Public Return Prototypes), typenames for PRP keys.
+ *        Keys are stored as whole key words of the environment profile, see basic_prp_keys.
  *
- * @param prp128  - portable rotation property 128-bit
- * @param prp512  - portable rotation property 512-bit
- * @param prp1024 - portable rotation property 1024-bit
+ * @param prp - prp128, prp512 and prp1024 portable rotation properties
  *
  *  @param crnHasNotInt - vector chaining for CRN property checking based upon INT value
  */
-struct has_prp_int
+template<class Env = default_env>
+struct basic_has_prp_int
 {
-    static int prp128;
-    static long prp512;
-    static long long prp1024;
+    static basic_prp_keys<Env> prp;
 
     std::vector<int> crnHasNotInt;
-} has_prp_int_t;
+};
+
+template<class Env>
+basic_prp_keys<Env> basic_has_prp_int<Env>::prp;
+
+typedef basic_has_prp_int<> has_prp_int;
+
+/// @brief Shared has_prp_int, defined in Crn.cpp
+extern has_prp_int has_prp_int_t;
 
 
 /**
@@ -81,6 +91,9 @@ struct crn
 {
     WORD default_crn;
     static std::string stdCRN;
+
+    /// @brief CRN of this process, createCRNData() saves its default_crn and hasCRNInstance() restores it
+    static crn current;
 };
 
 #if defined(HAS_STATIC_REFERENCE)
@@ -97,9 +110,13 @@ struct crn
 
 /// @param - Anonymous integer for sizing placeholder
 /// @param crnID - Default Session ID
-void crn(CRUNCHY_UINT*, const CRUNCHY_STRING crnID);
+void crn(CRUNCHY_UINT*, const CRUNCHY_STRING &crnID);
 
+/// @brief Saves the CRN instance, register table and page table to #CRN_SNAPSHOT_PATH, see CRH_Snapshot.h
 void  createCRNData();
+
+/// @brief Maps the snapshot saved by createCRNData(), only its header is checked up front
+/// @return Snapshot version, 0 if there is no usable snapshot
 DWORD hasCRNInstance();
 
 
@@ -0,0 +1,123 @@
+/**
+* \file CRH_Intern.h
+* \brief Interned string pool
+* \details Global thread-safe interner handing out 32-bit handles for CRUNCHY_STRING identifiers.
+* \author Corbin Matschull
+* \version 1
+* \date Oct 19. 2026
+* \pre Make sure you have GNU GCC or LLVM to compile, BSD won't compile.
+* \throws Out of Range Exception
+*/
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "CRH_Exception.h"
+
+namespace crunchy
+{
+    /// \brief Interned string pool
+    namespace intern
+    {
+        #   define  INTERN_NULL        0U          /**< Handle of the empty string, what a default istring holds */
+        #   define  INTERN_INVALID     0xFFFFFFFFU /**< Held by an istring whose string could not be interned, never a real handle */
+        #   define  INTERN_SHARD_BITS  4           /**< 16 shards, each with its own lock and arena */
+        #   define  INTERN_ARENA_BLOCK (64U << 10) /**< Arena block size per shard */
+
+
+        /**
+         * \brief Interns a string, equal strings always get the same handle.
+         *
+         * \param str - String data, does not need to be NUL terminated
+         * \param len - Length of str
+         *
+         * \return Handle, #INTERN_NULL for the empty string.
+         *         io_errc::out_of_range if the string's shard is full (see set_shard_limit()) or str is over 4GiB,
+         *         strings interned before are still found
+         */
+        IOexception::io_result<uint32_t> intern(const char *str, size_t len);
+
+        /// \brief Interns a string, see intern(const char*, size_t)
+        inline IOexception::io_result<uint32_t> intern(const std::string &str) { return intern(str.data(), str.size()); }
+
+        /**
+         * \brief Finds the handle of a string without interning it.
+         *
+         * \return Handle, #INTERN_NULL if the string was never interned (or is empty)
+         */
+        uint32_t find(const char *str, size_t len);
+
+        /**
+         * \brief NUL terminated string for a handle, valid for the life of the process. Lock-free.
+         *        A handle that was never handed out gives "".
+         */
+        const char *lookup(uint32_t handle);
+
+        /// \brief Length of the string for a handle, 0 for a handle that was never handed out. Lock-free.
+        size_t length(uint32_t handle);
+
+        /**
+         * \brief Pool usage.
+         *
+         * \param strings - Number of distinct strings interned
+         * \param bytes - Arena bytes reserved
+         */
+        void stats(size_t *strings, size_t *bytes);
+
+        /**
+         * \brief Caps how many strings each shard holds, to bound the pool.
+         *        Shards already past the cap keep their strings and only refuse new ones.
+         *
+         * \param perShard - Strings per shard, at most (and by default) 16M
+         */
+        void set_shard_limit(uint32_t perShard);
+
+
+        /**
+         * \brief Interned string, 4 bytes and trivially copyable.
+         *        Use this in structs instead of CRUNCHY_STRING, equality is a compare of two handles.
+         *        If the string could not be interned the istring is not valid(): it reads as "" but never
+         *        compares equal to anything, itself and the empty string included.
+         */
+        class istring
+        {
+            public:
+                istring() : h(INTERN_NULL) {}
+                /// \brief Interns str, explicit so a string never turns into a handle (and a pool entry) by accident
+                explicit istring(const char *str) : h(intern(str, strlen_(str)).value_or(INTERN_INVALID)) {}
+                explicit istring(const std::string &str) : h(intern(str).value_or(INTERN_INVALID)) {}
+
+                /// \brief Wraps a handle from intern()
+                static istring from_handle(uint32_t handle) { istring s; s.h = handle; return s; }
+
+                /// \brief Wraps the result of intern(), not valid() if it failed
+                static istring from_result(const IOexception::io_result<uint32_t> &r) { return from_handle(r.value_or(INTERN_INVALID)); }
+
+                /// \brief FALSE if the string could not be interned
+                bool valid() const { return h != INTERN_INVALID; }
+
+                uint32_t handle() const { return h; }
+                const char *c_str() const { return lookup(h); }
+                size_t size() const { return length(h); }
+                bool empty() const { return h == INTERN_NULL; }
+                std::string str() const { return std::string(lookup(h), length(h)); }
+
+                bool operator==(const istring &o) const { return h == o.h && h != INTERN_INVALID; }
+                bool operator!=(const istring &o) const { return !(*this == o); }
+
+                /// \brief Handle order, not lexical order. Good enough for ordered containers.
+                bool operator<(const istring &o) const { return h < o.h; }
+
+            private:
+                static size_t strlen_(const char *str)
+                {
+                    size_t n = 0;
+                    if (str) while (str[n]) ++n;
+                    return n;
+                }
+
+                uint32_t h;
+        };
+    }
+}
@@ -0,0 +1,123 @@
+/**
+* \file CRH_MappedFile.h
+* \brief Read-only file mappings
+* \details Maps whole files for CRN snapshots, and windows of a file for runt blocks so files
+*          larger than the address space can still be tested.
+* \author Corbin Matschull
+* \version 1
+* \date Oct 19. 2026
+* \pre Make sure you have GNU GCC or LLVM to compile, BSD won't compile.
+* \throws CANNOT_MAP_BLOCK_EXCEPTION
+*/
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "CRH_Exception.h"
+
+namespace crunchy
+{
+    namespace paging
+    {
+        /**
+         * \brief Read-only mapping of a whole file.
+         *
+         * \param data - Start of the mapping, NULL if the file could not be mapped
+         * \param size - Size of the file in bytes
+         * \param opened - TRUE if the file could be opened, an empty file is opened but not mapped
+         * \param error - Why the file could not be mapped
+         * \param file - OS file handle (Windows only)
+         * \param mapping - OS mapping handle (Windows only)
+         */
+        typedef struct mapped_file
+        {
+            const unsigned char *data;
+            uint64_t size;
+            bool opened;
+            IOexception::io_errc error;
+            intptr_t file;
+            intptr_t mapping;
+        } mapped_file_t;
+
+
+        /// \brief Mapping granularity of the current OS, offsets into a mapping should be aligned to it
+        size_t page_granularity();
+
+        /**
+         * \brief Maps a whole file read-only. Never throws, failures are reported in mapped_file::error.
+         *
+         * \param path - File to map
+         * \param sequential - TRUE to hint sequential access, FALSE for random access
+         */
+        mapped_file_t map_file(const std::string &path, bool sequential = true);
+
+        /// \brief Releases a mapping from map_file(), safe to call on a failed mapping
+        void unmap_file(mapped_file_t &mf);
+
+
+        /**
+         * \brief File opened for mapping one window at a time, see map_window().
+         *
+         * \param size - Size of the file in bytes
+         * \param opened - TRUE if the file could be opened
+         * \param error - Why the file could not be opened
+         * \param file - OS file handle or descriptor, -1 if not open
+         * \param mapping - OS mapping handle (Windows only), 0 if none
+         * \param sequential - Access hint passed to open_windowed()
+         */
+        typedef struct windowed_file
+        {
+            uint64_t size;
+            bool opened;
+            IOexception::io_errc error;
+            intptr_t file;
+            intptr_t mapping;
+            bool sequential;
+        } windowed_file_t;
+
+
+        /**
+         * \brief Read-only mapping of part of a windowed_file.
+         *
+         * \param data - Start of the requested range, NULL if it could not be mapped
+         * \param length - Length of the requested range
+         * \param base - Start of the mapping, aligned down to page_granularity()
+         * \param span - Length of the mapping
+         */
+        typedef struct mapped_window
+        {
+            const unsigned char *data;
+            size_t length;
+            const unsigned char *base;
+            size_t span;
+        } mapped_window_t;
+
+
+        /**
+         * \brief Opens a file for map_window(), nothing is mapped yet. Never throws.
+         *
+         * \param path - File to open
+         * \param sequential - TRUE to hint sequential access, FALSE for random access
+         */
+        windowed_file_t open_windowed(const std::string &path, bool sequential = true);
+
+        /// \brief Closes a file from open_windowed(), every window must be unmapped first
+        void close_windowed(windowed_file_t &wf);
+
+        /**
+         * \brief Maps length bytes at offset, the window only takes the address space it covers.
+         *        Safe to call from several threads on the same file.
+         *
+         * \param wf - Open file
+         * \param offset - Start of the range, any alignment
+         * \param length - Length of the range, clamped to the end of the file
+         *
+         * \return Window, data is NULL and length 0 if it could not be mapped
+         */
+        mapped_window_t map_window(const windowed_file_t &wf, uint64_t offset, size_t length);
+
+        /// \brief Releases a window from map_window(), safe to call on a failed window
+        void unmap_window(mapped_window_t &w);
+    }
+}
@@ -8,6 +8,7 @@
 #pragma once
 #include <Windows.h>
 #include "CRH_Signatures.h"
+#include "CRH_EnvProfile.h"
 
 namespace crunchy
 {
@@ -32,20 +33,7 @@ namespace crunchy
         bool hasUNIXEnv = true;
         bool hasWINEnv  = false;
 
-
-        /**
-         * \brief This holds environment sizes
-         *
-         * \param env64_t - Large environment size
-         * \param env32_t - Default environment size
-         * \param env16_t - Small environment size, use this in cases of being in a bootloader or other low-level process
-         */
-        typedef struct ENV_DATA
-        {
-            typedef long long   env64_t;
-            typedef long        env32_t;
-            typedef short       env16_t;
-        } ENV_DATA_T, *PENV_DATA_T;
+        // ENV_DATA lives in CRH_EnvProfile.h so the profiles can be keyed on it
 
 
         /**
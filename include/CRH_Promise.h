@@ -0,0 +1,240 @@
+/**
+* \file CRH_Promise.h
+* \brief Promise heartbeat engine
+* \details Coalesces component promises into one batched report per heartbeat tick.
+* \author Corbin Matschull
+* \version 1
+* \date Oct 19. 2026
+* \pre Make sure you have GNU GCC or LLVM to compile, BSD won't compile.
+* \throws CANNOT_BIND_REPORT_SOCKET_EXCEPTION
+*/
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CRH_Exception.h"
+#include "CRH_Hash.h"
+
+namespace crunchy
+{
+    /// \brief Promise heartbeat engine
+    namespace promise
+    {
+        #   define  PROMISE_MAX_SLOTS   (1UL << 20) /**< Default component slot capacity of the engine */
+        #   define  PROMISE_TICK_MS     1000        /**< Default heartbeat tick */
+        #   define  PROMISE_NO_SLOT     0xFFFFFFFFUL /**< Component has not promised anything yet */
+        #   define  PROMISE_REPORT_MAGIC 0x50524D53UL /**< "PRMS", first word of every report batch */
+        #   define  PROMISE_MAX_BATCH   4096        /**< Max records per send, keeps a batch inside one datagram */
+
+        // ===============================
+        // -------------------------------
+        //      SLOT FLAGS
+        #   define  PROMISE_ACTIVE  0x01 /**< Slot holds a promise */
+        #   define  PROMISE_STRICT  0x02 /**< Strict promise, reported ahead of everything else */
+        #   define  PROMISE_MISSED  0x04 /**< Strict promise did not report back this tick */
+
+
+        /**
+         * \brief Per-slot promise state, kept in one flat array indexed by component slot.
+         *
+         * \param key - Hash of the promise string
+         * \param objects - Max number of objects promised
+         * \param flags - PROMISE_* slot flags
+         */
+        typedef struct promise_state
+        {
+            uint32_t key;
+            uint32_t objects;
+            uint8_t  flags;
+        } promise_state_t;
+
+
+        /**
+         * \brief Header of a report batch, followed by count promise_record_t.
+         *
+         * \param magic - #PROMISE_REPORT_MAGIC
+         * \param tick - Heartbeat tick the batch was built on
+         * \param count - Number of records following the header
+         * \param missed - Number of non-strict promises that did not report back, these are not listed
+         */
+        typedef struct promise_header
+        {
+            uint32_t magic;
+            uint32_t tick;
+            uint32_t count;
+            uint32_t missed;
+        } promise_header_t;
+
+
+        /**
+         * \brief A single slot in a report batch.
+         *
+         * \param slot - Component slot
+         * \param key - Hash of the promise string
+         * \param objects - Max number of objects promised
+         * \param flags - PROMISE_* slot flags
+         */
+        typedef struct promise_record
+        {
+            uint32_t slot;
+            uint32_t key;
+            uint32_t objects;
+            uint32_t flags;
+        } promise_record_t;
+
+
+        /**
+         * \brief Hashes a promise string into a promise key (FNV-1a).
+         *
+         * \param promise_me - Promise string
+         */
+        inline uint32_t promise_key(const std::string &promise_me)
+        {
+            return hash::fnv1a32(promise_me.data(), promise_me.size());
+        }
+
+
+        /**
+         * \brief Where report batches go, one send per tick.
+         */
+        class report_sink
+        {
+            public:
+                virtual ~report_sink() {}
+
+                /**
+                 * \param batch - Header followed by the records
+                 * \param len - Length of batch in bytes
+                 *
+                 * \return TRUE if the batch was handed off
+                 */
+                virtual bool send(const unsigned char *batch, size_t len) = 0;
+        };
+
+
+        /**
+         * \brief Local stand-in for the report server.
+         *        A connected datagram socket pair (a non-blocking message mode named pipe on Windows),
+         *        one end is written by the engine and the other can be drained by a local reader.
+         *        Sends never block, a batch that does not fit is dropped.
+         */
+        class local_report_socket : public report_sink
+        {
+            public:
+                local_report_socket();
+                virtual ~local_report_socket();
+
+                /// \brief io_errc::cannot_bind_socket if the socket pair could not be created
+                std::error_code status() const noexcept { return state; }
+
+                bool send(const unsigned char *batch, size_t len);
+
+                /**
+                 * \brief Reads one batch from the server end.
+                 *
+                 * \return Number of bytes read, 0 if nothing could be read
+                 */
+                size_t receive(unsigned char *buf, size_t len);
+
+            private:
+                intptr_t engine_end;
+                intptr_t server_end;
+                std::error_code state;
+        };
+
+
+        /**
+         * \brief Heartbeat engine.
+         *        Components beat by setting one bit, each tick swaps the beat bitmap out a word
+         *        at a time and sends everything as a single batch, strict promises first.
+         *        Tick cost is one pass over the bitmap words plus one send, independent of
+         *        how many objects were promised.
+         */
+        class heartbeat_engine
+        {
+            public:
+                /**
+                 * \param sink - Report sink, not owned
+                 * \param capacity - Max number of component slots
+                 */
+                heartbeat_engine(report_sink *sink, uint32_t capacity = PROMISE_MAX_SLOTS);
+                ~heartbeat_engine();
+
+                /**
+                 * \brief Records a promise for a slot, acquiring a new slot if slot is #PROMISE_NO_SLOT.
+                 *
+                 * \param slot - Component slot or #PROMISE_NO_SLOT
+                 * \param key - Hash of the promise string, see promise_key()
+                 * \param hasStrictPromise - Report this slot ahead of the others and list it when it misses a tick
+                 * \param objectsToPromise - Max number of objects to promise
+                 *
+                 * \return The slot, #PROMISE_NO_SLOT if the engine is full
+                 */
+                uint32_t promise(uint32_t slot, uint32_t key, bool hasStrictPromise, uint32_t objectsToPromise);
+
+                /// \brief Drops the promise of a slot and any beat it left, the slot can be handed out again.
+                void release(uint32_t slot);
+
+                /// \brief Component reports back, lock-free.
+                inline void beat(uint32_t slot)
+                {
+                    if (slot < slotCount) {
+                        beats[slot >> 6].fetch_or(1ULL << (slot & 63), std::memory_order_relaxed);
+                    }
+                }
+
+                /**
+                 * \brief Builds and sends the report batch for this tick.
+                 *        Batches larger than #PROMISE_MAX_BATCH go out in several sends.
+                 *
+                 * \return Number of records the sink accepted
+                 */
+                size_t tick();
+
+                /// \brief Runs tick() every tickMs on a background thread.
+                void start(unsigned tickMs = PROMISE_TICK_MS);
+
+                /// \brief Stops the background thread.
+                void stop();
+
+            private:
+                void append(uint32_t slot, uint8_t flags);
+                void flush(bool force);
+
+                report_sink *sink;
+                uint32_t slotCount;
+                uint32_t ticks;
+
+                std::vector<promise_state_t> states;
+                std::vector<uint64_t> active;              /**< Bitmap of slots holding a promise */
+                std::vector<uint64_t> strict;              /**< Bitmap of slots holding a strict promise */
+                std::vector<std::atomic<uint64_t>> beats;  /**< Bitmap of slots that reported back since the last tick */
+                std::vector<uint32_t> freeSlots;
+                uint32_t nextSlot;
+
+                std::vector<uint64_t> taken;               /**< Beats swapped out this tick, reused across ticks */
+                std::vector<unsigned char> batch;          /**< Header plus up to #PROMISE_MAX_BATCH records, reused across ticks */
+                uint32_t count;
+                uint32_t missed;
+                size_t sent;
+                std::mutex lock;
+
+                std::thread runner;
+                std::atomic<bool> running;
+                std::mutex wakeLock;
+                std::condition_variable wake;
+        };
+
+
+        /**
+         * \brief Process wide engine used by Register::promise, reports to a local_report_socket
+         */
+        heartbeat_engine &engine();
+    }
+}
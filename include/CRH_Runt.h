@@ -0,0 +1,115 @@
+/**
+* \file CRH_Runt.h
+* \brief Runtime Unified Node Tester
+* \details Block splitting and parallel block testing used by Register::runt.
+* \author Corbin Matschull
+* \version 1
+* \date Oct 19. 2026
+* \pre Make sure you have GNU GCC or LLVM to compile, BSD won't compile.
+* \throws CANNOT_MAP_BLOCK_EXCEPTION
+*/
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "CRH_Exception.h"
+
+namespace crunchy
+{
+    /// \brief Runtime Unified Node Tester
+    namespace runt
+    {
+        /**
+         * \brief Default block size for runt, 4MiB.
+         *        Always rounded up to the page granularity of the current OS.
+         */
+        #   define  RUNT_BLOCK_SIZE (4UL << 20)
+
+        /// \brief Let runt pick the worker count (one per core)
+        #   define  RUNT_ALL_CORES 0
+
+
+        /**
+         * \brief A single block handed to the tester.
+         *
+         * \param file - Index of the file in the runt argument list
+         * \param index - Index of the block inside its file
+         * \param offset - Byte offset of the block inside its file
+         * \param data - Mapped block data, valid only during the test call
+         * \param length - Length of the block, the last block of a file may be short
+         */
+        typedef struct runt_block
+        {
+            size_t file;
+            size_t index;
+            uint64_t offset;
+            const unsigned char *data;
+            size_t length;
+        } runt_block_t;
+
+
+        /**
+         * \brief Result of testing a single block.
+         *
+         * \param file - Index of the file in the runt argument list
+         * \param offset - Byte offset of the block inside its file
+         * \param length - Length of the block
+         * \param passed - TRUE if the tester accepted the block
+         * \param error - Why the file could not be tested, io_errc::ok when the tester ran
+         */
+        typedef struct runt_result
+        {
+            size_t file;
+            uint64_t offset;
+            size_t length;
+            bool passed;
+            IOexception::io_errc error;
+        } runt_result_t;
+
+
+        /**
+         * \brief Block tester, called concurrently from the runt workers.
+         *        Must not keep the block data pointer after returning.
+         */
+        typedef std::function<bool(const runt_block_t &)> runt_tester;
+
+
+        /**
+         * \brief Tests every file block by block, spread across the worker threads.
+         *        Blocks are claimed from a shared counter and each is mapped read-only as its own window
+         *        while it is tested, so files larger than the address space can still be tested.
+         *        Results are written into their own slot so they come back in file/offset order.
+         *
+         * \param paths - Files to test
+         * \param test - Block tester
+         * \param blockSize - Block size in bytes, rounded up to the page granularity
+         * \param workers - Number of worker threads, #RUNT_ALL_CORES for one per core
+         *
+         * \return One result per block, ordered by file then offset.
+         *         A file that cannot be opened reports a single failed block of length 0 carrying the error,
+         *         a block whose window cannot be mapped fails with io_errc::cannot_map.
+         *         Never throws on I/O errors, see the error policy in CRH_Exception.h
+         */
+        std::vector<runt_result_t> run_blocks(
+                                              const std::vector<std::string> &paths,
+                                              const runt_tester &test,
+                                              size_t blockSize = RUNT_BLOCK_SIZE,
+                                              unsigned workers = RUNT_ALL_CORES
+                                             );
+
+
+        /// \brief Appends nothing, ends the path pack.
+        inline void pack_paths(std::vector<std::string> &) {}
+
+        /// \brief Appends every path of the pack in argument order.
+        template<class Path, class... Paths>
+        inline void pack_paths(std::vector<std::string> &out, const Path &path, const Paths &... rest)
+        {
+            out.emplace_back(path);
+            pack_paths(out, rest...);
+        }
+    }
+}
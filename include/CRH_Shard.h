@@ -0,0 +1,400 @@
+/**
+* \file CRH_Shard.h
+* \brief Sharded component registry
+* \details Splits component UIDs across several registry shards with a consistent hash ring.
+*          Shards live in this process or in other local processes behind a Unix socket.
+*          Adding a shard only moves the UIDs its ring points take over, and traffic keeps
+*          flowing while they move.
+* \author Corbin Matschull
+* \version 1
+* \date Oct 19. 2026
+* \pre Make sure you have GNU GCC or LLVM to compile, BSD won't compile.
+* \throws CANNOT_BIND_SOCKET_EXCEPTION
+*/
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "CRH_Exception.h"
+#include "CRH_Snapshot.h"
+#include "CRH_Filter.h"
+#include "CRH_Hash.h"
+
+namespace crunchy
+{
+    /// \brief Sharded component registry
+    namespace shard
+    {
+        #   define  SHARD_VNODES          160         /**< Default ring points per shard */
+        #   define  SHARD_MIGRATE_CHUNK   1024        /**< UIDs moved per exclusive section while rebalancing */
+        #   define  SHARD_WIRE_MAGIC      0x53484152UL /**< "SHAR", first word of every socket frame */
+        #   define  SHARD_MAX_FRAME       (64UL << 20) /**< Largest socket frame accepted */
+
+
+        /// \brief Batch operations
+        enum shard_op_code
+        {
+            SHARD_PUT = 0, /**< Insert or update */
+            SHARD_ADD,     /**< Insert only if absent */
+            SHARD_GET,     /**< Find */
+            SHARD_DEL,     /**< Erase */
+            SHARD_TAKE     /**< Find and erase */
+        };
+
+
+        /**
+         * \brief One operation of a batch.
+         *
+         * \param op - shard_op_code
+         * \param entry - Entry to store for PUT/ADD, only the uid is read otherwise
+         */
+        typedef struct shard_op
+        {
+            uint32_t op;
+            snapshot::register_entry_t entry;
+        } shard_op_t;
+
+
+        /**
+         * \brief Result of one operation.
+         *
+         * \param found - The UID was registered before the operation
+         * \param entry - Registered entry for GET/TAKE, and for ADD when it was already there
+         */
+        typedef struct shard_reply
+        {
+            bool found;
+            snapshot::register_entry_t entry;
+        } shard_reply_t;
+
+
+        /// \brief Inclusive range of ring hashes
+        typedef struct hash_range
+        {
+            uint64_t lo;
+            uint64_t hi;
+        } hash_range_t;
+
+
+        /// \brief Ring position of a UID (splitmix64, a bijection so UIDs never collide)
+        inline uint64_t shard_hash(uint64_t uid)
+        {
+            return hash::hash64(uid, HASH_SEED_RING);
+        }
+
+
+        /**
+         * \brief Consistent hash ring, each shard owns the hashes up to and including each of its points.
+         */
+        class hash_ring
+        {
+            public:
+                /// \brief Adds vnodes ring points for shard
+                void add(uint32_t shard, uint32_t vnodes = SHARD_VNODES);
+
+                /// \brief Shard owning a ring hash, the ring must not be empty
+                uint32_t owner(uint64_t hash) const;
+
+                /// \brief Hash ranges owned by shard
+                std::vector<hash_range_t> ranges(uint32_t shard) const;
+
+                bool empty() const { return points.empty(); }
+
+            private:
+                typedef struct point
+                {
+                    uint64_t hash;
+                    uint32_t shard;
+                } point_t;
+
+                std::vector<point_t> points; /**< Sorted by hash */
+        };
+
+
+        /**
+         * \brief A registry shard.
+         *        A batch is handed over with submit() and finished with complete(), so the
+         *        sharded_register can have a batch in flight on every shard at once.
+         *        Every successful submit() is followed by exactly one complete() on the same thread.
+         */
+        class shard_backend
+        {
+            public:
+                virtual ~shard_backend() {}
+
+                /**
+                 * \brief Starts a batch.
+                 *
+                 * \param ops - Operations, run in order
+                 * \param n - Number of operations
+                 * \param replies - One reply per operation, filled by the time complete() returns
+                 */
+                virtual std::error_code submit(const shard_op_t *ops, size_t n, shard_reply_t *replies) = 0;
+
+                /// \brief Waits for the batch started by submit()
+                virtual std::error_code complete() = 0;
+
+                /**
+                 * \brief Lists the UIDs whose ring hash falls in one of ranges.
+                 *
+                 * \param ranges - Hash ranges
+                 * \param n - Number of ranges
+                 * \param uids - Receives the UIDs
+                 */
+                virtual std::error_code collect(const hash_range_t *ranges, size_t n, std::vector<uint64_t> &uids) = 0;
+
+                /**
+                 * \brief Lock-free pre-check, FALSE only if uid is certainly not registered here.
+                 *        A call racing a registration of the same UID may miss it.
+                 */
+                virtual bool maybe_contains(uint64_t uid) const { (void)uid; return true; }
+
+                /**
+                 * \brief Appends a copy of every entry on the shard.
+                 *        The default lists the UIDs and reads them back #SHARD_MIGRATE_CHUNK at a time.
+                 */
+                virtual std::error_code entries(std::vector<snapshot::register_entry_t> &out);
+        };
+
+
+        /**
+         * \brief In-process shard, one hash table behind one lock.
+         *        A membership filter updated with the table answers absent UIDs without taking the lock.
+         */
+        class local_shard : public shard_backend
+        {
+            public:
+                /**
+                 * \param expected - Number of UIDs the membership filter is sized for
+                 * \param fpr - False positive rate of the membership filter
+                 */
+                explicit local_shard(size_t expected = FILTER_DEFAULT_CAPACITY, double fpr = FILTER_DEFAULT_FPR)
+                    : present(expected, fpr) {}
+
+                std::error_code submit(const shard_op_t *ops, size_t n, shard_reply_t *replies);
+                std::error_code complete() { return std::error_code(); }
+                std::error_code collect(const hash_range_t *ranges, size_t n, std::vector<uint64_t> &uids);
+
+                bool maybe_contains(uint64_t uid) const { return present.maybe_contains(uid); }
+
+                /// \brief Copies the table in one pass under its lock
+                std::error_code entries(std::vector<snapshot::register_entry_t> &out);
+
+                size_t size();
+
+            private:
+                std::unordered_map<uint64_t, snapshot::register_entry_t> table;
+                filter::membership_filter present; /**< UIDs in table, changed under lock */
+                std::mutex lock;
+        };
+
+
+        /**
+         * \brief Client end of a shard served by a shard_server in another local process.
+         *        One connection per shard, a batch is one frame each way.
+         */
+        class socket_shard : public shard_backend
+        {
+            public:
+                socket_shard();
+                ~socket_shard();
+
+                /**
+                 * \brief Connects to a shard_server.
+                 *
+                 * \return io_errc::cannot_bind_socket if it could not connect, std::errc::not_supported on Windows
+                 */
+                std::error_code connect(const std::string &path);
+
+                std::error_code submit(const shard_op_t *ops, size_t n, shard_reply_t *replies);
+                std::error_code complete();
+                std::error_code collect(const hash_range_t *ranges, size_t n, std::vector<uint64_t> &uids);
+
+            private:
+                intptr_t fd;
+                std::mutex lock;                   /**< Held from submit() to complete() */
+                shard_reply_t *pending;
+                size_t pendingCount;
+                std::vector<unsigned char> buf;    /**< Frame buffer, reused */
+        };
+
+
+        /**
+         * \brief Serves a local_shard on a Unix socket, one thread per connection.
+         */
+        class shard_server
+        {
+            public:
+                /// \param backend - Shard to serve, not owned
+                explicit shard_server(local_shard *backend);
+                ~shard_server();
+
+                /**
+                 * \brief Binds path and starts accepting.
+                 *
+                 * \return io_errc::cannot_bind_socket if path could not be bound, std::errc::not_supported on Windows
+                 */
+                std::error_code start(const std::string &path);
+
+                /// \brief Closes the socket and every connection, then joins the threads
+                void stop();
+
+                /// \brief Connection threads still held, finished ones are joined as new connections arrive
+                size_t threads()
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    return workers.size();
+                }
+
+            private:
+                void accept_loop();
+                void serve(intptr_t conn);
+
+                /// \brief Joins the connection threads that have returned
+                void reap();
+
+                local_shard *backend;
+                std::string path;
+                intptr_t listener;
+                std::atomic<bool> running;
+                std::thread acceptor;
+                std::vector<std::thread> workers;
+                std::vector<std::thread::id> finished; /**< Workers done serving, joined by reap() */
+                std::vector<intptr_t> conns;
+                std::mutex lock;
+        };
+
+
+        /**
+         * \brief Register facade spread over shards.
+         *        Batches are split per shard and every shard's part is in flight at once.
+         *        add_shard() rebalances online: while UIDs move, reads try the new owner
+         *        first and then the old one, and erases go to both.
+         *        Every sharded_register is attached as a snapshot source for its whole life.
+         */
+        class sharded_register : public snapshot::snapshot_source
+        {
+            public:
+                /**
+                 * \param expected - Number of UIDs the register-wide filter is sized for
+                 * \param fpr - False positive rate of the register-wide filter
+                 */
+                explicit sharded_register(size_t expected = FILTER_DEFAULT_CAPACITY, double fpr = FILTER_DEFAULT_FPR);
+                ~sharded_register();
+
+                /**
+                 * \brief Adds a shard and moves the UIDs it now owns onto it.
+                 *        Moves run #SHARD_MIGRATE_CHUNK UIDs at a time so other calls keep going in between.
+                 *        If a move fails the UIDs are moved back and the shard is removed again. If that fails
+                 *        too the register stays migrating, every UID stays reachable, and the next call
+                 *        finishes the move before adding its own shard.
+                 *
+                 * \param backend - Shard, not owned. Must be empty
+                 * \param vnodes - Ring points, relative weight of the shard
+                 *
+                 * \return First shard error hit while moving UIDs
+                 */
+                std::error_code add_shard(shard_backend *backend, uint32_t vnodes = SHARD_VNODES);
+
+                /**
+                 * \brief Runs a batch across the shards, one round trip per shard.
+                 *
+                 * \param ops - Operations, ops on the same UID run in order
+                 * \param n - Number of operations
+                 * \param replies - One reply per operation
+                 */
+                std::error_code apply(const shard_op_t *ops, size_t n, shard_reply_t *replies);
+
+                /// \brief Registers or updates a component
+                std::error_code insert(const snapshot::register_entry_t &entry);
+
+                /**
+                 * \brief Copies a registered component out, FALSE if the UID is not registered.
+                 *        Absent UIDs are usually answered by the register-wide filter, before the lock
+                 *        and the ring, or else by the shard filters without a shard call.
+                 */
+                bool find(uint64_t uid, snapshot::register_entry_t *out);
+
+                /// \brief Deregisters a component, FALSE if it was not registered. Filtered like find()
+                bool erase(uint64_t uid);
+
+                /**
+                 * \brief Appends every registered component of every shard to inst.
+                 *        Each shard is copied under its own lock while calls keep running, a UID registered
+                 *        or erased meanwhile may or may not be in inst. add_shard() waits, so no UID is seen
+                 *        twice or missed mid-move.
+                 */
+                std::error_code collect(snapshot::crn_instance_t &inst);
+
+                /**
+                 * \brief Registers every component of a mapped snapshot that is not registered already.
+                 *
+                 * \return io_errc::bad_format if the register section fails its check, or the first shard error
+                 */
+                std::error_code restore(snapshot::snapshot_view &view);
+
+                size_t shards() const { return backends.size(); }
+
+            private:
+                /// \brief apply() under the shared lock, keeps the register-wide filter up to date
+                std::error_code apply_locked(const shard_op_t *ops, size_t n, shard_reply_t *replies);
+
+                /// \brief Sends every op to the shard owning its UID, UIDs being moved take the slow path
+                std::error_code route(const shard_op_t *ops, size_t n, shard_reply_t *replies);
+                std::error_code dispatch(const shard_op_t *ops, size_t n, shard_reply_t *replies,
+                                         const uint32_t *owners);
+
+                /**
+                 * \brief Moves the UIDs of from that fall in ranges onto to, a chunk at a time.
+                 *
+                 * \param code - SHARD_ADD or SHARD_PUT, how entries are stored on to
+                 * \param chunked - Take the exclusive lock per chunk, FALSE if the caller already holds it
+                 */
+                std::error_code move(shard_backend *from, shard_backend *to,
+                                     const std::vector<hash_range_t> &ranges, uint32_t code, bool chunked);
+
+                /// \brief Moves the UIDs shard added owns onto it and ends the migration
+                std::error_code migrate(uint32_t added);
+
+                /// \brief Moves everything on shard added back to its previous owner and removes the shard
+                std::error_code roll_back(uint32_t added);
+
+                /// \brief One UID op, skipped when no shard that could hold the UID has it in its filter
+                bool single(uint32_t code, uint64_t uid, snapshot::register_entry_t *out);
+
+                /// \brief Lock-free pre-check on the register-wide filter, FALSE only if uid is certainly not registered
+                bool maybe_registered(uint64_t uid) const;
+
+                /// \brief Rebuilds the register-wide filter from the shards once enough erased UIDs linger in it
+                void prune_filter();
+
+                /// \brief Shared lock, queued behind a writer waiting in exclusive()
+                std::shared_lock<std::shared_timed_mutex> shared();
+
+                /// \brief Takes lock exclusively ahead of calls still arriving, the shared lock alone favours readers
+                std::unique_lock<std::shared_timed_mutex> exclusive();
+
+                std::vector<shard_backend *> backends;
+                hash_ring ring;
+                hash_ring previous;  /**< Ring before the shard being added, only used while migrating */
+                bool migrating;
+
+                std::shared_timed_mutex lock; /**< Shared for calls, exclusive for ring swaps and moves */
+                std::mutex gate;              /**< Held by a writer waiting on lock, new calls queue on it */
+                std::atomic<bool> writerWaiting;
+                std::mutex rebalance;         /**< One add_shard(), collect() or filter rebuild at a time */
+
+                filter::bloom_filter present[2];    /**< UIDs registered since the last rebuild, present[(presentEpoch >> 1) & 1] is read */
+                std::atomic<uint64_t> presentEpoch; /**< Odd while a rebuild fills the other filter, +2 per swap */
+                std::atomic<size_t> presentStale;   /**< UIDs erased since the rebuild started, still set in the filter */
+                size_t presentLimit;                /**< presentStale that starts a rebuild */
+        };
+    }
+}
@@ -0,0 +1,244 @@
+/**
+* \file CRH_SharedRegistry.h
+* \brief Multi-process shared-memory registry
+* \details Component registry kept in one shared-memory segment so every crunchy process on a host
+*          shares a single table. The layout only uses offsets, so each process may map it anywhere.
+* \author Corbin Matschull
+* \version 1
+* \date Oct 19. 2026
+* \pre Make sure you have GNU GCC or LLVM to compile, BSD won't compile.
+* \throws CANNOT_MAP_BLOCK_EXCEPTION
+*/
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#include "CRH_Exception.h"
+
+namespace crunchy
+{
+    /// \brief Shared-memory registry
+    namespace shm
+    {
+        #   define  SHM_REGISTRY_NAME     "/crunchy_registry" /**< Default segment name */
+        #   define  SHM_REGISTRY_MAGIC    0x53484D52UL        /**< "SHMR" */
+        #   define  SHM_REGISTRY_VERSION  3
+        #   define  SHM_DEFAULT_CAPACITY  (1UL << 20)         /**< Default slot count, keep the load under 3/4 */
+        #   define  SHM_DEFAULT_ARENA     (32UL << 20)        /**< Default name arena size */
+        #   define  SHM_MAX_LEASES        1024                /**< Processes that can be attached at once */
+        #   define  SHM_CLAIM_STRIPES     64                  /**< Locks serializing new entries of the same UID */
+        #   define  SHM_NAME_CLASSES      24                  /**< Name block sizes, 8 bytes to 64 MB in powers of two */
+
+        #   define  SHM_EMPTY_UID         0ULL                /**< Reserved, marks a never used slot */
+        #   define  SHM_TOMBSTONE_UID     0xFFFFFFFFFFFFFFFFULL /**< Reserved, marks an erased slot */
+
+
+        // ===============================
+        // -------------------------------
+        //      SEGMENT LAYOUT
+
+        /**
+         * \brief Segment header, always at offset 0.
+         *
+         * \param init - 0 until the segment is laid out, then ready. Only written under the init lock
+         * \param capacity - Number of slots
+         * \param arena_size - Size of the name arena in bytes
+         * \param leases_offset - Offset of the #SHM_MAX_LEASES process leases from the segment start
+         * \param slots_offset - Offset of the slot table from the segment start
+         * \param arena_offset - Offset of the name arena from the segment start
+         * \param count - Number of live entries
+         * \param tombstones - Erased slots since the last compaction, approximate
+         * \param arena_used - Bytes of the arena handed out as name blocks
+         * \param moving - Lock word, odd while a compaction moves entries; a lookup that missed meanwhile looks again
+         * \param claim - Lock words taken while a new entry claims a slot, picked by UID hash
+         * \param name_free - Free name blocks per size class, (tag << 32) | (offset + 1) of the first block
+         */
+        typedef struct shm_header
+        {
+            uint32_t magic;
+            uint32_t version;
+            std::atomic<uint64_t> init;
+            uint32_t capacity;
+            uint32_t arena_size;
+            uint64_t leases_offset;
+            uint64_t slots_offset;
+            uint64_t arena_offset;
+            std::atomic<uint32_t> count;
+            std::atomic<uint32_t> tombstones;
+            std::atomic<uint32_t> arena_used;
+            uint32_t reserved;
+            std::atomic<uint64_t> moving;
+            std::atomic<uint64_t> claim[SHM_CLAIM_STRIPES];
+            std::atomic<uint64_t> name_free[SHM_NAME_CLASSES];
+        } shm_header_t;
+
+
+        /**
+         * \brief Lease of one attached process.
+         *        On POSIX the lease is a byte-range lock on the segment held for as long as the process
+         *        is attached, the kernel drops it when the process dies in any PID namespace.
+         *        On Windows the holder pid and start time are checked instead.
+         *
+         * \param gen - Bumped each time the lease is claimed, stale owner tokens stop matching
+         * \param holder - Holder pid while claimed, 0 when free. On Windows (start token << 32) | pid
+         */
+        typedef struct shm_lease
+        {
+            std::atomic<uint32_t> gen;
+            uint32_t reserved;
+            std::atomic<uint64_t> holder;
+        } shm_lease_t;
+
+
+        /**
+         * \brief One slot of the open-addressed table.
+         *        Fields are written under the slot seqlock, readers retry on an odd or changed sequence.
+         *
+         * \param lock - (writer owner token << 32) | sequence, the sequence is odd while a write is in progress
+         * \param uid - Component UID, #SHM_EMPTY_UID or #SHM_TOMBSTONE_UID
+         * \param name_off - Offset of the name block in the arena
+         * \param name_len - Length of the name
+         * \param promise_key - Promise key of the component
+         * \param flags - Registry flags
+         * \param owner_pid - Process that registered the component, for diagnostics
+         * \param owner - Owner token of that process, ((lease + 1) << 16) | lease generation
+         * \param counted - 1 once the entry is included in shm_header::count
+         */
+        typedef struct shm_slot
+        {
+            std::atomic<uint64_t> lock;
+            std::atomic<uint64_t> uid;
+            uint32_t name_off;
+            uint32_t name_len;
+            uint32_t promise_key;
+            uint32_t flags;
+            uint32_t owner_pid;
+            uint32_t owner;
+            uint32_t counted;
+            uint32_t reserved;
+        } shm_slot_t;
+
+
+        /**
+         * \brief Consistent copy of a slot, see shared_registry::find()
+         */
+        typedef struct shm_record
+        {
+            uint64_t uid;
+            uint32_t name_off;
+            uint32_t name_len;
+            uint32_t promise_key;
+            uint32_t flags;
+            uint32_t owner_pid;
+            uint32_t owner;
+        } shm_record_t;
+
+
+        /**
+         * \brief Handle on the shared registry segment of this host.
+         *        Lookups are lock-free apart from a per-slot seqlock held for a few stores, a new UID also
+         *        takes the claim lock of its stripe so two processes cannot register it twice.
+         *        Every attached process holds a lease, a writer or owner whose lease is gone is dead:
+         *        a slot it left locked is taken over and its half written entry dropped, its entries are
+         *        removed by reap_dead_owners(). A process that detaches counts as gone too.
+         *        Erased slots are reused by the next new entry on their probe path. Once they pass an eighth
+         *        of the table the eraser compacts it, shifting entries back so misses stay short under churn.
+         *        Name blocks are freed with their entry and reused by names of the same size class.
+         *        Without open file description locks (non-Linux POSIX) a process should attach once.
+         */
+        class shared_registry
+        {
+            public:
+                shared_registry();
+                ~shared_registry();
+
+                /**
+                 * \brief Maps the segment and claims a lease in it.
+                 *        Only the process that finds the segment blank under the init lock sizes and lays it out,
+                 *        every later process keeps the existing size and validates the header instead.
+                 *
+                 * \param name - Segment name
+                 * \param capacity - Slot count when creating
+                 * \param arenaBytes - Name arena size when creating
+                 * \return io_errc::bad_format for a foreign or damaged header, io_errc::out_of_range if every lease is taken
+                 */
+                std::error_code attach(
+                                       const char *name = SHM_REGISTRY_NAME,
+                                       uint32_t capacity = SHM_DEFAULT_CAPACITY,
+                                       uint32_t arenaBytes = SHM_DEFAULT_ARENA
+                                      );
+
+                /// \brief Drops the lease and unmaps the segment, it stays alive for the other processes
+                void detach();
+
+                /// \brief Removes the segment name, mapped processes keep their mapping
+                static bool unlink(const char *name = SHM_REGISTRY_NAME);
+
+                /**
+                 * \brief Registers a component, or updates it if the UID is already registered.
+                 *
+                 * \return Slot index, io_errc::out_of_range if the table or the arena is full or the name is over 64 MB
+                 */
+                IOexception::io_result<uint32_t> insert(uint64_t uid, const std::string &name, uint32_t promise_key, uint32_t flags);
+
+                /**
+                 * \brief Copies a registered component out.
+                 *
+                 * \return FALSE if the UID is not registered
+                 */
+                bool find(uint64_t uid, shm_record_t *out);
+
+                /// \brief Name of a record, points into the segment and is not NUL terminated.
+                ///        The bytes are only stable until the entry is erased or renamed
+                const char *name(const shm_record_t &rec) const;
+
+                /// \brief Deregisters a component, FALSE if it was not registered
+                bool erase(uint64_t uid);
+
+                /// \brief Removes every entry whose owner process is gone, returns the number removed
+                size_t reap_dead_owners();
+
+                /// \brief Number of live entries
+                uint32_t size() const { return hdr ? hdr->count.load(std::memory_order_relaxed) : 0; }
+
+                uint32_t capacity() const { return hdr ? hdr->capacity : 0; }
+
+                /// \brief Owner token of this handle, 0 while detached
+                uint32_t owner_token() const { return token; }
+
+            private:
+                bool claim_lease();
+                void release_lease();
+                bool owner_alive(uint32_t owner) const;
+
+                bool lock_word(std::atomic<uint64_t> &w, uint64_t *seq);
+                bool try_lock_word(std::atomic<uint64_t> &w, uint64_t *seq);
+                void unlock_word(std::atomic<uint64_t> &w, uint64_t seq);
+
+                void lock_slot(shm_slot_t &s, uint64_t *seq);
+                bool read_slot(shm_slot_t &s, shm_record_t *out);
+                void drop_entry(shm_slot_t &s, bool reclaim);
+                uint64_t moves_settled();
+                bool moves_unchanged(uint64_t m) const;
+                void maybe_compact();
+                void compact();
+                std::error_code write_entry(shm_slot_t &s, bool fresh, const std::string &name, uint32_t promise_key, uint32_t flags);
+
+                bool alloc_name(size_t len, uint32_t *off);
+                void free_name(uint32_t off, uint32_t len);
+
+                shm_lease_t *leases() const { return (shm_lease_t *)(base + hdr->leases_offset); }
+                shm_slot_t *slots() const { return (shm_slot_t *)(base + hdr->slots_offset); }
+
+                unsigned char *base;
+                shm_header_t *hdr;
+                size_t mapped;
+                intptr_t handle; /**< Segment fd on POSIX, kept open for the lease lock, mapping handle on Windows */
+                uint32_t self;
+                uint32_t lease;  /**< Lease index of this handle */
+                uint32_t token;  /**< Owner token of this handle, ((lease + 1) << 16) | generation */
+        };
+    }
+}
@@ -10,16 +10,19 @@
  * \throws Out of Range Exception
  */
 #pragma once
-#include <Windows.h>
 #include <iostream>
 #include <array>
 
+#include "CRH_WinTypes.h"
+#include "CRH_EnvProfile.h"
+#include "CRH_Async.h"
+
 
 namespace crunchy
 {
 
 template <typename T, unsigned S>
-inline unsigned arraysize(const T(&v)[S]) { return S; }
+inline unsigned arraysize(const T(&)[S]) { return S; }
 
 
 #   define  DEFAULT_GENERATED_UID 1UL
@@ -76,10 +79,16 @@ struct pseudo
 
     /**
      * \brief This is used for creating signatures to verify objects, components and file against a master server.
+     *
+     * \param Env - Environment profile, see env_profile. PRUIDs and keys take the profile widths.
      */
-    class Signatures
+    template<class Env = default_env>
+    class basic_signatures
     {
         public:
+            typedef typename Env::pruid_t pruid_t; /**< PRUID width of the profile */
+            typedef typename Env::key_t   key_t;   /**< Key width of the profile */
+
             // ===============================
             // -------------------------------
             //      Signature Constructs
@@ -90,14 +99,14 @@ struct pseudo
              * \param nilset - Access shell environment flags
              * \param _SHELL_PROC - Shell process command
              */
-            Signatures(nset_t *nilset, int _SHELL_PROC);
+            basic_signatures(nset_t *nilset, int _SHELL_PROC);
 
 
             /**
              * \brief Deconstructor
              * \brief Deletes all signatures upon call
              */
-            virtual ~Signatures();
+            virtual ~basic_signatures();
 
 
             // ===================================
@@ -108,12 +117,26 @@ struct pseudo
             /**
              * \param ta - Time Alive ~ How long to keep the process alive
              * \param PSEUDO_UID - Default UID assigned to the process
-             *                     You can reassign to a different UID, make sure you define it as NUM=UL
-             *                     Have "Unsigned Long" assigned!
+             *                     You can reassign to a different UID, it is truncated to the profile PRUID width
              *
              * \return Nothing
              */
-            _PSEUDO_SIGN runproc(float ta, static int PSEUDO_UID = 1UL);
+            _PSEUDO_SIGN runproc(float ta, pruid_t PSEUDO_UID = (pruid_t)DEFAULT_GENERATED_UID);
+
+
+            /**
+             * \brief runproc() without blocking the caller, co_await it or use then().
+             * \brief The call runs on async::blocking_pool() and completes on resumeOn.
+             *
+             * \param resumeOn - Executor to complete on, usually the caller's async::reactor
+             *
+             * \return Awaitable
+             */
+            async::async_op<void> runproc_async(async::executor &resumeOn, float ta, pruid_t PSEUDO_UID = (pruid_t)DEFAULT_GENERATED_UID)
+            {
+                basic_signatures *self = this;
+                return async::async_op<void>(resumeOn, [=]() { self->runproc(ta, PSEUDO_UID); });
+            }
 
 
             /**
@@ -122,7 +145,7 @@ struct pseudo
              *
              * \return Nothing
              */
-            _PSEUDO_SIGN deleteproc(float TLA,static int PSEUDO_UID = 1UL) _SHELL_ENV_HAS_NO_PROCESS;
+            _PSEUDO_SIGN deleteproc(float TLA, pruid_t PSEUDO_UID = (pruid_t)DEFAULT_GENERATED_UID) _SHELL_ENV_HAS_NO_PROCESS;
 
 
             /**
@@ -130,31 +153,19 @@ struct pseudo
              *
              * \param idt - inline decrement type
              */
-            void *create_self_signature(static long idt);
+            void *create_self_signature(key_t idt);
     };
 
+    /// \brief Signatures for the profile selected by #CRUNCHY_ENV_PROFILE
+    typedef basic_signatures<> Signatures;
+
 
     /**
      * \brief Creates explicit signature for piping methods
      *
-     * \param default_id - default generated id
+     * \param default_id - default generated id, 0 for #DEFAULT_GENERATED_UID
      *
      * \return nset_t
      */
-    nset_t create_explicit_signature(static unsigned long default_id)
-    {
-        int buf = 255;
-        bool done;
-
-        printf("ASSIGNING EXPLICIT ID TO COMPONENT...");
-
-        if (default_id <= 0) {
-            default_id = DEFAULT_GENERATED_UID;
-        }
-        else {
-            while (!done) {
-                printf("Trying to assign signature to component");
-            }
-        }
-    }
+    nset_t create_explicit_signature(unsigned long default_id);
 }
@@ -0,0 +1,329 @@
+/**
+* \file CRH_Snapshot.h
+* \brief CRN instance snapshots
+* \details Versioned binary snapshot of the CRN instance, the register table and the page table.
+*          A restarted process maps the snapshot and serves from it straight away, sections are
+*          only checked when first touched.
+* \author Corbin Matschull
+* \version 1
+* \date Oct 19. 2026
+* \pre Make sure you have GNU GCC or LLVM to compile, BSD won't compile.
+* \throws BAD_FORMAT_EXCEPTION
+*/
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CRH_Exception.h"
+#include "CRH_Intern.h"
+#include "CRH_EnvProfile.h"
+#include "CRH_MappedFile.h"
+
+namespace crunchy
+{
+    /// \brief CRN instance snapshots
+    namespace snapshot
+    {
+        #   define  CRN_SNAPSHOT_MAGIC   0x534E5243UL /**< "CRNS" */
+        #   define  CRN_SNAPSHOT_VERSION 2           /**< Bump on any change to the snap_* layouts or their order */
+        #   define  CRN_SNAPSHOT_PATH    ".crnsnap"  /**< Default snapshot file, relative to the working directory */
+
+
+        /// \brief Sections of a snapshot, in file order
+        enum snapshot_section
+        {
+            SNAP_CRN = 0,
+            SNAP_REGISTER,
+            SNAP_PAGES,
+            SNAP_STRINGS,
+            SNAP_SECTIONS
+        };
+
+
+        // ===============================
+        // -------------------------------
+        //      ON-DISK LAYOUT
+
+        /**
+         * \brief File header, the section table follows right after it.
+         *
+         * \param magic - #CRN_SNAPSHOT_MAGIC
+         * \param version - #CRN_SNAPSHOT_VERSION
+         * \param env_size - env_size of the profile that wrote the snapshot
+         * \param sections - Number of entries in the section table, #SNAP_SECTIONS
+         * \param file_size - Total size of the snapshot
+         * \param table_crc - CRC32 of the section table
+         */
+        typedef struct snap_header
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t env_size;
+            uint32_t sections;
+            uint64_t file_size;
+            uint32_t table_crc;
+            uint32_t reserved;
+        } snap_header_t;
+
+
+        /**
+         * \brief Section table entry.
+         *
+         * \param entry_size - Size of one entry, must match the reader's struct
+         * \param offset - Offset of the section from the start of the file, 8 byte aligned
+         * \param count - Number of entries
+         * \param crc - CRC32 of the section, checked on first access
+         */
+        typedef struct snap_section
+        {
+            uint32_t entry_size;
+            uint32_t crc;
+            uint64_t offset;
+            uint64_t count;
+        } snap_section_t;
+
+
+        /// \brief String stored in the #SNAP_STRINGS section
+        typedef struct snap_string
+        {
+            uint32_t offset;
+            uint32_t length;
+        } snap_string_t;
+
+
+        /// \brief #SNAP_CRN entry, there is exactly one
+        typedef struct snap_crn
+        {
+            uint32_t default_crn;
+            snap_string_t stdCRN;
+        } snap_crn_t;
+
+
+        /// \brief #SNAP_REGISTER entry, the section is sorted by uid
+        typedef struct snap_register
+        {
+            uint64_t uid;
+            snap_string_t name;
+            uint32_t promise_key;
+            uint32_t flags;
+        } snap_register_t;
+
+
+        /// \brief #SNAP_PAGES entry, the section is sorted by signableID
+        typedef struct snap_page
+        {
+            uint32_t signableID;
+            snap_string_t virtualUID;
+        } snap_page_t;
+
+
+        // ===============================
+        // -------------------------------
+        //      LIVE STATE
+
+        /**
+         * \brief One registered component.
+         *
+         * \param uid - Component UID
+         * \param name - Registry name
+         * \param promise_key - Key of the last promise, see promise::promise_key()
+         * \param flags - Registry flags
+         */
+        typedef struct register_entry
+        {
+            uint64_t uid;
+            intern::istring name;
+            uint32_t promise_key;
+            uint32_t flags;
+        } register_entry_t;
+
+
+        /// \brief One page table entry, the snapshotable part of pgs_t
+        typedef struct page_entry
+        {
+            uint32_t signableID;
+            intern::istring virtualUID;
+        } page_entry_t;
+
+
+        /**
+         * \brief Everything a process would otherwise rebuild on start.
+         *
+         * \param default_crn - crn::current.default_crn, filled in by createCRNData()
+         * \param stdCRN - crn::stdCRN, filled in by createCRNData()
+         * \param registers - Register table, filled by the attached sources
+         * \param pages - Page table, filled by the attached sources
+         */
+        typedef struct crn_instance
+        {
+            uint16_t default_crn;
+            std::string stdCRN;
+            std::vector<register_entry_t> registers;
+            std::vector<page_entry_t> pages;
+        } crn_instance_t;
+
+
+        /**
+         * \brief Live state that goes into a snapshot, e.g. a shard::sharded_register or the page_table.
+         */
+        class snapshot_source
+        {
+            public:
+                virtual ~snapshot_source() {}
+
+                /**
+                 * \brief Appends a consistent copy of its entries to inst.
+                 *
+                 * \return First error hit, inst keeps what was appended before it
+                 */
+                virtual std::error_code collect(crn_instance_t &inst) = 0;
+        };
+
+
+        /// \brief Adds a source to every later capture(), not owned
+        void attach(snapshot_source *src);
+
+        /// \brief Removes a source, call before it is destroyed
+        void detach(snapshot_source *src);
+
+        /**
+         * \brief Appends the tables of every attached source to inst, the CRN values are left as they are.
+         *
+         * \return First source error, the other sources are still collected
+         */
+        std::error_code capture(crn_instance_t &inst);
+
+
+        /**
+         * \brief Process page table, the snapshotable part of every live pgs_t keyed by signableID.
+         */
+        class page_table : public snapshot_source
+        {
+            public:
+                /// \brief Adds or replaces the page of signableID
+                void set(uint32_t signableID, const intern::istring &virtualUID);
+
+                /// \brief FALSE if signableID has no page
+                bool erase(uint32_t signableID);
+
+                /// \brief Copies a page out, FALSE if signableID has no page
+                bool find(uint32_t signableID, page_entry_t *out);
+
+                size_t size();
+
+                std::error_code collect(crn_instance_t &inst);
+
+            private:
+                std::unordered_map<uint32_t, intern::istring> table;
+                std::mutex lock;
+        };
+
+
+        /// \brief Process wide page table, attached on first use
+        page_table &pages();
+
+
+        /**
+         * \brief Writes a snapshot, through a temp file and a rename so readers never see half a file.
+         *        The temp file is flushed to disk before the rename, a crash leaves the old or the new snapshot.
+         *        Registers are written sorted by uid and pages by signableID, see snapshot_view::find_register().
+         *
+         * \param inst - State to save
+         * \param path - Snapshot file
+         *
+         * \return Bytes written
+         */
+        IOexception::io_result<uint64_t> save(const crn_instance_t &inst, const std::string &path = CRN_SNAPSHOT_PATH);
+
+
+        /**
+         * \brief Mapped, read-only snapshot.
+         *        open() only checks the header and section table, so it costs the same for any
+         *        snapshot size. Each section is CRC checked the first time it is asked for.
+         */
+        class snapshot_view
+        {
+            public:
+                snapshot_view();
+                ~snapshot_view();
+
+                /**
+                 * \brief Maps a snapshot and checks its header.
+                 *
+                 * \return io_errc::cannot_open / cannot_map if it could not be mapped,
+                 *         io_errc::bad_format if it is not a snapshot of this version and profile
+                 */
+                std::error_code open(const std::string &path = CRN_SNAPSHOT_PATH);
+
+                /// \brief Unmaps the snapshot
+                void close();
+
+                bool is_open() const { return file.data != NULL; }
+
+                /// \brief Snapshot version, 0 if nothing is mapped
+                uint32_t version() const;
+
+                /**
+                 * \brief Entries of a section, checked on first access.
+                 *
+                 * \param id - Section
+                 * \param count - Set to the number of entries
+                 *
+                 * \return Entries, io_errc::bad_format if the section fails its check
+                 */
+                template<class T>
+                IOexception::io_result<const T *> entries(snapshot_section id, size_t *count)
+                {
+                    const void *p = section(id, sizeof(T), count);
+                    if (CRUNCHY_UNLIKELY(p == NULL)) {
+                        return IOexception::io_errc::bad_format;
+                    }
+                    return (const T *)p;
+                }
+
+                /**
+                 * \brief String of the #SNAP_STRINGS section, not NUL terminated.
+                 *
+                 * \return String data, NULL if the strings section fails its check or s is out of range
+                 */
+                const char *string(const snap_string_t &s);
+
+                /// \brief Interns a snapshot string, for moving entries back into live state.
+                ///        Not valid() if the string cannot be read or interned, see intern::intern()
+                intern::istring intern_string(const snap_string_t &s);
+
+                /**
+                 * \brief Looks a register up straight from the mapping, binary search over #SNAP_REGISTER.
+                 *
+                 * \param uid - Component UID
+                 * \param out - Set to the entry, its name interned
+                 *
+                 * \return TRUE if found, FALSE if not, if the section fails its check (io_errc::bad_format is set)
+                 *         or if the name cannot be interned (io_errc::out_of_range is set)
+                 */
+                bool find_register(uint64_t uid, register_entry_t *out);
+
+                /// \brief Looks a page up straight from the mapping, see find_register()
+                bool find_page(uint32_t signableID, page_entry_t *out);
+
+            private:
+                const void *section(snapshot_section id, size_t entrySize, size_t *count);
+
+                paging::mapped_file_t file;
+                std::atomic<uint8_t> checked[SNAP_SECTIONS]; /**< 0 unchecked, 1 good, 2 bad */
+        };
+
+
+        /// \brief Process wide snapshot mapped by hasCRNInstance()
+        snapshot_view &mapped();
+
+
+        /// \brief CRC32 (IEEE), slice-by-8
+        uint32_t crc32(const void *data, size_t len, uint32_t crc = 0);
+    }
+}
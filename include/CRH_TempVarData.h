@@ -9,9 +9,16 @@
 * \warning Make sure you run with admin/root privilages or this will fail
 * \throws Check your Privilage ExceptionS
 */
-#include <Windows.h>
-#include <minwindef.h>
+#pragma once
 #include <string>
+#include <vector>
+
+#include "CRH_WinTypes.h"
+#include "CRH_Runt.h"
+#include "CRH_Promise.h"
+#include "CRH_Intern.h"
+#include "CRH_EnvProfile.h"
+#include "CRH_Async.h"
 
 // =================================================== //
 // --------------------------------------------------- //
@@ -111,33 +118,19 @@ namespace crunchy
      * \brief Primary ms5 hashtable data memebers
      *
      * \param ms5_portablekey - Defines a public key that can be used for an ms5 hash
-     * \param ms5_usablename - Name assigned to ms5_portablekey
+     * \param ms5_usablename - Interned name assigned to ms5_portablekey
      */
     typedef struct ms5_hash
     {
         unsigned int ms5_portablekey;
-        std::string ms5_usablename;
+        intern::istring ms5_usablename;
     } ms5_hash_t;
 
 
     /**
-     * \brief Content keys for keeping content strings in handy containers.
-     *
-     * \param CONTENT_VOID - Sends key dump to the content trunk incase of void instances happening.
-     * \param KEY_PRNG - PRNG for the key dump
-     * \param PROMISE_KEY - Generates a promise key, use with Register::register_component()
-     * \param content_box - Key trunk
+     * \brief Content keys for the profile selected by #CRUNCHY_ENV_PROFILE, see basic_content_keys.
      */
-    typedef struct CONTENT_KEYS
-    {
-        ULONG CONTENT_VOID;
-        ULONG KEY_PRNG;
-
-        DWORD PROMISE_KEY;
-
-        // Keeps keys in storage box
-        DWORD64 content_box[64];
-    } CONTENT_KEYS, *_CONTENT_KEYS_P;
+    typedef basic_content_keys<default_env> CONTENT_KEYS, *_CONTENT_KEYS_P;
 
 
     /**
@@ -150,32 +143,76 @@ namespace crunchy
     {
         UNARY_TYPE hasNoUnary;
         UNARY_TYPE hasUnary;
-    } type_form_t;
+    };
+
+    /// \brief Shared type_form, defined in TempVarData.cpp
+    extern type_form type_form_t;
 
 /**
  * \brief Class for registering object components and putting them in a hashtable
+ *
+ * \param Env - Environment profile, see env_profile. Key sizes default to the profile key width.
  */
-class Register
+template<class Env = default_env>
+class basic_register
 {
     public:
 
+        typedef basic_content_keys<Env> content_keys; /**< Key container of the profile */
+        typedef typename Env::key_t key_t;            /**< Key width of the profile */
+        typedef uint32_t crc_t;                       /**< CRCs stay 32 bits in every profile */
+
         /**
          * \brief Main component registry function.
          *
          * \param registerSize - Default size of the registry file
          * \param registerName - Name of the default registery file
          */
-        Register(
-                 int registerSize,
-                 std::string registerName
-                )
+        basic_register(
+                       int registerSize,
+                       const std::string &registerName
+                      )
+                : registerSize(registerSize),
+                  registerName(registerName),
+                  promiseSlot(PROMISE_NO_SLOT)
+                {
+                }
+
+        /// @brief Deconstructor, hands the promise slot back to the heartbeat engine
+        virtual ~basic_register()
+        {
+            if (promiseSlot != PROMISE_NO_SLOT) {
+                promise::engine().release(promiseSlot);
+            }
+        }
+
+        /// @brief Not copyable, two registers would release the same promise slot
+        basic_register(const basic_register &) = delete;
+        basic_register &operator=(const basic_register &) = delete;
+
+        /// @brief Takes over the promise slot of other, which is left without one
+        basic_register(basic_register &&other)
+                : registerSize(other.registerSize),
+                  registerName(std::move(other.registerName)),
+                  promiseSlot(other.promiseSlot)
                 {
-                   registerSize = tmp_dt::max_tmp_size;
-                   registerName = tmp_dt::tmp_reg_str;
+                    other.promiseSlot = PROMISE_NO_SLOT;
                 }
 
-        /// @brief Deconstructor
-        virtual ~Register();
+        /// @brief Releases its own promise slot and takes over the one of other
+        basic_register &operator=(basic_register &&other)
+        {
+            if (this != &other) {
+                if (promiseSlot != PROMISE_NO_SLOT) {
+                    promise::engine().release(promiseSlot);
+                }
+                registerSize      = other.registerSize;
+                registerName      = std::move(other.registerName);
+                promiseSlot       = other.promiseSlot;
+                other.promiseSlot = PROMISE_NO_SLOT;
+            }
+            return *this;
+        }
 
 
         // ===================================
@@ -185,6 +222,7 @@ class Register
         /**
          * \brief This promises that the currently registered component will periodically report back to the server.
          * \brief This can prevent versioning or runtime mismatches.
+         * \brief Promises are batched by the shared heartbeat engine, see promise::engine()
          *
          * \param promise_me - Promise string (based upon command context)
          * \param hasStrictPromise - Uses strict promise set based upon sets in "Strict.h"
@@ -192,11 +230,27 @@ class Register
          *
          * \return this
          */
-        Register *promise(
-                          std::string promise_me,
+        basic_register *promise(
+                          const std::string &promise_me,
                           bool hasStrictPromise,
                           int objectsToPromise
-                         ){ return this; };
+                         )
+                         {
+                            promiseSlot = promise::engine().promise(promiseSlot,
+                                                                    promise::promise_key(promise_me),
+                                                                    hasStrictPromise,
+                                                                    objectsToPromise > 0 ? (uint32_t)objectsToPromise : 0);
+                            return this;
+                         }
+
+
+        /**
+         * \brief Reports back to the server for the current promise, cheap enough to call on every unit of work.
+         */
+        void keep_promise()
+        {
+            promise::engine().beat(promiseSlot);
+        }
 
 
 
@@ -207,13 +261,31 @@ class Register
         /**
          * \brief runt (Runtime. Unified. Node. Tester), this will test and parse components on a "block" basis
          * \brief This can help with performing tests on a file-to-file basis.
+         * \brief Files are split into blockSize blocks and tested on every core, see runt::run_blocks
          *
-         * \param tmpd - Reference accessor to tmp_dt_t<ln: 21>
-         * \param ... - Takes multiple parameters
+         * \param tmpd - Reference accessor to tmp_dt_t<ln: 21>, runt writes no temp data so it is only passed through
+         * \param blockSize - Block and map window size in bytes, #RUNT_BLOCK_SIZE unless the caller needs another,
+         *                    rounded up to the page granularity
+         * \param test - Block tester, must be safe to call from several threads
+         * \param paths - Component files to test
          *
-         * \return Nothing
+         * \return One result per block, in file/offset order
          */
-        void runt(tmp_dt* tmpd, ...);
+        template<class... Paths>
+        std::vector<runt::runt_result_t> runt(
+                                              tmp_dt* tmpd,
+                                              size_t blockSize,
+                                              const runt::runt_tester &test,
+                                              const Paths &... paths
+                                             )
+        {
+            std::vector<std::string> files;
+            files.reserve(sizeof...(Paths));
+            runt::pack_paths(files, paths...);
+            (void)tmpd;
+
+            return runt::run_blocks(files, test, blockSize);
+        }
 
 
 
@@ -227,7 +299,7 @@ class Register
          *                 FALSE if component doesn't and a UID will be assigned
          * \param hasSignedUID - TRUE if component has registered UID
          *                       FALSE if doesn't have a registered UID, will assign registered UID
-         * \param keySizeUID - Keysize for UID
+         * \param keySizeUID - Keysize for UID in bits, defaults to the profile key width
          *
          * \return TRUE if component successfully registered
          *         FALSE if component couldn't register
@@ -235,7 +307,7 @@ class Register
         BOOL register_component(
                                 bool hasUID,
                                 bool hasSignedUID,
-                                DWORD keySizeUID
+                                size_t keySizeUID = Env::key_bits
                                );
 
 
@@ -247,7 +319,7 @@ class Register
          * If any other components use #DEFAULT_GENERATED_UID it will deregister all of them.
          *
          * \param signedUID - has signed UID
-         * \param keyLen - Key length
+         * \param keyLen - Key length in bits, defaults to the profile key width
          * \param path - Grabs default tempfile path from global define
          *
          * \return TRUE if component successfully deregistered.
@@ -255,23 +327,86 @@ class Register
          */
         BOOL deregister_component(
                                   bool signedUID,
-                                  DWORD keyLen,
-                                  std::string path = TEMPVAR_PATH
+                                  size_t keyLen = Env::key_bits,
+                                  const std::string &path = TEMPVAR_PATH
                                  );
 
 
         /**
-         * \param crc_sign - CRC key
+         * \param crc_sign - CRC key, a full 32 bit CRC whatever the profile key width
          * \param crc_p - CRC paraform
          *
          * \return crc_sign
          */
-        DWORD check_temp_crc(
-                             DWORD crc_sign,
-                             std::string crc_p
+        crc_t check_temp_crc(
+                             crc_t crc_sign,
+                             const std::string &crc_p
                             );
+
+
+
+        // ===================================
+        // -----------------------------------
+        //      Async Component Registry
+
+        /**
+         * \brief register_component() without blocking the caller, co_await it or use then().
+         * \brief The call runs on async::blocking_pool() and completes on resumeOn.
+         *
+         * \param resumeOn - Executor to complete on, usually the caller's async::reactor
+         *
+         * \return Awaitable, see register_component()
+         */
+        async::async_op<BOOL> register_component_async(
+                                                       async::executor &resumeOn,
+                                                       bool hasUID,
+                                                       bool hasSignedUID,
+                                                       size_t keySizeUID = Env::key_bits
+                                                      )
+        {
+            basic_register *self = this;
+            return async::async_op<BOOL>(resumeOn, [=]() {
+                return self->register_component(hasUID, hasSignedUID, keySizeUID);
+            });
+        }
+
+
+        /**
+         * \brief check_temp_crc() without blocking the caller, see register_component_async()
+         *
+         * \return Awaitable, see check_temp_crc()
+         */
+        async::async_op<crc_t> check_temp_crc_async(
+                                                    async::executor &resumeOn,
+                                                    crc_t crc_sign,
+                                                    const std::string &crc_p
+                                                   )
+        {
+            basic_register *self = this;
+            return async::async_op<crc_t>(resumeOn, [=]() {
+                return self->check_temp_crc(crc_sign, crc_p);
+            });
+        }
+
+        /// \brief Default size of the registry file given to the constructor
+        int register_size() const { return registerSize; }
+
+        /// \brief Name of the default registry file given to the constructor
+        const std::string &register_name() const { return registerName; }
+
+        /// \brief Heartbeat engine slot, #PROMISE_NO_SLOT until promise() is called
+        uint32_t promise_slot() const { return promiseSlot; }
+
+    private:
+
+        int registerSize;         /**< Per register, never written into the tmp_dt globals */
+        std::string registerName; /**< Per register, never written into the tmp_dt globals */
+        uint32_t promiseSlot;     /**< Heartbeat engine slot, #PROMISE_NO_SLOT until promise() is called */
 };
 
+/// \brief Register for the profile selected by #CRUNCHY_ENV_PROFILE
+typedef basic_register<> Register;
+
 /**
  * \brief Holds EFLAG data to send to CRC checkers
  *
@@ -296,13 +431,16 @@ enum EFLAG_CRMP
  * Can use this for in cases of needed an UID under all costs
  *
  */
-static enum EFLAG_PAGE
+enum EFLAG_PAGE
 {
     PAGE_HAS_NO_FORM,
     PAGE_VOIDABLE_HAS_NO_UID,
     PAGE_WILL_DIE,
     PAGE_WILL_NEVER_DIE,
-} EFLAG_PAGE_T;
+};
+
+/// \brief Shared EFLAG_PAGE, defined in TempVarData.cpp
+extern EFLAG_PAGE EFLAG_PAGE_T;
 
 
 
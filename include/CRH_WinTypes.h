@@ -0,0 +1,29 @@
+/**
+* \file CRH_WinTypes.h
+* \brief Windows integer types
+* \details Pulls in <Windows.h> on Windows. Everywhere else it defines the few Windows types
+*          (BOOL, WORD, DWORD) the Register, Signatures and CRN headers are written against.
+* \author Corbin Matschull
+* \version 1
+* \date Oct 19. 2026
+* \pre Make sure you have GNU GCC or LLVM to compile, BSD won't compile.
+*/
+#pragma once
+
+#if defined(_WIN32) | defined(WIN32)
+#include <Windows.h>
+#include <minwindef.h>
+#else
+#include <stdint.h>
+
+typedef int      BOOL;  /**< Win32 BOOL, TRUE or FALSE */
+typedef uint16_t WORD;  /**< Win32 WORD, 16 bits */
+typedef uint32_t DWORD; /**< Win32 DWORD, 32 bits on every Windows ABI */
+
+#if !defined(TRUE)
+#   define  TRUE  1
+#endif
+#if !defined(FALSE)
+#   define  FALSE 0
+#endif
+#endif
@@ -0,0 +1,267 @@
+// AsyncTest.cpp : Reactor posts, fd watches and stop, thread pool shutdown and async_op round trips.
+//
+
+#include "Test.h"
+#include "../include/CRH_Async.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace crunchy;
+
+#if defined(CRUNCHY_EXPECT_COROUTINES)
+static_assert(CRUNCHY_HAS_COROUTINES, "CRUNCHY_CXX20 builds must compile the co_await paths");
+#endif
+
+namespace
+{
+    /// \brief Task argument recording the order tasks ran in
+    typedef struct step
+    {
+        std::vector<int> *ran;
+        int id;
+    } step_t;
+
+    void record(void *p)
+    {
+        step_t *s = (step_t *)p;
+        s->ran->push_back(s->id);
+    }
+
+    void count(void *p)
+    {
+        ((std::atomic<int> *)p)->fetch_add(1);
+    }
+
+
+    void posts_run_in_order_on_drain()
+    {
+        async::reactor loop;
+        REQUIRE(!loop.status());
+
+        std::vector<int> ran;
+        step_t steps[3] = { { &ran, 1 }, { &ran, 2 }, { &ran, 3 } };
+        for (int i = 0; i < 3; ++i) {
+            loop.post(&record, &steps[i]);
+        }
+        CHECK(ran.empty());
+
+        CHECK(loop.run_once(0) == 3);
+        REQUIRE(ran.size() == 3);
+        CHECK(ran[0] == 1 && ran[1] == 2 && ran[2] == 3);
+        CHECK(loop.run_once(0) == 0);
+
+        // A post from another thread wakes a loop waiting without a limit
+        std::atomic<int> hits(0);
+        std::thread poster([&loop, &hits]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            loop.post(&count, &hits);
+        });
+        CHECK(loop.run_once(-1) == 1);
+        poster.join();
+        CHECK(hits == 1);
+    }
+
+
+    /// \brief Counts completions of one fd_waiter and keeps the last ready events
+    typedef struct pipe_watch
+    {
+        int calls;
+        uint32_t events;
+        async::fd_waiter_t waiter;
+    } pipe_watch_t;
+
+    void on_ready(void *p)
+    {
+        pipe_watch_t *w = (pipe_watch_t *)p;
+        ++w->calls;
+        w->events = w->waiter.events;
+    }
+
+
+    void watch_rearms_on_a_pipe()
+    {
+        async::reactor loop;
+        int fds[2];
+        REQUIRE(pipe(fds) == 0);
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+        pipe_watch_t w = {};
+        w.waiter.fn  = &on_ready;
+        w.waiter.arg = &w;
+
+        REQUIRE(!loop.watch(fds[0], ASYNC_READABLE, &w.waiter));
+        CHECK(loop.run_once(0) == 0);
+
+        char byte = 'x';
+        REQUIRE(write(fds[1], &byte, 1) == 1);
+        CHECK(loop.run_once(1000) == 1);
+        CHECK(w.calls == 1);
+        CHECK(w.events == ASYNC_READABLE);
+
+        // One shot, still readable but not reported again until re-armed
+        CHECK(loop.run_once(0) == 0);
+        CHECK(w.calls == 1);
+
+        REQUIRE(read(fds[0], &byte, 1) == 1);
+        REQUIRE(!loop.watch(fds[0], ASYNC_READABLE, &w.waiter));
+        CHECK(loop.run_once(0) == 0);
+        REQUIRE(write(fds[1], &byte, 1) == 1);
+        CHECK(loop.run_once(1000) == 1);
+        CHECK(w.calls == 2);
+
+        // The writer going away is reported as a hangup
+        REQUIRE(read(fds[0], &byte, 1) == 1);
+        REQUIRE(!loop.watch(fds[0], ASYNC_READABLE, &w.waiter));
+        close(fds[1]);
+        CHECK(loop.run_once(1000) == 1);
+        CHECK(w.calls == 3);
+        CHECK(w.events & ASYNC_HANGUP);
+
+        loop.unwatch(fds[0]);
+        close(fds[0]);
+    }
+
+
+    void stop_ends_run_and_run_restarts()
+    {
+        async::reactor loop;
+        std::atomic<int> hits(0);
+
+        for (int round = 0; round < 2; ++round) {
+            std::thread runner([&loop]() { loop.run(); });
+            for (int i = 0; i < 100; ++i) {
+                loop.post(&count, &hits);
+            }
+            loop.stop();
+            runner.join();
+        }
+
+        // Posts queued before stop() may run on the next run, none are lost
+        while (loop.run_once(0) != 0) {
+        }
+        CHECK(hits == 200);
+    }
+
+
+    void pool_runs_the_queue_before_shutdown()
+    {
+        std::atomic<int> hits(0);
+        {
+            async::thread_pool pool(2);
+            CHECK(pool.size() == 2);
+
+            for (int i = 0; i < 100; ++i) {
+                pool.post(&count, &hits);
+            }
+            pool.stop();
+            CHECK(hits == 100);
+
+            // Nothing left to run it, so it runs on the posting thread
+            pool.post(&count, &hits);
+            CHECK(hits == 101);
+            pool.stop();
+        }
+        CHECK(hits == 101);
+    }
+
+
+    void op_completes_on_the_reactor()
+    {
+        async::reactor loop;
+        std::thread::id loopThread = std::this_thread::get_id();
+
+        int got = 0;
+        std::thread::id workedOn, completedOn;
+        async::async_op<int>(loop, [&workedOn]() {
+            workedOn = std::this_thread::get_id();
+            return 42;
+        }).then([&](async::async_op<int> &op) {
+            completedOn = std::this_thread::get_id();
+            got = op.get();
+            loop.stop();
+        });
+        loop.run();
+
+        CHECK(got == 42);
+        CHECK(workedOn != loopThread);
+        CHECK(completedOn == loopThread);
+
+        // Exceptions come back through get()
+        bool rethrown = false;
+        async::async_op<void>(loop, []() {
+            throw std::runtime_error("blocking call failed");
+        }).then([&](async::async_op<void> &op) {
+            try {
+                op.get();
+            }
+            catch (const std::runtime_error &) {
+                rethrown = true;
+            }
+            loop.stop();
+        });
+        loop.run();
+        CHECK(rethrown);
+    }
+
+
+#if CRUNCHY_HAS_COROUTINES
+    /// \brief Awaits a blocking call and then a pipe through the reactor, then stops it
+    async::detached await_round_trip(async::reactor &loop, int fd, int *got, uint32_t *events,
+                                     std::thread::id *resumedOn)
+    {
+        *got = co_await async::async_op<int>(loop, []() { return 7; });
+        *resumedOn = std::this_thread::get_id();
+
+        async::reactor::fd_wait ready = loop.readable(fd);
+        std::error_code e = co_await ready;
+        *events = e ? 0 : ready.waiter.events;
+
+        loop.unwatch(fd);
+        loop.stop();
+    }
+
+
+    void coroutine_resumes_on_the_reactor()
+    {
+        async::reactor loop;
+        int fds[2];
+        REQUIRE(pipe(fds) == 0);
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+        int got = 0;
+        uint32_t events = 0;
+        std::thread::id resumedOn;
+        await_round_trip(loop, fds[0], &got, &events, &resumedOn);
+
+        char byte = 'x';
+        REQUIRE(write(fds[1], &byte, 1) == 1);
+        loop.run();
+
+        CHECK(got == 7);
+        CHECK(resumedOn == std::this_thread::get_id());
+        CHECK(events == ASYNC_READABLE);
+
+        close(fds[0]);
+        close(fds[1]);
+    }
+#endif
+}
+
+
+int main()
+{
+    posts_run_in_order_on_drain();
+    watch_rearms_on_a_pipe();
+    stop_ends_run_and_run_restarts();
+    pool_runs_the_queue_before_shutdown();
+    op_completes_on_the_reactor();
+#if CRUNCHY_HAS_COROUTINES
+    coroutine_resumes_on_the_reactor();
+#endif
+    return crunchy::test::result("async");
+}
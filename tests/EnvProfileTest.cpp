@@ -0,0 +1,94 @@
+// EnvProfileTest.cpp : Widths of every ENV_DATA profile and the Register, Signatures and key containers built on them.
+//
+
+#include "Test.h"
+#include "../include/CRH_EnvProfile.h"
+#include "../include/CRH_Signatures.h"
+#include "../include/CRH_TempVarData.h"
+#include <limits>
+#include <type_traits>
+
+using namespace crunchy;
+
+namespace
+{
+    typedef env_profile<UNIX_Portable::ENV_DATA::env16_t> env16;
+    typedef env_profile<UNIX_Portable::ENV_DATA::env32_t> env32;
+    typedef env_profile<UNIX_Portable::ENV_DATA::env64_t> env64;
+
+
+    /// \brief Everything here is checked at compile time, the profile must not cost anything at runtime
+    template<class Env, env_size Size, unsigned KeyBits, unsigned PruidBits, unsigned BoxBits, unsigned BoxSize>
+    void profile_matches()
+    {
+        static_assert(Env::size == Size, "profile row");
+        static_assert(Env::key_bits == KeyBits && sizeof(typename Env::key_t) * 8 == KeyBits, "key width");
+        static_assert(Env::pruid_bits == PruidBits && sizeof(typename Env::pruid_t) * 8 == PruidBits, "PRUID width");
+        static_assert(Env::box_bits == BoxBits && sizeof(typename Env::box_t) * 8 == BoxBits, "box width");
+        static_assert(Env::box_size == BoxSize, "box slots");
+        static_assert(std::is_unsigned<typename Env::key_t>::value, "keys are unsigned");
+
+        // Key containers take whole key words
+        static_assert(sizeof(basic_content_keys<Env>) >= 3 * sizeof(typename Env::key_t) + BoxSize * sizeof(typename Env::box_t),
+                      "content keys hold three keys and a full box");
+        static_assert(sizeof(basic_prp_keys<Env>) == (128 + 512 + 1024) / 8, "PRP keys hold exactly their bits");
+        static_assert(Env::key_words(128) * KeyBits == 128, "128 bits in whole words");
+
+        // Signatures and Register take the profile widths, sizes and CRCs do not
+        static_assert(std::is_same<typename basic_signatures<Env>::pruid_t, typename Env::pruid_t>::value, "Signatures PRUID");
+        static_assert(std::is_same<typename basic_signatures<Env>::key_t, typename Env::key_t>::value, "Signatures key");
+        static_assert(std::is_same<typename basic_register<Env>::key_t, typename Env::key_t>::value, "Register key");
+        static_assert(std::is_same<typename basic_register<Env>::crc_t, uint32_t>::value, "CRCs are 32 bits");
+        static_assert(std::is_same<decltype(std::declval<basic_register<Env> &>().check_temp_crc(0, std::string())), uint32_t>::value,
+                      "check_temp_crc keeps the full CRC");
+
+        // Used at runtime too, odr-uses the constexpr members
+        const unsigned &bits = Env::key_bits;
+        CHECK(bits == KeyBits);
+
+        basic_content_keys<Env> keys = {};
+        keys.PROMISE_KEY = (typename Env::key_t)~0ULL;
+        CHECK(keys.PROMISE_KEY == std::numeric_limits<typename Env::key_t>::max());
+        CHECK(std::numeric_limits<typename Env::key_t>::digits == (int)KeyBits);
+        CHECK(arraysize(keys.content_box) == BoxSize);
+
+        basic_prp_keys<Env> prp = {};
+        CHECK(arraysize(prp.prp1024) == 1024 / KeyBits);
+
+        basic_register<Env> reg(128, "env_profile_test");
+        CHECK(reg.register_size() == 128);
+        CHECK(reg.register_name() == "env_profile_test");
+        CHECK(reg.promise_slot() == PROMISE_NO_SLOT);
+    }
+
+
+    void every_profile_builds()
+    {
+        profile_matches<env16, ENV_SIZE_16, 16, 16, 16, 8>();
+        profile_matches<env32, ENV_SIZE_32, 32, 32, 64, 64>();
+        profile_matches<env64, ENV_SIZE_64, 64, 64, 64, 256>();
+    }
+
+
+    void default_profile_is_env32()
+    {
+        static_assert(std::is_same<default_env, env32>::value, "CRUNCHY_ENV_PROFILE defaults to env32_t");
+        static_assert(std::is_same<Register, basic_register<env32> >::value, "Register is the default profile");
+        static_assert(std::is_same<Signatures, basic_signatures<env32> >::value, "Signatures is the default profile");
+        static_assert(sizeof(CONTENT_KEYS) == sizeof(basic_content_keys<env32>), "CONTENT_KEYS is the default profile");
+
+        // A 16 bit key cannot hold a CRC, the Register signature must not narrow it
+        uint32_t crc = 0xDEADBEEFUL;
+        basic_register<env16>::crc_t passed = crc;
+        CHECK(passed == crc);
+        CHECK((env16::key_t)crc != crc);
+    }
+}
+
+
+int main()
+{
+    every_profile_builds();
+    default_profile_is_env32();
+    return crunchy::test::result("env profile");
+}
@@ -0,0 +1,137 @@
+// ExceptionTest.cpp : io_errc category and texts, io_result access, per-thread last error and raise().
+//
+
+#include "Test.h"
+#include "../include/CRH_Exception.h"
+#include <string.h>
+#include <string>
+#include <thread>
+
+using namespace crunchy;
+using IOexception::io_errc;
+
+namespace
+{
+    const io_errc ALL_ERRORS[] =
+    {
+        io_errc::cannot_open,
+        io_errc::cannot_map,
+        io_errc::cannot_bind_socket,
+        io_errc::short_write,
+        io_errc::out_of_range,
+        io_errc::not_registered,
+        io_errc::still_active,
+        io_errc::bad_format
+    };
+
+
+    void category_maps_every_code()
+    {
+        const std::error_category &cat = IOexception::io_category();
+        CHECK(strcmp(cat.name(), "crunchy.io") == 0);
+        CHECK(&cat == &IOexception::io_category());
+
+        for (size_t i = 0; i < sizeof(ALL_ERRORS) / sizeof(ALL_ERRORS[0]); ++i) {
+            std::error_code ec = ALL_ERRORS[i];
+            CHECK(ec);
+            CHECK(&ec.category() == &cat);
+            CHECK(ec.value() == (int)ALL_ERRORS[i]);
+            CHECK(ec == ALL_ERRORS[i]);
+            CHECK(ec.message() == IOexception::describe(ALL_ERRORS[i]));
+
+            // Every code has its own text
+            for (size_t j = 0; j < i; ++j) {
+                CHECK(strcmp(IOexception::describe(ALL_ERRORS[i]), IOexception::describe(ALL_ERRORS[j])) != 0);
+            }
+        }
+
+        std::error_code none = io_errc::ok;
+        CHECK(!none);
+        CHECK(strcmp(IOexception::describe(io_errc::ok), "OK") == 0);
+        CHECK(strcmp(IOexception::describe(io_errc::out_of_range), "Out of Range Exception") == 0);
+        CHECK(strcmp(IOexception::describe((io_errc)0x7777), "UNDEFINED_ERROR_EXCEPTION") == 0);
+
+        // Not the same code as the generic category's value
+        CHECK(std::error_code(io_errc::cannot_open) != std::error_code((int)io_errc::cannot_open, std::generic_category()));
+    }
+
+
+    void result_holds_value_or_error()
+    {
+        IOexception::io_result<std::string> good(std::string("value"));
+        CHECK(good.ok());
+        CHECK((bool)good);
+        CHECK(!good.error());
+        CHECK(*good == "value");
+        CHECK(good.value() == "value");
+        CHECK(good.value_or("fallback") == "value");
+        good.value() += "!";
+        CHECK(*good == "value!");
+
+        IOexception::io_result<std::string> bad(io_errc::bad_format);
+        CHECK(!bad.ok());
+        CHECK(!bad);
+        CHECK(bad.error() == io_errc::bad_format);
+        CHECK(bad.value().empty());
+        CHECK(bad.value_or("fallback") == "fallback");
+
+        IOexception::io_result<int> sys(std::make_error_code(std::errc::io_error));
+        CHECK(!sys);
+        CHECK(sys.error() == std::errc::io_error);
+        CHECK(sys.value_or(-1) == -1);
+    }
+
+
+    void last_error_is_per_thread()
+    {
+        CHECK(IOexception::set_error(io_errc::short_write) == io_errc::short_write);
+        CHECK(IOexception::last_error().error_code == (long)io_errc::short_write);
+        CHECK(strcmp(IOexception::last_error().exception_name, "SHORT_WRITE_EXCEPTION") == 0);
+
+        long seen = -1;
+        std::thread other([&seen]() {
+            seen = IOexception::last_error().error_code;
+            IOexception::set_error(io_errc::still_active);
+        });
+        other.join();
+
+        CHECK(seen == 0);
+        CHECK(IOexception::last_error().error_code == (long)io_errc::short_write);
+    }
+
+
+    void raise_throws_the_static_text()
+    {
+        bool caught = false;
+        try {
+            IOexception::raise(io_errc::not_registered);
+        }
+        catch (const IOexception::IOException &e) {
+            caught = true;
+            CHECK(e.what() == IOexception::describe(io_errc::not_registered));
+            CHECK(e.code() == (long)io_errc::not_registered);
+        }
+        CHECK(caught);
+        CHECK(IOexception::last_error().error_code == (long)io_errc::not_registered);
+
+        // Catchable as a plain std::exception too
+        caught = false;
+        try {
+            IOexception::raise(io_errc::cannot_map);
+        }
+        catch (const std::exception &e) {
+            caught = strcmp(e.what(), "CANNOT_MAP_BLOCK_EXCEPTION") == 0;
+        }
+        CHECK(caught);
+    }
+}
+
+
+int main()
+{
+    category_maps_every_code();
+    result_holds_value_or_error();
+    last_error_is_per_thread();
+    raise_throws_the_static_text();
+    return crunchy::test::result("exception");
+}
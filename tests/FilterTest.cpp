@@ -0,0 +1,178 @@
+// FilterTest.cpp : Cuckoo relocation, erase, spill-over and false positive rates of the UID membership filters.
+//
+
+#include "Test.h"
+#include "../include/CRH_Filter.h"
+#include "../include/CRH_Shard.h"
+#include <atomic>
+#include <thread>
+
+using namespace crunchy;
+
+namespace
+{
+    /// \brief Keys spread like real UIDs, never 0
+    uint64_t key_of(uint64_t i)
+    {
+        return i * 0x9E3779B97F4A7C15ULL + 1;
+    }
+
+
+    void relocation_keeps_every_key()
+    {
+        filter::cuckoo_filter f(10000, 0.001);
+        size_t slots = (f.size_bytes() / sizeof(uint64_t)) * f.slots();
+
+        // Fill far past where the two home buckets are free, inserts have to kick fingerprints around
+        uint64_t n = 0;
+        while (n < slots * 95 / 100 && f.insert(key_of(n))) {
+            ++n;
+        }
+        CHECK(n >= slots * 90 / 100);
+        CHECK(f.size() == n);
+
+        size_t missing = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            missing += f.maybe_contains(key_of(i)) ? 0 : 1;
+        }
+        CHECK(missing == 0);
+    }
+
+
+    void lookups_never_miss_during_relocation()
+    {
+        filter::cuckoo_filter f(20000, 0.001);
+        size_t slots = (f.size_bytes() / sizeof(uint64_t)) * f.slots();
+
+        std::atomic<uint64_t> published(0);
+        std::atomic<bool> done(false);
+        std::atomic<size_t> misses(0);
+
+        std::thread reader([&]() {
+            while (!done.load(std::memory_order_acquire)) {
+                uint64_t upto = published.load(std::memory_order_acquire);
+                for (uint64_t i = 0; i < upto; i += 7) {
+                    if (!f.maybe_contains(key_of(i))) {
+                        ++misses;
+                    }
+                }
+            }
+        });
+
+        for (uint64_t i = 0; i < slots * 93 / 100; ++i) {
+            if (!f.insert(key_of(i))) {
+                break;
+            }
+            published.store(i + 1, std::memory_order_release);
+        }
+        done.store(true, std::memory_order_release);
+        reader.join();
+
+        CHECK(misses == 0);
+    }
+
+
+    void erase_removes_only_its_key()
+    {
+        filter::cuckoo_filter f(20000, 0.001);
+        const uint64_t n = 20000;
+        for (uint64_t i = 0; i < n; ++i) {
+            REQUIRE(f.insert(key_of(i)));
+        }
+
+        for (uint64_t i = 0; i < n; i += 2) {
+            CHECK(f.erase(key_of(i)));
+        }
+        CHECK(f.size() == n / 2);
+
+        size_t stale = 0, missing = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            bool in = f.maybe_contains(key_of(i));
+            if (i % 2 == 0) {
+                stale += in ? 1 : 0;
+            }
+            else {
+                missing += in ? 0 : 1;
+            }
+        }
+        CHECK(missing == 0);
+        CHECK(stale < n / 2 / 100);
+
+        // Erased room can be used again
+        for (uint64_t i = 0; i < n; i += 2) {
+            CHECK(f.insert(key_of(i)));
+        }
+        CHECK(f.size() == n);
+    }
+
+
+    void overflow_goes_to_bloom()
+    {
+        filter::membership_filter f(1000, 0.001);
+        const uint64_t n = 4000;
+        for (uint64_t i = 0; i < n; ++i) {
+            f.insert(key_of(i));
+        }
+        CHECK(f.overflowed() > 0);
+
+        size_t missing = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            missing += f.maybe_contains(key_of(i)) ? 0 : 1;
+        }
+        CHECK(missing == 0);
+
+        // Keys still in the cuckoo filter go, spilled keys stay in the Bloom filter, nothing is lost
+        for (uint64_t i = 0; i < n; i += 2) {
+            f.erase(key_of(i));
+        }
+        for (uint64_t i = 1; i < n; i += 2) {
+            CHECK(f.maybe_contains(key_of(i)));
+        }
+    }
+
+
+    void filter_is_independent_of_the_ring()
+    {
+        for (uint64_t i = 0; i < 1000; ++i) {
+            CHECK(filter::filter_hash(key_of(i)) != shard::shard_hash(key_of(i)));
+        }
+
+        // A shard's filter only ever holds UIDs from its own ring ranges, probe with absent UIDs from
+        // the same ranges and the rate must still be what the filter was sized for
+        shard::hash_ring ring;
+        for (uint32_t s = 0; s < 4; ++s) {
+            ring.add(s);
+        }
+
+        filter::cuckoo_filter f(20000, 0.01);
+        uint64_t i = 0, inserted = 0;
+        while (inserted < 18000) {
+            uint64_t k = key_of(i++);
+            if (ring.owner(shard::shard_hash(k)) == 0) {
+                REQUIRE(f.insert(k));
+                ++inserted;
+            }
+        }
+
+        size_t probes = 0, hits = 0;
+        while (probes < 200000) {
+            uint64_t k = key_of(i++);
+            if (ring.owner(shard::shard_hash(k)) == 0) {
+                ++probes;
+                hits += f.maybe_contains(k) ? 1 : 0;
+            }
+        }
+        CHECK((double)hits / probes <= f.false_positive_rate() * 1.5);
+    }
+}
+
+
+int main()
+{
+    relocation_keeps_every_key();
+    lookups_never_miss_during_relocation();
+    erase_removes_only_its_key();
+    overflow_goes_to_bloom();
+    filter_is_independent_of_the_ring();
+    return crunchy::test::result("filter");
+}
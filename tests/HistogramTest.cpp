@@ -0,0 +1,168 @@
+// HistogramTest.cpp : Percentiles, precision, merging and .hgrm output of stats::histogram.
+//
+
+#include "Test.h"
+#include "../include/CRH_Histogram.h"
+#include <string.h>
+
+using crunchy::stats::histogram;
+
+namespace
+{
+    /// \brief TRUE if got is within the histogram precision (1 part in 1024) above want
+    bool close_above(uint64_t got, uint64_t want)
+    {
+        return got >= want && got - want <= want / 1024 + 1;
+    }
+
+
+    void empty_histogram()
+    {
+        histogram h;
+        CHECK(h.count() == 0);
+        CHECK(h.percentile(50.0) == 0);
+        CHECK(h.min() == 0);
+        CHECK(h.max() == 0);
+        CHECK(h.mean() == 0.0);
+    }
+
+
+    void small_values_are_exact()
+    {
+        histogram h;
+        for (uint64_t v = 1; v <= 100; ++v) {
+            h.record(v);
+        }
+
+        CHECK(h.count() == 100);
+        CHECK(h.min() == 1);
+        CHECK(h.max() == 100);
+        CHECK(h.mean() == 50.5);
+        CHECK(h.percentile(0.0) == 1);
+        CHECK(h.percentile(50.0) == 50);
+        CHECK(h.percentile(99.0) == 99);
+        CHECK(h.percentile(100.0) == 100);
+    }
+
+
+    void large_values_keep_precision()
+    {
+        histogram h;
+        for (uint64_t v = 1; v <= 1000000; ++v) {
+            h.record(v * 1000);
+        }
+
+        CHECK(close_above(h.percentile(50.0), 500000000ULL));
+        CHECK(close_above(h.percentile(99.0), 990000000ULL));
+        CHECK(close_above(h.percentile(99.9), 999000000ULL));
+        CHECK(h.percentile(100.0) == 1000000000ULL);
+        CHECK(h.max() == 1000000000ULL);
+    }
+
+
+    void bucket_edges()
+    {
+        // Every value lands in a bucket whose top is at or just above it
+        histogram h;
+        const uint64_t edges[] = { 2047, 2048, 2049, 4095, 4096, 4097, 1ULL << 30, (1ULL << 30) + 1, (1ULL << 40) - 1 };
+        for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); ++i) {
+            h.reset();
+            h.record(edges[i]);
+            h.record(edges[i] + (edges[i] >> 10) + 2); // Sits above every value in edges[i]'s bucket
+            CHECK(close_above(h.percentile(50.0), edges[i]));
+        }
+    }
+
+
+    void out_of_range_goes_to_the_last_bucket()
+    {
+        histogram h;
+        h.record(UINT64_MAX);
+        h.record(1);
+        CHECK(h.count() == 2);
+        CHECK(h.max() == UINT64_MAX);
+        CHECK(h.percentile(100.0) == UINT64_MAX);
+        CHECK(h.percentile(50.0) == 1);
+    }
+
+
+    void merge_adds_everything()
+    {
+        histogram a, b;
+        for (uint64_t v = 1; v <= 1000; ++v) {
+            a.record(v);
+            b.record(v + 1000);
+        }
+        a.merge(b);
+
+        CHECK(a.count() == 2000);
+        CHECK(a.min() == 1);
+        CHECK(a.max() == 2000);
+        CHECK(a.percentile(50.0) == 1000);
+        CHECK(a.percentile(75.0) == 1500);
+
+        a.reset();
+        CHECK(a.count() == 0);
+        CHECK(a.percentile(50.0) == 0);
+    }
+
+
+    void hgrm_output()
+    {
+        histogram h;
+        for (uint64_t v = 1; v <= 10; ++v) {
+            h.record(v * 1000);
+        }
+
+        FILE *fp = tmpfile();
+        REQUIRE(fp != NULL);
+        h.write_hgrm(fp, 1000.0);
+        rewind(fp);
+
+        char line[256];
+        int rows = 0;
+        bool header = false, mean = false, max = false;
+        double lastValue = 0.0, lastQ = 0.0;
+        while (fgets(line, sizeof(line), fp)) {
+            double value, q;
+            unsigned long long total;
+            if (strstr(line, "Percentile")) {
+                header = true;
+            }
+            else if (strncmp(line, "#[Mean", 6) == 0) {
+                mean = strstr(line, "5.500") != NULL;
+            }
+            else if (strncmp(line, "#[Max", 5) == 0) {
+                max = strstr(line, "10.000") != NULL && strstr(line, " 10]") != NULL;
+            }
+            else if (sscanf(line, "%lf %lf %llu", &value, &q, &total) == 3) {
+                CHECK(value > lastValue);
+                CHECK(q > lastQ);
+                lastValue = value;
+                lastQ = q;
+                ++rows;
+            }
+        }
+        fclose(fp);
+
+        CHECK(header);
+        CHECK(mean);
+        CHECK(max);
+        CHECK(rows == 10);
+        CHECK(lastQ == 1.0);
+        CHECK(lastValue == 10.0);
+    }
+}
+
+
+int main()
+{
+    empty_histogram();
+    small_values_are_exact();
+    large_values_keep_precision();
+    bucket_edges();
+    out_of_range_goes_to_the_last_bucket();
+    merge_adds_everything();
+    hgrm_output();
+    return crunchy::test::result("histogram");
+}
@@ -0,0 +1,166 @@
+// InternTest.cpp : Handle round trips, find, out-of-range handles and full shards of the string interner.
+//
+
+#include "Test.h"
+#include "../include/CRH_Intern.h"
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace crunchy;
+
+namespace
+{
+    void round_trip()
+    {
+        uint32_t a = *intern::intern("component-a", 11);
+        uint32_t b = *intern::intern(std::string("component-b"));
+
+        CHECK(a != INTERN_NULL);
+        CHECK(b != INTERN_NULL);
+        CHECK(a != b);
+        CHECK(strcmp(intern::lookup(a), "component-a") == 0);
+        CHECK(intern::length(a) == 11);
+        CHECK(*intern::intern("component-a", 11) == a);
+
+        // Not NUL terminated input still comes back terminated
+        const char raw[] = { 'x', 'y', 'z', '!' };
+        uint32_t x = *intern::intern(raw, 3);
+        CHECK(strcmp(intern::lookup(x), "xyz") == 0);
+    }
+
+
+    void istring_round_trip()
+    {
+        intern::istring s("registry");
+        intern::istring t(std::string("registry"));
+        intern::istring e;
+
+        CHECK(s == t);
+        CHECK(s.str() == "registry");
+        CHECK(s.size() == 8);
+        CHECK(!s.empty());
+        CHECK(e.empty());
+        CHECK(strcmp(e.c_str(), "") == 0);
+        CHECK(intern::istring::from_handle(s.handle()) == s);
+    }
+
+
+    void find_does_not_intern()
+    {
+        CHECK(intern::find("never-interned", 14) == INTERN_NULL);
+        CHECK(intern::find("never-interned", 14) == INTERN_NULL);
+
+        uint32_t h = *intern::intern("now-interned", 12);
+        CHECK(intern::find("now-interned", 12) == h);
+        CHECK(intern::find("", 0) == INTERN_NULL);
+        CHECK(intern::intern("", 0).ok());
+        CHECK(*intern::intern("", 0) == INTERN_NULL);
+    }
+
+
+    void out_of_range_handles()
+    {
+        // Past the page table of every shard, and a valid index no string was given yet
+        const uint32_t bad[] = { 0xFFFFFFFFU, 0x7FFFFFF3U, (1U << 28) | 5U, 0x00FFFFF0U };
+        for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+            CHECK(strcmp(intern::lookup(bad[i]), "") == 0);
+            CHECK(intern::length(bad[i]) == 0);
+        }
+    }
+
+
+    void concurrent_interning_agrees()
+    {
+        const int names = 2000;
+        std::vector<std::vector<uint32_t> > got(4, std::vector<uint32_t>(names));
+        std::vector<std::thread> pool;
+        for (size_t t = 0; t < got.size(); ++t) {
+            pool.emplace_back([&got, t]() {
+                for (int i = 0; i < names; ++i) {
+                    std::string s = "concurrent-" + std::to_string(i);
+                    got[t][i] = *intern::intern(s);
+                }
+            });
+        }
+        for (size_t t = 0; t < pool.size(); ++t) {
+            pool[t].join();
+        }
+
+        for (int i = 0; i < names; ++i) {
+            CHECK(intern::lookup(got[0][i]) == "concurrent-" + std::to_string(i));
+            for (size_t t = 1; t < got.size(); ++t) {
+                CHECK(got[t][i] == got[0][i]);
+            }
+        }
+    }
+
+
+    void full_shards_refuse_new_strings()
+    {
+        uint32_t known = *intern::intern("known-before-the-cap", 20);
+
+        // Fill every shard up to the cap, the strings that fit must all stay readable
+        const uint32_t cap = 1000;
+        intern::set_shard_limit(cap);
+
+        std::vector<uint32_t> kept;
+        std::vector<std::string> keptNames;
+        size_t failed = 0;
+        for (int i = 0; i < 40000; ++i) {
+            std::string s = "fill-" + std::to_string(i);
+            IOexception::io_result<uint32_t> h = intern::intern(s);
+            if (h.ok()) {
+                CHECK(*h != INTERN_NULL);
+                kept.push_back(*h);
+                keptNames.push_back(s);
+            }
+            else {
+                CHECK(h.error() == IOexception::io_errc::out_of_range);
+                CHECK(intern::find(s.data(), s.size()) == INTERN_NULL);
+                ++failed;
+            }
+        }
+        CHECK(failed > 0);
+        CHECK(!kept.empty());
+        CHECK(kept.size() <= (size_t)cap << INTERN_SHARD_BITS);
+        CHECK(IOexception::last_error().error_code == (long)IOexception::io_errc::out_of_range);
+        for (size_t i = 0; i < kept.size(); ++i) {
+            CHECK(intern::lookup(kept[i]) == keptNames[i]);
+            CHECK(*intern::intern(keptNames[i]) == kept[i]);
+        }
+
+        IOexception::io_result<uint32_t> again = intern::intern("known-before-the-cap", 20);
+        CHECK(again.ok() && *again == known);
+        CHECK(intern::intern("", 0).ok());
+
+        // A name that did not make it never passes for "" or for another failed name
+        intern::istring lost("lost-after-the-cap");
+        intern::istring other(std::string("other-after-the-cap"));
+        intern::istring empty;
+        CHECK(!lost.valid());
+        CHECK(lost != empty);
+        CHECK(lost != other);
+        CHECK(!(lost == lost));
+        CHECK(!lost.empty());
+        CHECK(strcmp(lost.c_str(), "") == 0);
+        CHECK(intern::istring("known-before-the-cap").valid());
+        CHECK(empty.valid() && empty == intern::istring(""));
+
+        intern::set_shard_limit(0xFFFFFFFFU);
+        CHECK(intern::istring("lost-after-the-cap").valid());
+    }
+}
+
+
+int main()
+{
+    round_trip();
+    istring_round_trip();
+    find_does_not_intern();
+    out_of_range_handles();
+    concurrent_interning_agrees();
+    full_shards_refuse_new_strings();
+    return crunchy::test::result("intern");
+}
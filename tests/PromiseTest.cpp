@@ -0,0 +1,225 @@
+// PromiseTest.cpp : Report ordering, misses, slot reuse and the local report socket of the heartbeat engine.
+//
+
+#include "Test.h"
+#include "../include/CRH_Promise.h"
+#include "../include/CRH_TempVarData.h"
+#include <string.h>
+#include <type_traits>
+#include <vector>
+
+using namespace crunchy;
+
+namespace
+{
+    /// \brief Keeps every batch the engine sends
+    class capture_sink : public promise::report_sink
+    {
+        public:
+            bool send(const unsigned char *batch, size_t len)
+            {
+                batches.push_back(std::vector<unsigned char>(batch, batch + len));
+                return true;
+            }
+
+            promise::promise_header_t header(size_t i) const
+            {
+                promise::promise_header_t hdr;
+                memcpy(&hdr, &batches[i][0], sizeof(hdr));
+                return hdr;
+            }
+
+            /// \brief Records of every batch, in send order
+            std::vector<promise::promise_record_t> records() const
+            {
+                std::vector<promise::promise_record_t> out;
+                for (size_t i = 0; i < batches.size(); ++i) {
+                    size_t n = header(i).count;
+                    for (size_t r = 0; r < n; ++r) {
+                        promise::promise_record_t rec;
+                        memcpy(&rec, &batches[i][sizeof(promise::promise_header_t) + r * sizeof(rec)], sizeof(rec));
+                        out.push_back(rec);
+                    }
+                }
+                return out;
+            }
+
+            std::vector<std::vector<unsigned char>> batches;
+    };
+
+
+    void strict_promises_go_first()
+    {
+        capture_sink sink;
+        promise::heartbeat_engine eng(&sink, 256);
+
+        uint32_t a = eng.promise(PROMISE_NO_SLOT, 10, false, 1);
+        uint32_t b = eng.promise(PROMISE_NO_SLOT, 11, true, 2);
+        uint32_t c = eng.promise(PROMISE_NO_SLOT, 12, false, 3);
+        uint32_t d = eng.promise(PROMISE_NO_SLOT, 13, true, 4);
+        REQUIRE(a == 0 && b == 1 && c == 2 && d == 3);
+
+        eng.beat(a);
+        eng.beat(c);
+        eng.beat(d);
+        CHECK(eng.tick() == 4);
+
+        REQUIRE(sink.batches.size() == 1);
+        CHECK(sink.header(0).magic == PROMISE_REPORT_MAGIC);
+        CHECK(sink.header(0).tick == 1);
+        CHECK(sink.header(0).missed == 0);
+
+        std::vector<promise::promise_record_t> recs = sink.records();
+        REQUIRE(recs.size() == 4);
+        CHECK(recs[0].slot == b && recs[0].key == 11 && recs[0].objects == 2);
+        CHECK(recs[0].flags == (PROMISE_ACTIVE | PROMISE_STRICT | PROMISE_MISSED));
+        CHECK(recs[1].slot == d && recs[1].flags == (PROMISE_ACTIVE | PROMISE_STRICT));
+        CHECK(recs[2].slot == a && recs[2].flags == PROMISE_ACTIVE);
+        CHECK(recs[3].slot == c && recs[3].flags == PROMISE_ACTIVE);
+    }
+
+
+    void misses_are_counted()
+    {
+        capture_sink sink;
+        promise::heartbeat_engine eng(&sink, 256);
+
+        for (int i = 0; i < 5; ++i) {
+            eng.promise(PROMISE_NO_SLOT, (uint32_t)i, false, 1);
+        }
+        uint32_t s = eng.promise(PROMISE_NO_SLOT, 99, true, 1);
+        eng.beat(1);
+
+        // Plain misses are only counted, strict misses are listed
+        CHECK(eng.tick() == 2);
+        REQUIRE(sink.batches.size() == 1);
+        CHECK(sink.header(0).missed == 4);
+        std::vector<promise::promise_record_t> recs = sink.records();
+        REQUIRE(recs.size() == 2);
+        CHECK(recs[0].slot == s && (recs[0].flags & PROMISE_MISSED));
+        CHECK(recs[1].slot == 1);
+
+        // Beats are per tick, nothing carries over
+        sink.batches.clear();
+        CHECK(eng.tick() == 1);
+        CHECK(sink.header(0).tick == 2);
+        CHECK(sink.header(0).missed == 5);
+    }
+
+
+    void large_ticks_are_split()
+    {
+        capture_sink sink;
+        promise::heartbeat_engine eng(&sink, PROMISE_MAX_BATCH + 1000);
+
+        for (uint32_t i = 0; i < PROMISE_MAX_BATCH + 1000; ++i) {
+            REQUIRE(eng.promise(PROMISE_NO_SLOT, i, false, 1) == i);
+            if (i % 10 != 0) {
+                eng.beat(i);
+            }
+        }
+        CHECK(eng.promise(PROMISE_NO_SLOT, 0, false, 1) == PROMISE_NO_SLOT);
+
+        size_t beaten = (PROMISE_MAX_BATCH + 1000) - (PROMISE_MAX_BATCH + 1000 + 9) / 10;
+        CHECK(eng.tick() == beaten);
+        REQUIRE(sink.batches.size() == 2);
+        CHECK(sink.header(0).count == PROMISE_MAX_BATCH);
+        CHECK(sink.header(0).missed == 0);
+        CHECK(sink.header(1).missed == (PROMISE_MAX_BATCH + 1000 + 9) / 10);
+        CHECK(sink.records().size() == beaten);
+    }
+
+
+    void released_slots_are_reused_clean()
+    {
+        capture_sink sink;
+        promise::heartbeat_engine eng(&sink, 256);
+
+        uint32_t old = eng.promise(PROMISE_NO_SLOT, 1, true, 1);
+        eng.promise(PROMISE_NO_SLOT, 2, false, 1);
+
+        // The old holder beats and leaves before the tick
+        eng.beat(old);
+        eng.release(old);
+        eng.release(old);
+
+        uint32_t reused = eng.promise(PROMISE_NO_SLOT, 3, true, 7);
+        CHECK(reused == old);
+
+        eng.tick();
+        std::vector<promise::promise_record_t> recs = sink.records();
+        REQUIRE(recs.size() == 1);
+        CHECK(recs[0].slot == reused && recs[0].key == 3 && recs[0].objects == 7);
+        CHECK(recs[0].flags & PROMISE_MISSED);
+        CHECK(sink.header(0).missed == 1);
+
+        // A beat after the release is dropped by the next promise too
+        eng.release(reused);
+        eng.beat(reused);
+        reused = eng.promise(PROMISE_NO_SLOT, 4, true, 1);
+        sink.batches.clear();
+        eng.tick();
+        recs = sink.records();
+        REQUIRE(recs.size() == 1);
+        CHECK(recs[0].flags & PROMISE_MISSED);
+    }
+
+
+    void reports_reach_the_local_socket()
+    {
+        promise::local_report_socket server;
+        REQUIRE(!server.status());
+        promise::heartbeat_engine eng(&server, 64);
+
+        uint32_t s = eng.promise(PROMISE_NO_SLOT, promise::promise_key("socket"), true, 1);
+        eng.beat(s);
+        CHECK(eng.tick() == 1);
+
+        unsigned char buf[256];
+        size_t got = server.receive(buf, sizeof(buf));
+        REQUIRE(got == sizeof(promise::promise_header_t) + sizeof(promise::promise_record_t));
+        promise::promise_record_t rec;
+        memcpy(&rec, buf + sizeof(promise::promise_header_t), sizeof(rec));
+        CHECK(rec.slot == s);
+        CHECK(rec.key == promise::promise_key("socket"));
+        CHECK(server.receive(buf, sizeof(buf)) == 0);
+    }
+
+
+    void registers_own_their_slot()
+    {
+        static_assert(!std::is_copy_constructible<Register>::value, "copies would share a promise slot");
+        static_assert(!std::is_copy_assignable<Register>::value, "copies would share a promise slot");
+
+        Register first(64, "first");
+        first.promise("first", true, 1);
+        uint32_t slot = first.promise_slot();
+        REQUIRE(slot != PROMISE_NO_SLOT);
+
+        // The moved-from register releases nothing when it goes
+        Register owner(64, "owner");
+        {
+            Register moved(std::move(first));
+            CHECK(first.promise_slot() == PROMISE_NO_SLOT);
+            CHECK(moved.promise_slot() == slot);
+            owner = std::move(moved);
+        }
+        CHECK(owner.promise_slot() == slot);
+
+        Register other(64, "other");
+        other.promise("other", false, 1);
+        CHECK(other.promise_slot() != slot);
+    }
+}
+
+
+int main()
+{
+    strict_promises_go_first();
+    misses_are_counted();
+    large_ticks_are_split();
+    released_slots_are_reused_clean();
+    reports_reach_the_local_socket();
+    registers_own_their_slot();
+    return crunchy::test::result("promise");
+}
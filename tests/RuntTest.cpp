@@ -0,0 +1,196 @@
+// RuntTest.cpp : Block splitting, ordering and per-block windows of runt::run_blocks and Register::runt.
+//
+
+#include "Test.h"
+#include "../include/CRH_Runt.h"
+#include "../include/CRH_MappedFile.h"
+#include "../include/CRH_TempVarData.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+using namespace crunchy;
+
+namespace
+{
+    /// \brief Byte at offset i of every test file, so a block can check it got the right window
+    unsigned char pattern(uint64_t i)
+    {
+        return (unsigned char)(i * 131 + (i >> 12));
+    }
+
+
+    std::string write_file(const char *name, uint64_t size)
+    {
+        std::string path = std::string("runt_test_") + name;
+        FILE *fp = fopen(path.c_str(), "wb");
+        REQUIRE(fp != NULL);
+        for (uint64_t i = 0; i < size; ++i) {
+            fputc(pattern(i), fp);
+        }
+        fclose(fp);
+        return path;
+    }
+
+
+    bool block_matches(const runt::runt_block_t &block)
+    {
+        for (size_t i = 0; i < block.length; ++i) {
+            if (block.data[i] != pattern(block.offset + i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+
+    void blocks_are_split_in_order()
+    {
+        size_t gran = paging::page_granularity();
+        std::vector<std::string> paths;
+        paths.push_back(write_file("exact", gran * 3));
+        paths.push_back(write_file("short", gran * 2 + 17));
+        paths.push_back(write_file("tiny", 1));
+
+        std::atomic<size_t> calls(0);
+        auto test = [&](const runt::runt_block_t &block) {
+            ++calls;
+            return block_matches(block);
+        };
+
+        for (unsigned workers = 1; workers <= 4; workers += 3) {
+            calls = 0;
+            std::vector<runt::runt_result_t> res = runt::run_blocks(paths, test, gran, workers);
+            REQUIRE(res.size() == 3 + 3 + 1);
+            CHECK(calls == res.size());
+
+            const size_t files[]     = { 0, 0, 0, 1, 1, 1, 2 };
+            const uint64_t offsets[] = { 0, gran, gran * 2, 0, gran, gran * 2, 0 };
+            const size_t lengths[]   = { gran, gran, gran, gran, gran, 17, 1 };
+            for (size_t i = 0; i < res.size(); ++i) {
+                CHECK(res[i].file == files[i]);
+                CHECK(res[i].offset == offsets[i]);
+                CHECK(res[i].length == lengths[i]);
+                CHECK(res[i].passed);
+                CHECK(res[i].error == IOexception::io_errc::ok);
+            }
+        }
+
+        for (size_t i = 0; i < paths.size(); ++i) {
+            remove(paths[i].c_str());
+        }
+    }
+
+
+    void block_size_rounds_up_to_pages()
+    {
+        size_t gran = paging::page_granularity();
+        std::vector<std::string> paths(1, write_file("round", gran * 2));
+
+        std::vector<runt::runt_result_t> res = runt::run_blocks(paths, block_matches, 1, 2);
+        REQUIRE(res.size() == 2);
+        CHECK(res[0].length == gran);
+        CHECK(res[1].offset == gran);
+        CHECK(res[0].passed && res[1].passed);
+
+        remove(paths[0].c_str());
+    }
+
+
+    void missing_and_empty_files()
+    {
+        std::vector<std::string> paths;
+        paths.push_back("runt_test_does_not_exist");
+        paths.push_back(write_file("empty", 0));
+        paths.push_back(write_file("after", 5));
+
+        std::vector<runt::runt_result_t> res = runt::run_blocks(paths, block_matches, RUNT_BLOCK_SIZE, 2);
+
+        // The missing file reports one failed block, the empty file none at all
+        REQUIRE(res.size() == 2);
+        CHECK(res[0].file == 0);
+        CHECK(res[0].length == 0);
+        CHECK(!res[0].passed);
+        CHECK(res[0].error == IOexception::io_errc::cannot_open);
+        CHECK(res[1].file == 2);
+        CHECK(res[1].length == 5);
+        CHECK(res[1].passed);
+
+        remove(paths[1].c_str());
+        remove(paths[2].c_str());
+    }
+
+
+    void windows_start_mid_file()
+    {
+        size_t gran = paging::page_granularity();
+        std::string path = write_file("window", gran * 3);
+
+        paging::windowed_file_t wf = paging::open_windowed(path, false);
+        REQUIRE(wf.opened);
+        CHECK(wf.size == gran * 3);
+
+        // Unaligned offset, and a length running past the end gets clamped
+        paging::mapped_window_t w = paging::map_window(wf, gran + 5, gran * 4);
+        REQUIRE(w.data != NULL);
+        CHECK(w.length == gran * 2 - 5);
+        CHECK(w.data[0] == pattern(gran + 5));
+        CHECK(w.data[w.length - 1] == pattern(gran * 3 - 1));
+        paging::unmap_window(w);
+        CHECK(w.data == NULL);
+
+        paging::mapped_window_t past = paging::map_window(wf, gran * 3, 1);
+        CHECK(past.data == NULL);
+
+        paging::close_windowed(wf);
+        remove(path.c_str());
+    }
+
+
+    void register_runt_end_to_end()
+    {
+        size_t gran = paging::page_granularity();
+        std::string big   = write_file("register_big", gran * 5 + 3);
+        std::string small = write_file("register_small", gran);
+
+        // The temp file limit has nothing to do with the window size
+        tmp_dt tmpd;
+        tmp_dt::max_tmp_size = 1;
+
+        crunchy::Register reg(64, "runt_test");
+        std::vector<runt::runt_result_t> res = reg.runt(&tmpd, gran * 2, block_matches, big, small.c_str());
+
+        REQUIRE(res.size() == 3 + 1);
+        const size_t files[]     = { 0, 0, 0, 1 };
+        const uint64_t offsets[] = { 0, gran * 2, gran * 4, 0 };
+        const size_t lengths[]   = { gran * 2, gran * 2, gran + 3, gran };
+        for (size_t i = 0; i < res.size(); ++i) {
+            CHECK(res[i].file == files[i]);
+            CHECK(res[i].offset == offsets[i]);
+            CHECK(res[i].length == lengths[i]);
+            CHECK(res[i].passed);
+        }
+
+        // A rejecting tester fails every block but still reports them all in order
+        res = reg.runt(NULL, RUNT_BLOCK_SIZE, [](const runt::runt_block_t &) { return false; }, big);
+        REQUIRE(res.size() == 1);
+        CHECK(res[0].length == gran * 5 + 3);
+        CHECK(!res[0].passed);
+        CHECK(res[0].error == IOexception::io_errc::ok);
+
+        tmp_dt::max_tmp_size = 0;
+        remove(big.c_str());
+        remove(small.c_str());
+    }
+}
+
+
+int main()
+{
+    blocks_are_split_in_order();
+    block_size_rounds_up_to_pages();
+    missing_and_empty_files();
+    windows_start_mid_file();
+    register_runt_end_to_end();
+    return crunchy::test::result("runt");
+}
@@ -0,0 +1,365 @@
+// ShardTest.cpp : Ring ownership, online migration, add_shard failure handling, filtered lookups, collect and the shard server.
+//
+
+#include "Test.h"
+#include "../include/CRH_Shard.h"
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <unistd.h>
+
+using namespace crunchy;
+
+namespace
+{
+    /**
+     * \brief Local shard that can be told to fail.
+     *
+     * \param failAddsAfter - Batches carrying an ADD or PUT accepted before they start failing, -1 never fails
+     * \param failCollect - collect() fails
+     */
+    class flaky_shard : public shard::local_shard
+    {
+        public:
+            flaky_shard() : failAddsAfter(-1), failCollect(false) {}
+
+            std::error_code submit(const shard::shard_op_t *ops, size_t n, shard::shard_reply_t *replies)
+            {
+                bool stores = false;
+                for (size_t i = 0; i < n; ++i) {
+                    stores = stores || ops[i].op == shard::SHARD_ADD || ops[i].op == shard::SHARD_PUT;
+                }
+                if (stores && failAddsAfter >= 0 && failAddsAfter-- == 0) {
+                    failAddsAfter = 0;
+                    return std::make_error_code(std::errc::io_error);
+                }
+                return local_shard::submit(ops, n, replies);
+            }
+
+            std::error_code collect(const shard::hash_range_t *ranges, size_t n, std::vector<uint64_t> &uids)
+            {
+                if (failCollect) {
+                    return std::make_error_code(std::errc::io_error);
+                }
+                return local_shard::collect(ranges, n, uids);
+            }
+
+            int failAddsAfter;
+            bool failCollect;
+    };
+
+
+    const uint64_t UID_COUNT = 20000;
+
+
+    /// \brief Local shard that never rules a UID out and counts the batches reaching it
+    class counting_shard : public shard::local_shard
+    {
+        public:
+            counting_shard() : batches(0) {}
+
+            std::error_code submit(const shard::shard_op_t *ops, size_t n, shard::shard_reply_t *replies)
+            {
+                batches.fetch_add(1);
+                return local_shard::submit(ops, n, replies);
+            }
+
+            bool maybe_contains(uint64_t uid) const { (void)uid; return true; }
+
+            std::atomic<size_t> batches;
+    };
+
+
+    /// \brief Local shard that registers a UID from another thread while it is being copied
+    class calling_shard : public shard::local_shard
+    {
+        public:
+            calling_shard() : reg(NULL), passed(false) {}
+
+            std::error_code entries(std::vector<snapshot::register_entry_t> &out)
+            {
+                if (reg) {
+                    shard::sharded_register *r = reg;
+                    reg = NULL;
+                    pending = std::async(std::launch::async, [r]() {
+                        snapshot::register_entry_t e = {};
+                        e.uid = UID_COUNT + 7;
+                        return !r->insert(e) && r->find(UID_COUNT + 7, NULL);
+                    });
+                    passed = pending.wait_for(std::chrono::seconds(5)) == std::future_status::ready && pending.get();
+                }
+                return local_shard::entries(out);
+            }
+
+            shard::sharded_register *reg;
+            std::future<bool> pending; /**< Outlives collect() if the call was blocked */
+            bool passed;
+    };
+
+
+    void fill(shard::sharded_register &reg)
+    {
+        for (uint64_t uid = 1; uid <= UID_COUNT; ++uid) {
+            snapshot::register_entry_t e = {};
+            e.uid         = uid;
+            e.promise_key = (uint32_t)(uid * 3);
+            REQUIRE(!reg.insert(e));
+        }
+    }
+
+
+    /// \brief Every UID is found with its own entry
+    bool all_reachable(shard::sharded_register &reg)
+    {
+        for (uint64_t uid = 1; uid <= UID_COUNT; ++uid) {
+            snapshot::register_entry_t e;
+            if (!reg.find(uid, &e) || e.promise_key != (uint32_t)(uid * 3)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+
+    void ring_ranges_cover_everything()
+    {
+        shard::hash_ring ring;
+        ring.add(0);
+        ring.add(1);
+        ring.add(2, 40);
+
+        for (uint64_t uid = 0; uid < 5000; ++uid) {
+            uint64_t h = shard::shard_hash(uid);
+            uint32_t owner = ring.owner(h);
+            for (uint32_t s = 0; s < 3; ++s) {
+                std::vector<shard::hash_range_t> r = ring.ranges(s);
+                bool in = false;
+                for (size_t i = 0; i < r.size(); ++i) {
+                    in = in || (h >= r[i].lo && h <= r[i].hi);
+                }
+                CHECK(in == (owner == s));
+            }
+        }
+    }
+
+
+    void migration_moves_only_what_the_new_shard_owns()
+    {
+        shard::local_shard a, b, c;
+        shard::sharded_register reg;
+        REQUIRE(!reg.add_shard(&a));
+        REQUIRE(!reg.add_shard(&b));
+        fill(reg);
+
+        size_t before = a.size();
+        CHECK(a.size() + b.size() == UID_COUNT);
+
+        REQUIRE(!reg.add_shard(&c));
+        CHECK(reg.shards() == 3);
+        CHECK(a.size() + b.size() + c.size() == UID_COUNT);
+        CHECK(c.size() > UID_COUNT / 5);
+        CHECK(a.size() <= before);
+        CHECK(all_reachable(reg));
+
+        CHECK(reg.erase(17));
+        CHECK(!reg.find(17, NULL));
+        CHECK(a.size() + b.size() + c.size() == UID_COUNT - 1);
+    }
+
+
+    void failed_move_rolls_back()
+    {
+        shard::local_shard a, b;
+        flaky_shard c;
+        shard::sharded_register reg;
+        REQUIRE(!reg.add_shard(&a));
+        REQUIRE(!reg.add_shard(&b));
+        fill(reg);
+        size_t sizeA = a.size(), sizeB = b.size();
+
+        // The first chunk lands, the second fails, everything has to come back
+        c.failAddsAfter = 1;
+        CHECK(reg.add_shard(&c));
+        CHECK(reg.shards() == 2);
+        CHECK(c.size() == 0);
+        CHECK(a.size() == sizeA);
+        CHECK(b.size() == sizeB);
+        CHECK(all_reachable(reg));
+
+        // And the register still rebalances afterwards
+        shard::local_shard d;
+        CHECK(!reg.add_shard(&d));
+        CHECK(reg.shards() == 3);
+        CHECK(d.size() > 0);
+        CHECK(all_reachable(reg));
+    }
+
+
+    void failed_collect_rolls_back()
+    {
+        flaky_shard a;
+        shard::local_shard b, c;
+        shard::sharded_register reg;
+        REQUIRE(!reg.add_shard(&a));
+        REQUIRE(!reg.add_shard(&b));
+        fill(reg);
+
+        // b's share reaches c before a's collect fails
+        a.failCollect = true;
+        CHECK(reg.add_shard(&c));
+        a.failCollect = false;
+
+        CHECK(reg.shards() == 2);
+        CHECK(c.size() == 0);
+        CHECK(a.size() + b.size() == UID_COUNT);
+        CHECK(all_reachable(reg));
+    }
+
+
+    void failed_roll_back_keeps_migrating()
+    {
+        shard::local_shard a, b;
+        flaky_shard c;
+        shard::sharded_register reg;
+        REQUIRE(!reg.add_shard(&a));
+        REQUIRE(!reg.add_shard(&b));
+        fill(reg);
+
+        // Neither the move nor the move back can finish
+        c.failAddsAfter = 1;
+        c.failCollect   = true;
+        CHECK(reg.add_shard(&c));
+        CHECK(reg.shards() == 3);
+        CHECK(c.size() > 0);
+        CHECK(all_reachable(reg));
+
+        // Writes while stuck still land somewhere reads look
+        c.failAddsAfter = -1;
+        snapshot::register_entry_t e = {};
+        e.uid = UID_COUNT + 1;
+        CHECK(!reg.insert(e));
+        CHECK(reg.find(UID_COUNT + 1, NULL));
+        CHECK(reg.erase(UID_COUNT + 1));
+
+        // Writes while stuck leave the old shard's copy behind, a snapshot still lists each UID once
+        fill(reg);
+        snapshot::crn_instance_t inst = {};
+        CHECK(!reg.collect(inst));
+        CHECK(inst.registers.size() == UID_COUNT);
+
+        // Once the shard recovers the next add finishes the pending move first
+        c.failCollect = false;
+        shard::local_shard d;
+        CHECK(!reg.add_shard(&d));
+        CHECK(reg.shards() == 4);
+        CHECK(a.size() + b.size() + c.size() + d.size() == UID_COUNT);
+        CHECK(all_reachable(reg));
+    }
+
+
+    void absent_uids_stop_at_the_register_filter()
+    {
+        counting_shard a, b;
+        shard::sharded_register reg(4096);
+        REQUIRE(!reg.add_shard(&a));
+        REQUIRE(!reg.add_shard(&b));
+        for (uint64_t uid = 1; uid <= 2000; ++uid) {
+            snapshot::register_entry_t e = {};
+            e.uid = uid;
+            REQUIRE(!reg.insert(e));
+        }
+
+        // The shard filters let everything through, only the register filter keeps lookups off the shards
+        a.batches = 0;
+        b.batches = 0;
+        size_t found = 0;
+        for (uint64_t uid = 1000000; uid < 1100000; ++uid) {
+            found += reg.find(uid, NULL) ? 1 : 0;
+        }
+        CHECK(found == 0);
+        CHECK(a.batches + b.batches < 1000);
+
+        // Erased UIDs linger until a quarter of the sizing has gone, then the filter is rebuilt without them
+        for (uint64_t uid = 1; uid <= 1900; ++uid) {
+            CHECK(reg.erase(uid));
+        }
+        a.batches = 0;
+        b.batches = 0;
+        for (uint64_t uid = 1; uid <= 1024; ++uid) {
+            CHECK(!reg.find(uid, NULL));
+        }
+        CHECK(a.batches + b.batches < 50);
+
+        for (uint64_t uid = 1025; uid <= 2000; ++uid) {
+            CHECK(reg.find(uid, NULL) == (uid > 1900));
+        }
+        CHECK(a.size() + b.size() == 100);
+    }
+
+
+    void collect_lets_calls_through()
+    {
+        shard::local_shard a;
+        calling_shard b;
+        shard::sharded_register reg;
+        REQUIRE(!reg.add_shard(&a));
+        REQUIRE(!reg.add_shard(&b));
+        fill(reg);
+
+        // Calls are only held off while one shard is copied, and not by the register at all
+        b.reg = &reg;
+        snapshot::crn_instance_t inst = {};
+        CHECK(!reg.collect(inst));
+        CHECK(b.passed);
+        CHECK(inst.registers.size() == UID_COUNT || inst.registers.size() == UID_COUNT + 1);
+        CHECK(reg.find(UID_COUNT + 7, NULL));
+    }
+
+
+    void server_reaps_closed_connections()
+    {
+        std::string path = "shard_test_" + std::to_string((unsigned)getpid()) + ".sock";
+        shard::local_shard backing;
+        shard::shard_server server(&backing);
+        REQUIRE(!server.start(path));
+
+        for (int round = 0; round < 20; ++round) {
+            shard::socket_shard remote;
+            REQUIRE(!remote.connect(path));
+
+            shard::shard_op_t op = {};
+            op.op        = shard::SHARD_PUT;
+            op.entry.uid = (uint64_t)round + 1;
+            shard::shard_reply_t rep;
+            CHECK(!remote.submit(&op, 1, &rep));
+            CHECK(!remote.complete());
+        }
+        CHECK(backing.size() == 20);
+
+        // Each new connection joins the threads of the closed ones, wait for the last to finish
+        for (int tries = 0; tries < 200 && server.threads() > 1; ++tries) {
+            shard::socket_shard probe;
+            REQUIRE(!probe.connect(path));
+            usleep(5000);
+        }
+        CHECK(server.threads() <= 2);
+
+        server.stop();
+        CHECK(server.threads() == 0);
+    }
+}
+
+
+int main()
+{
+    ring_ranges_cover_everything();
+    migration_moves_only_what_the_new_shard_owns();
+    failed_move_rolls_back();
+    failed_collect_rolls_back();
+    failed_roll_back_keeps_migrating();
+    absent_uids_stop_at_the_register_filter();
+    collect_lets_calls_through();
+    server_reaps_closed_connections();
+    return crunchy::test::result("shard");
+}
@@ -0,0 +1,548 @@
+// SharedRegistryTest.cpp : Table operations, slot and name reuse under churn, attach rules and dead writer/owner recovery of shm::shared_registry.
+//
+
+#include "Test.h"
+#include "../include/CRH_SharedRegistry.h"
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace crunchy;
+
+namespace
+{
+    std::string segment_name()
+    {
+        return "/crunchy_test_" + std::to_string((unsigned)getpid());
+    }
+
+
+    /// \brief Second mapping of the segment, for poking slots the way a crashed writer leaves them
+    struct raw_segment
+    {
+        unsigned char *base;
+        size_t size;
+
+        explicit raw_segment(const std::string &name) : base(NULL), size(0)
+        {
+            int fd = shm_open(name.c_str(), O_RDWR, 0);
+            REQUIRE(fd >= 0);
+            struct stat st;
+            REQUIRE(fstat(fd, &st) == 0);
+            size = (size_t)st.st_size;
+            void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            REQUIRE(p != MAP_FAILED);
+            base = (unsigned char *)p;
+        }
+
+        ~raw_segment() { munmap(base, size); }
+
+        shm::shm_header_t &header() { return *(shm::shm_header_t *)base; }
+
+        shm::shm_slot_t &slot(uint32_t i) { return ((shm::shm_slot_t *)(base + header().slots_offset))[i]; }
+
+        /// \brief Slots holding uid
+        uint32_t count_uid(uint64_t uid)
+        {
+            uint32_t n = 0;
+            for (uint32_t i = 0; i < header().capacity; ++i) {
+                n += slot(i).uid.load() == uid;
+            }
+            return n;
+        }
+    };
+
+
+    /// \brief Leaves slot i locked by owner, as if it crashed mid-write
+    void lock_as(raw_segment &raw, uint32_t i, uint32_t owner)
+    {
+        shm::shm_slot_t &s = raw.slot(i);
+        uint64_t seq = (s.lock.load() & 0xFFFFFFFFULL) + 1;
+        REQUIRE(seq & 1);
+        s.lock.store(((uint64_t)owner << 32) | seq);
+    }
+
+
+    /// \brief Registers uid from a child process that then dies without detaching, returns its owner token
+    uint32_t dead_owner(shm::shared_registry &reg, const std::string &name, uint64_t uid)
+    {
+        pid_t child = fork();
+        REQUIRE(child >= 0);
+        if (child == 0) {
+            shm::shared_registry r;
+            _exit(!r.attach(name.c_str()) && r.insert(uid, "child", 0, 0).ok() ? 0 : 1);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        REQUIRE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+        shm::shm_record_t rec;
+        REQUIRE(reg.find(uid, &rec));
+        CHECK(rec.owner_pid == (uint32_t)child);
+        return rec.owner;
+    }
+
+
+    void table_operations(shm::shared_registry &reg)
+    {
+        REQUIRE(reg.insert(11, "alpha", 1, 2).ok());
+        REQUIRE(reg.insert(12, "beta", 3, 4).ok());
+        CHECK(reg.size() == 2);
+
+        shm::shm_record_t rec;
+        REQUIRE(reg.find(11, &rec));
+        CHECK(std::string(reg.name(rec), rec.name_len) == "alpha");
+        CHECK(rec.promise_key == 1 && rec.flags == 2);
+        CHECK(rec.owner_pid == (uint32_t)getpid());
+        CHECK(rec.owner == reg.owner_token() && rec.owner != 0);
+
+        // Update in place keeps the count
+        REQUIRE(reg.insert(11, "alpha", 5, 6).ok());
+        CHECK(reg.size() == 2);
+        REQUIRE(reg.find(11, &rec));
+        CHECK(rec.promise_key == 5);
+
+        // A longer name moves to a bigger block
+        REQUIRE(reg.insert(11, "alpha-renamed-past-sixteen", 5, 6).ok());
+        REQUIRE(reg.find(11, &rec));
+        CHECK(std::string(reg.name(rec), rec.name_len) == "alpha-renamed-past-sixteen");
+
+        CHECK(reg.erase(12));
+        CHECK(!reg.erase(12));
+        CHECK(!reg.find(12, &rec));
+        CHECK(reg.size() == 1);
+        CHECK(reg.erase(11));
+        CHECK(reg.size() == 0);
+
+        CHECK(!reg.insert(SHM_EMPTY_UID, "reserved", 0, 0).ok());
+        CHECK(!reg.insert(SHM_TOMBSTONE_UID, "reserved", 0, 0).ok());
+    }
+
+
+    void missing_lookups_stop_early()
+    {
+        std::string name = segment_name() + "_miss";
+        shm::shared_registry::unlink(name.c_str());
+
+        shm::shared_registry reg;
+        REQUIRE(!reg.attach(name.c_str(), 1024, 64 << 10));
+        raw_segment raw(name);
+
+        shm::shm_record_t rec;
+        CHECK(!reg.find(77, &rec));
+        CHECK(!reg.erase(77));
+
+        // Erasing everything compacts the table as tombstones pile up
+        for (uint64_t uid = 1; uid <= 700; ++uid) {
+            REQUIRE(reg.insert(uid, "full", 0, 0).ok());
+        }
+        for (uint64_t uid = 1; uid <= 700; uid += 2) {
+            CHECK(reg.erase(uid));
+        }
+        for (uint64_t uid = 700; uid >= 2; uid -= 2) {
+            CHECK(reg.erase(uid));
+        }
+        CHECK(reg.size() == 0);
+        CHECK(raw.count_uid(SHM_TOMBSTONE_UID) <= 1024 / 8);
+        CHECK(raw.count_uid(SHM_EMPTY_UID) + raw.count_uid(SHM_TOMBSTONE_UID) == 1024);
+        CHECK(!reg.find(77, &rec));
+
+        // Entries shifted back by a compaction are all still found
+        for (uint64_t uid = 1; uid <= 700; ++uid) {
+            REQUIRE(reg.insert(uid, "again", (uint32_t)uid, 0).ok());
+        }
+        for (uint64_t uid = 1; uid <= 700; uid += 3) {
+            CHECK(reg.erase(uid));
+        }
+        uint32_t lost = 0;
+        for (uint64_t uid = 1; uid <= 700; ++uid) {
+            bool found = reg.find(uid, &rec);
+            lost += found != (uid % 3 != 1) || (found && rec.promise_key != uid);
+        }
+        CHECK(lost == 0);
+
+        reg.detach();
+        shm::shared_registry::unlink(name.c_str());
+    }
+
+
+    /// \brief Same length for every UID, so every name takes a block of one class
+    std::string churn_name(uint64_t uid)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "churn-%08llu", (unsigned long long)uid);
+        return buf;
+    }
+
+
+    void churn_reuses_slots_and_names()
+    {
+        std::string name = segment_name() + "_churn";
+        shm::shared_registry::unlink(name.c_str());
+
+        shm::shared_registry reg;
+        REQUIRE(!reg.attach(name.c_str(), 1024, 64 << 10));
+        raw_segment raw(name);
+
+        // Many times the capacity in registrations, with 600 always live
+        const uint64_t live = 600, rounds = 20000;
+        for (uint64_t uid = 1; uid <= live; ++uid) {
+            REQUIRE(reg.insert(uid, churn_name(uid), 0, 0).ok());
+        }
+        uint32_t failed = 0;
+        for (uint64_t n = 0; n < rounds; ++n) {
+            failed += !reg.erase(1 + n);
+            failed += !reg.insert(live + 1 + n, churn_name(live + 1 + n), 0, 0).ok();
+        }
+        CHECK(failed == 0);
+        CHECK(reg.size() == live);
+
+        shm::shm_record_t rec;
+        REQUIRE(reg.find(rounds + live, &rec));
+        CHECK(std::string(reg.name(rec), rec.name_len) == churn_name(rounds + live));
+        CHECK(!reg.find(1, &rec));
+
+        // Tombstones are reused or compacted away, so misses still find an empty slot early
+        CHECK(raw.count_uid(SHM_EMPTY_UID) + raw.count_uid(SHM_TOMBSTONE_UID) == 1024 - live);
+        CHECK(raw.count_uid(SHM_TOMBSTONE_UID) <= 1024 / 8);
+
+        // Freed name blocks are handed out again instead of growing the arena
+        CHECK(raw.header().arena_used.load() <= (live + 1) * 16);
+
+        reg.detach();
+        shm::shared_registry::unlink(name.c_str());
+    }
+
+
+    void moves_never_hide_entries()
+    {
+        std::string name = segment_name() + "_moves";
+        shm::shared_registry::unlink(name.c_str());
+
+        shm::shared_registry reg;
+        REQUIRE(!reg.attach(name.c_str(), 256, 64 << 10));
+        // Kept entries go in behind churned ones, so they move back as the churned ones go
+        for (uint64_t uid = 1000; uid < 1050; ++uid) {
+            REQUIRE(reg.insert(uid, "moving", 0, 0).ok());
+        }
+        for (uint64_t uid = 1; uid <= 100; ++uid) {
+            REQUIRE(reg.insert(uid, "kept", 0, 0).ok());
+        }
+
+        // Another handle churns next to the kept entries, compacting every few dozen erases
+        std::atomic<bool> done(false);
+        uint32_t failed = 0;
+        std::thread churn([&name, &done, &failed]() {
+            shm::shared_registry r;
+            if (r.attach(name.c_str())) {
+                ++failed;
+                done = true;
+                return;
+            }
+            for (uint64_t n = 50; n < 200000; ++n) {
+                failed += !r.insert(1000 + n, "moving", 0, 0).ok();
+                failed += !r.erase(1000 + n - 50);
+            }
+            done = true;
+        });
+
+        uint32_t missed = 0, lookups = 0;
+        shm::shm_record_t rec;
+        while (!done) {
+            for (uint64_t uid = 1; uid <= 100; ++uid, ++lookups) {
+                missed += !reg.find(uid, &rec);
+            }
+        }
+        churn.join();
+
+        CHECK(failed == 0);
+        CHECK(missed == 0);
+        CHECK(lookups > 0);
+        CHECK(reg.size() == 150);
+
+        reg.detach();
+        shm::shared_registry::unlink(name.c_str());
+    }
+
+
+    void full_arena_is_not_consumed()
+    {
+        std::string name = segment_name() + "_arena";
+        shm::shared_registry::unlink(name.c_str());
+
+        shm::shared_registry reg;
+        REQUIRE(!reg.attach(name.c_str(), 64, 96));
+
+        // Names take power of two blocks, 40 bytes a 64 byte one
+        REQUIRE(reg.insert(1, std::string(40, 'a'), 0, 0).ok());
+        for (int i = 0; i < 1000; ++i) {
+            CHECK(reg.insert(2, std::string(40, 'b'), 0, 0).error() == IOexception::io_errc::out_of_range);
+        }
+
+        // The failed inserts left the arena where it was, so a name that fits still goes in
+        REQUIRE(reg.insert(3, std::string(24, 'c'), 0, 0).ok());
+        shm::shm_record_t rec;
+        REQUIRE(reg.find(3, &rec));
+        CHECK(rec.name_off == 64);
+        CHECK(reg.size() == 2);
+
+        // An erased name's block goes to the next name of its class
+        CHECK(reg.erase(1));
+        REQUIRE(reg.insert(4, std::string(33, 'd'), 0, 0).ok());
+        REQUIRE(reg.find(4, &rec));
+        CHECK(rec.name_off == 0);
+
+        // A rename that does not fit keeps the old name
+        CHECK(!reg.insert(3, std::string(50, 'e'), 9, 0).ok());
+        REQUIRE(reg.find(3, &rec));
+        CHECK(std::string(reg.name(rec), rec.name_len) == std::string(24, 'c') && rec.promise_key == 0);
+
+        reg.detach();
+        shm::shared_registry::unlink(name.c_str());
+    }
+
+
+    void racing_inserts_register_once(shm::shared_registry &reg, const std::string &name, raw_segment &raw)
+    {
+        // Separate handles hold separate leases, as separate processes would
+        std::vector<std::thread> threads;
+        uint32_t failed[4] = {};
+        for (int t = 0; t < 4; ++t) {
+            threads.push_back(std::thread([&name, &failed, t]() {
+                shm::shared_registry r;
+                if (r.attach(name.c_str())) {
+                    ++failed[t];
+                    return;
+                }
+                for (int round = 0; round < 3; ++round) {
+                    for (uint64_t uid = 6000; uid < 6200; ++uid) {
+                        failed[t] += !r.insert(uid, "race", (uint32_t)t, 0).ok();
+                    }
+                    for (uint64_t uid = 6000 + t; uid < 6200; uid += 4) {
+                        r.erase(uid);
+                    }
+                }
+                for (uint64_t uid = 6000; uid < 6200; ++uid) {
+                    failed[t] += !r.insert(uid, "race", (uint32_t)t, 0).ok();
+                }
+            }));
+        }
+        for (size_t t = 0; t < threads.size(); ++t) {
+            threads[t].join();
+        }
+        CHECK(failed[0] + failed[1] + failed[2] + failed[3] == 0);
+
+        uint32_t twice = 0;
+        for (uint64_t uid = 6000; uid < 6200; ++uid) {
+            twice += raw.count_uid(uid) != 1;
+        }
+        CHECK(twice == 0);
+
+        // The handles are gone, so are their entries
+        CHECK(reg.reap_dead_owners() == 200);
+        CHECK(reg.size() == 0);
+    }
+
+
+    void attach_keeps_the_creator_layout(shm::shared_registry &reg, const std::string &name, raw_segment &raw)
+    {
+        // A later process asking for another size gets the segment as it is, nobody resizes it
+        shm::shared_registry other;
+        REQUIRE(!other.attach(name.c_str(), 4096, 1 << 20));
+        CHECK(other.capacity() == reg.capacity());
+        CHECK(other.owner_token() != reg.owner_token());
+
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        REQUIRE(fd >= 0);
+        struct stat st;
+        REQUIRE(fstat(fd, &st) == 0);
+        close(fd);
+        CHECK((size_t)st.st_size == raw.size);
+        other.detach();
+
+        // A header from another layout is refused, not trusted
+        raw.header().magic = 0;
+        CHECK(other.attach(name.c_str()) == IOexception::io_errc::bad_format);
+        raw.header().magic = SHM_REGISTRY_MAGIC;
+        raw.header().version = SHM_REGISTRY_VERSION - 1;
+        CHECK(other.attach(name.c_str()) == IOexception::io_errc::bad_format);
+        raw.header().version = SHM_REGISTRY_VERSION;
+        CHECK(!other.attach(name.c_str()));
+    }
+
+
+    void half_initialized_segment_is_redone()
+    {
+        // A creator that died after sizing the segment leaves it unready with the init lock free
+        std::string name = segment_name() + "_half";
+        shm::shared_registry::unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0660);
+        REQUIRE(fd >= 0);
+        REQUIRE(ftruncate(fd, 1 << 20) == 0);
+        void *p = mmap(NULL, 1 << 20, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        REQUIRE(p != MAP_FAILED);
+        memset(p, 0xAB, 1 << 20);
+        munmap(p, 1 << 20);
+        close(fd);
+
+        shm::shared_registry reg;
+        REQUIRE(!reg.attach(name.c_str(), 256, 4096));
+        CHECK(reg.capacity() == 256);
+        CHECK(reg.size() == 0);
+        REQUIRE(reg.insert(5, "redone", 0, 0).ok());
+        shm::shm_record_t rec;
+        CHECK(reg.find(5, &rec));
+
+        reg.detach();
+        shm::shared_registry::unlink(name.c_str());
+    }
+
+
+    void dead_writer_is_taken_over(shm::shared_registry &reg, const std::string &name, raw_segment &raw)
+    {
+        uint32_t dead = dead_owner(reg, name, 20);
+
+        IOexception::io_result<uint32_t> at = reg.insert(21, "crashed", 0, 0);
+        REQUIRE(at.ok());
+        uint32_t before = reg.size();
+
+        lock_as(raw, *at, dead);
+
+        // The half written entry is dropped and the slot works again
+        shm::shm_record_t rec;
+        CHECK(!reg.find(21, &rec));
+        CHECK(reg.size() == before - 1);
+        CHECK((raw.slot(*at).lock.load() & 1) == 0);
+
+        IOexception::io_result<uint32_t> again = reg.insert(22, "after", 0, 0);
+        CHECK(again.ok());
+        CHECK(reg.find(22, &rec));
+        CHECK(reg.erase(20));
+    }
+
+
+    void reused_lease_is_taken_over(shm::shared_registry &reg, const std::string &name, raw_segment &raw)
+    {
+        uint32_t dead = dead_owner(reg, name, 30);
+
+        // A new process claims the same lease, the dead owner's token no longer matches it
+        int up[2], hold[2];
+        REQUIRE(pipe(up) == 0 && pipe(hold) == 0);
+        pid_t child = fork();
+        REQUIRE(child >= 0);
+        if (child == 0) {
+            close(up[0]);
+            close(hold[1]);
+            shm::shared_registry r;
+            uint32_t token = !r.attach(name.c_str()) && r.insert(32, "successor", 0, 0).ok() ? r.owner_token() : 0;
+            char c;
+            if (write(up[1], &token, sizeof(token)) != (ssize_t)sizeof(token) || read(hold[0], &c, 1) < 0) {
+                _exit(1);
+            }
+            _exit(0);
+        }
+        close(up[1]);
+        close(hold[0]);
+        uint32_t successor = 0;
+        REQUIRE(read(up[0], &successor, sizeof(successor)) == (ssize_t)sizeof(successor));
+        REQUIRE(successor != 0);
+        CHECK((successor >> 16) == (dead >> 16) && successor != dead);
+
+        IOexception::io_result<uint32_t> at = reg.insert(31, "reused", 0, 0);
+        REQUIRE(at.ok());
+        lock_as(raw, *at, dead);
+        CHECK(reg.insert(31, "reused", 7, 0).ok());
+        shm::shm_record_t rec;
+        REQUIRE(reg.find(31, &rec));
+        CHECK(rec.promise_key == 7);
+
+        // Only the dead owner's entry goes, the successor is alive
+        CHECK(reg.reap_dead_owners() == 1);
+        CHECK(!reg.find(30, &rec));
+        CHECK(reg.find(32, &rec));
+
+        // Once the successor exits its entry goes too
+        close(hold[1]);
+        waitpid(child, NULL, 0);
+        close(up[0]);
+        CHECK(reg.reap_dead_owners() == 1);
+        CHECK(!reg.find(32, &rec));
+        CHECK(reg.find(31, &rec));
+    }
+
+
+    void live_writer_is_waited_for(shm::shared_registry &reg, const std::string &name, raw_segment &raw)
+    {
+        shm::shared_registry other;
+        REQUIRE(!other.attach(name.c_str()));
+
+        IOexception::io_result<uint32_t> at = reg.insert(41, "busy", 0, 0);
+        REQUIRE(at.ok());
+        lock_as(raw, *at, other.owner_token());
+
+        shm::shm_slot_t &s = raw.slot(*at);
+        std::thread writer([&s]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            uint64_t w = s.lock.load();
+            s.lock.store((w & 0xFFFFFFFFULL) + 1);
+        });
+
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        CHECK(reg.insert(41, "busy", 9, 0).ok());
+        CHECK(std::chrono::steady_clock::now() - t0 >= std::chrono::milliseconds(150));
+        writer.join();
+
+        shm::shm_record_t rec;
+        REQUIRE(reg.find(41, &rec));
+        CHECK(rec.promise_key == 9);
+
+        // Entries of a live handle stay, a detached one counts as gone
+        REQUIRE(other.insert(42, "other", 0, 0).ok());
+        CHECK(reg.reap_dead_owners() == 0);
+        other.detach();
+        CHECK(reg.reap_dead_owners() == 1);
+        CHECK(!reg.find(42, &rec));
+        CHECK(reg.find(41, &rec));
+    }
+}
+
+
+int main()
+{
+    // A recovery bug would spin forever, fail instead
+    alarm(60);
+
+    std::string name = segment_name();
+    shm::shared_registry::unlink(name.c_str());
+
+    shm::shared_registry reg;
+    REQUIRE(!reg.attach(name.c_str(), 1024, 64 << 10));
+    raw_segment raw(name);
+
+    table_operations(reg);
+    missing_lookups_stop_early();
+    churn_reuses_slots_and_names();
+    moves_never_hide_entries();
+    full_arena_is_not_consumed();
+    racing_inserts_register_once(reg, name, raw);
+    attach_keeps_the_creator_layout(reg, name, raw);
+    half_initialized_segment_is_redone();
+    dead_writer_is_taken_over(reg, name, raw);
+    reused_lease_is_taken_over(reg, name, raw);
+    live_writer_is_waited_for(reg, name, raw);
+
+    reg.detach();
+    shm::shared_registry::unlink(name.c_str());
+    return crunchy::test::result("shared registry");
+}
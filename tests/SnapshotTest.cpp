@@ -0,0 +1,278 @@
+// SnapshotTest.cpp : Capture, save, lookup from the mapping, CRC and bounds checks of CRN snapshots and the CRN entry points.
+//
+
+#include "Test.h"
+#include "../include/CRH_Snapshot.h"
+#include "../include/CRH_Shard.h"
+#include "../include/CRH_Int.h"
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace crunchy;
+
+namespace
+{
+    const char *const SNAP_TEST_PATH = "snapshot_test.crnsnap";
+
+
+    std::vector<unsigned char> read_file(const char *path)
+    {
+        std::vector<unsigned char> bytes;
+        FILE *fp = fopen(path, "rb");
+        REQUIRE(fp != NULL);
+        int c;
+        while ((c = fgetc(fp)) != EOF) {
+            bytes.push_back((unsigned char)c);
+        }
+        fclose(fp);
+        return bytes;
+    }
+
+
+    void write_file(const char *path, const std::vector<unsigned char> &bytes)
+    {
+        FILE *fp = fopen(path, "wb");
+        REQUIRE(fp != NULL);
+        REQUIRE(fwrite(&bytes[0], 1, bytes.size(), fp) == bytes.size());
+        fclose(fp);
+    }
+
+
+    snapshot::snap_section_t *section_table(std::vector<unsigned char> &bytes)
+    {
+        return (snapshot::snap_section_t *)(&bytes[0] + sizeof(snapshot::snap_header_t));
+    }
+
+
+    /// \brief Rewrites the table CRC so only the change under test is wrong
+    void reseal(std::vector<unsigned char> &bytes)
+    {
+        snapshot::snap_header_t *hdr = (snapshot::snap_header_t *)&bytes[0];
+        hdr->table_crc = snapshot::crc32(section_table(bytes), snapshot::SNAP_SECTIONS * sizeof(snapshot::snap_section_t));
+    }
+
+
+    std::string name_of(uint64_t uid)
+    {
+        return "component-" + std::to_string(uid % 97);
+    }
+
+
+    /// \brief Saves 5000 registers spread over two shards and 50 pages
+    void save_live_state()
+    {
+        shard::local_shard a, b;
+        shard::sharded_register reg;
+        REQUIRE(!reg.add_shard(&a));
+        REQUIRE(!reg.add_shard(&b));
+
+        for (uint64_t i = 0; i < 5000; ++i) {
+            snapshot::register_entry_t e;
+            e.uid         = i * 7919 + 3;
+            e.name        = intern::istring(name_of(e.uid));
+            e.promise_key = (uint32_t)i;
+            e.flags       = (uint32_t)(i & 3);
+            REQUIRE(!reg.insert(e));
+        }
+        for (uint32_t p = 0; p < 50; ++p) {
+            snapshot::pages().set(p * 2, intern::istring("page-" + std::to_string(p)));
+        }
+
+        snapshot::crn_instance_t inst = {};
+        inst.default_crn = 7;
+        inst.stdCRN      = "std-crn";
+        CHECK(!snapshot::capture(inst));
+        CHECK(inst.registers.size() == 5000);
+        CHECK(inst.pages.size() == 50);
+
+        IOexception::io_result<uint64_t> written = snapshot::save(inst, SNAP_TEST_PATH);
+        REQUIRE(written.ok());
+        CHECK(*written == read_file(SNAP_TEST_PATH).size());
+    }
+
+
+    void lookups_serve_from_the_mapping()
+    {
+        snapshot::snapshot_view view;
+        REQUIRE(!view.open(SNAP_TEST_PATH));
+        CHECK(view.version() == CRN_SNAPSHOT_VERSION);
+
+        for (uint64_t i = 0; i < 5000; ++i) {
+            uint64_t uid = i * 7919 + 3;
+            snapshot::register_entry_t e;
+            REQUIRE(view.find_register(uid, &e));
+            CHECK(e.uid == uid);
+            CHECK(e.name.str() == name_of(uid));
+            CHECK(e.promise_key == (uint32_t)i);
+            CHECK(e.flags == (uint32_t)(i & 3));
+        }
+        CHECK(!view.find_register(0, NULL));
+        CHECK(!view.find_register(4, NULL));
+        CHECK(!view.find_register(UINT64_MAX, NULL));
+
+        snapshot::page_entry_t p;
+        REQUIRE(view.find_page(14, &p));
+        CHECK(p.virtualUID.str() == "page-7");
+        CHECK(!view.find_page(15, NULL));
+
+        size_t count;
+        IOexception::io_result<const snapshot::snap_crn_t *> crn = view.entries<snapshot::snap_crn_t>(snapshot::SNAP_CRN, &count);
+        REQUIRE(crn.ok() && count == 1);
+        CHECK((*crn)->default_crn == 7);
+        CHECK(std::string(view.string((*crn)->stdCRN), (*crn)->stdCRN.length) == "std-crn");
+
+        // Restoring into a fresh register brings every entry back
+        shard::local_shard c;
+        shard::sharded_register restored;
+        REQUIRE(!restored.add_shard(&c));
+        CHECK(!restored.restore(view));
+        CHECK(c.size() == 5000);
+
+        snapshot::register_entry_t e;
+        CHECK(restored.find(3 + 7919 * 10, &e));
+        CHECK(e.promise_key == 10);
+    }
+
+
+    void corrupt_sections_are_rejected()
+    {
+        std::vector<unsigned char> good = read_file(SNAP_TEST_PATH);
+
+        // A flipped byte in the register section is found on first access, open() stays cheap
+        std::vector<unsigned char> bytes = good;
+        bytes[(size_t)section_table(bytes)[snapshot::SNAP_REGISTER].offset + 5] ^= 0x40;
+        write_file(SNAP_TEST_PATH, bytes);
+        {
+            snapshot::snapshot_view view;
+            REQUIRE(!view.open(SNAP_TEST_PATH));
+            CHECK(!view.find_register(3, NULL));
+            size_t count;
+            CHECK(!view.entries<snapshot::snap_register_t>(snapshot::SNAP_REGISTER, &count));
+            CHECK(count == 0);
+
+            // Other sections are still good
+            CHECK(view.find_page(0, NULL));
+        }
+
+        // A flipped byte in the section table fails open()
+        bytes = good;
+        bytes[sizeof(snapshot::snap_header_t) + 3] ^= 1;
+        write_file(SNAP_TEST_PATH, bytes);
+        {
+            snapshot::snapshot_view view;
+            CHECK(view.open(SNAP_TEST_PATH) == IOexception::io_errc::bad_format);
+            CHECK(!view.is_open());
+        }
+
+        write_file(SNAP_TEST_PATH, good);
+    }
+
+
+    void out_of_bounds_sections_are_rejected()
+    {
+        std::vector<unsigned char> good = read_file(SNAP_TEST_PATH);
+
+        // entry_size * count wraps around to less than one entry
+        std::vector<unsigned char> bytes = good;
+        snapshot::snap_section_t *table = section_table(bytes);
+        table[snapshot::SNAP_REGISTER].count = UINT64_MAX / table[snapshot::SNAP_REGISTER].entry_size + 1;
+        CHECK(table[snapshot::SNAP_REGISTER].entry_size * table[snapshot::SNAP_REGISTER].count <
+              table[snapshot::SNAP_REGISTER].entry_size);
+        reseal(bytes);
+        write_file(SNAP_TEST_PATH, bytes);
+        {
+            snapshot::snapshot_view view;
+            CHECK(view.open(SNAP_TEST_PATH) == IOexception::io_errc::bad_format);
+        }
+
+        // One entry past the end of the file
+        bytes = good;
+        table = section_table(bytes);
+        table[snapshot::SNAP_STRINGS].count = bytes.size() - table[snapshot::SNAP_STRINGS].offset + 1;
+        reseal(bytes);
+        write_file(SNAP_TEST_PATH, bytes);
+        {
+            snapshot::snapshot_view view;
+            CHECK(view.open(SNAP_TEST_PATH) == IOexception::io_errc::bad_format);
+        }
+
+        // Entries of size 0
+        bytes = good;
+        table = section_table(bytes);
+        table[snapshot::SNAP_PAGES].entry_size = 0;
+        reseal(bytes);
+        write_file(SNAP_TEST_PATH, bytes);
+        {
+            snapshot::snapshot_view view;
+            CHECK(view.open(SNAP_TEST_PATH) == IOexception::io_errc::bad_format);
+        }
+
+        // Truncated file
+        bytes = good;
+        bytes.resize(bytes.size() - 8);
+        write_file(SNAP_TEST_PATH, bytes);
+        {
+            snapshot::snapshot_view view;
+            CHECK(view.open(SNAP_TEST_PATH) == IOexception::io_errc::bad_format);
+        }
+
+        write_file(SNAP_TEST_PATH, good);
+        snapshot::snapshot_view view;
+        CHECK(!view.open(SNAP_TEST_PATH));
+    }
+
+
+    void crn_entry_points_round_trip()
+    {
+        shard::local_shard a;
+        shard::sharded_register reg;
+        REQUIRE(!reg.add_shard(&a));
+        for (uint64_t uid = 1; uid <= 100; ++uid) {
+            snapshot::register_entry_t e;
+            e.uid         = uid;
+            e.name        = intern::istring(name_of(uid));
+            e.promise_key = (uint32_t)uid;
+            e.flags       = 0;
+            REQUIRE(!reg.insert(e));
+        }
+
+        remove(CRN_SNAPSHOT_PATH);
+        crn::current.default_crn = 42;
+        crn::stdCRN              = "live-crn";
+        createCRNData();
+
+        // A restarted process starts with nothing set and gets both values back
+        crn::current.default_crn = 0;
+        crn::stdCRN.clear();
+        CHECK(hasCRNInstance() == CRN_SNAPSHOT_VERSION);
+        CHECK(crn::current.default_crn == 42);
+        CHECK(crn::stdCRN == "live-crn");
+
+        size_t count;
+        IOexception::io_result<const snapshot::snap_crn_t *> rec =
+            snapshot::mapped().entries<snapshot::snap_crn_t>(snapshot::SNAP_CRN, &count);
+        REQUIRE(rec.ok() && count == 1);
+        CHECK((*rec)->default_crn == 42);
+
+        snapshot::register_entry_t e;
+        CHECK(snapshot::mapped().find_register(77, &e));
+        CHECK(e.name.str() == name_of(77));
+        CHECK(snapshot::mapped().find_page(2, NULL));
+
+        snapshot::mapped().close();
+        remove(CRN_SNAPSHOT_PATH);
+    }
+}
+
+
+int main()
+{
+    save_live_state();
+    lookups_serve_from_the_mapping();
+    corrupt_sections_are_rejected();
+    out_of_bounds_sections_are_rejected();
+    crn_entry_points_round_trip();
+    remove(SNAP_TEST_PATH);
+    return crunchy::test::result("snapshot");
+}
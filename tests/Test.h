@@ -0,0 +1,48 @@
+/**
+* \file Test.h
+* \brief Minimal test harness
+* \details Each test is its own executable run by ctest, a failed check prints where it failed
+*          and the process exits non-zero.
+* \author Corbin Matschull
+* \version 1
+* \date Oct 19. 2026
+*/
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace crunchy
+{
+    namespace test
+    {
+        /// \brief Failed checks so far
+        inline int &failures()
+        {
+            static int n = 0;
+            return n;
+        }
+
+        inline void fail(const char *file, int line, const char *expr)
+        {
+            fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+            ++failures();
+        }
+
+        /// \brief Exit code for main
+        inline int result(const char *name)
+        {
+            if (failures() == 0) {
+                printf("%s: ok\n", name);
+                return 0;
+            }
+            printf("%s: %d check(s) failed\n", name, failures());
+            return 1;
+        }
+    }
+}
+
+/// \brief Records a failure and keeps going
+#   define  CHECK(expr) do { if (!(expr)) crunchy::test::fail(__FILE__, __LINE__, #expr); } while (0)
+
+/// \brief Records a failure and stops the test, for checks the rest of the test depends on
+#   define  REQUIRE(expr) do { if (!(expr)) { crunchy::test::fail(__FILE__, __LINE__, #expr); exit(1); } } while (0)